@@ -0,0 +1,82 @@
+#!/usr/bin/env bash
+
+# Line-rate benchmark with pktgen, run from the script directory after building.
+# Usage: sudo bash bench.sh [router|switch] [rate_pps] [duration_sec] [pcap|io_uring]
+#
+# router: R2 (pktgen tx) --> R3 (router) --> R4 (pktgen rx), destinations spread over 10.10.0.0/16
+# switch: P12 (pktgen tx) --> BRD1 (switch) --> P13 (pktgen rx)
+# The io backend is used by the device under test and by pktgen on both ends, run once per backend to compare them.
+
+MODE=${1:-router}
+RATE=${2:-0}
+DURATION=${3:-5}
+BACKEND=${4:-pcap}
+SIZES="64 128 256 512 1024 1518 64:7,576:4,1518:1"
+BIN=../build/bin
+DUT_CONFIG=$(mktemp)
+
+if [ "$MODE" = "router" ]; then
+    bash router.sh >/dev/null 2>&1
+    # Drop benchmark traffic in R4 instead of answering with ICMP
+    ip netns exec R4 ip r add blackhole 10.10.0.0/16
+    sed "s/\"trace\": {/\"io\": {\"backend\": \"$BACKEND\"},\n  \"trace\": {/" ../conf/router/r3_bench.json >"$DUT_CONFIG"
+    ip netns exec R3 stdbuf -oL $BIN/router "$DUT_CONFIG" >bench_router.log 2>/dev/null &
+    DUT_PID=$!
+    TX_NS=R2; TX_IF=r2r3; RX_NS=R4; RX_IF=r4r3
+    DST_MAC=$(ip netns exec R3 cat /sys/class/net/r3r2/address)
+    TX_ARGS="--src-ip 10.0.2.9 --dst-ip 10.10.0.1 --dst-spread 65534 --flows 64"
+    sleep 2
+elif [ "$MODE" = "switch" ]; then
+    bash switch.sh >/dev/null 2>&1
+    echo "{\"interfaces\": $(cat ../conf/switch/s.json), \"io\": {\"backend\": \"$BACKEND\"}}" >"$DUT_CONFIG"
+    ip netns exec BRD1 $BIN/switch "$DUT_CONFIG" >/dev/null 2>&1 &
+    DUT_PID=$!
+    TX_NS=P12; TX_IF=veth; RX_NS=P13; RX_IF=veth
+    DST_MAC=$(ip netns exec P13 cat /sys/class/net/veth/address)
+    TX_ARGS="--src-ip 10.0.1.2 --dst-ip 10.0.1.3 --flows 64"
+    sleep 1
+    # Let the switch learn the sink's MAC address
+    ip netns exec P13 ping -c 1 -W 1 10.0.1.2 >/dev/null 2>&1
+else
+    echo "Unknown mode $MODE, expected router or switch"
+    exit 1
+fi
+
+TX_ARGS="$TX_ARGS --backend $BACKEND"
+
+# Warm up, so that the router resolves its next hop before measuring
+ip netns exec $TX_NS $BIN/pktgen tx $TX_IF --dst-mac "$DST_MAC" $TX_ARGS --count 100 --rate 100 >/dev/null 2>&1
+
+echo "Io backend: $BACKEND"
+printf "%-18s %12s %12s %10s %10s %10s %10s %10s\n" "SIZE" "TX_PPS" "RX_PPS" "LOSS" "REORDER" "LAT_P50" "LAT_P99" "LAT_MAX"
+for SIZE in $SIZES; do
+    RX_OUT=$(mktemp)
+    ip netns exec $RX_NS $BIN/pktgen rx $RX_IF --duration $((DURATION + 3)) --backend $BACKEND >"$RX_OUT" 2>/dev/null &
+    RX_PID=$!
+    sleep 0.5
+    TX_OUT=$(ip netns exec $TX_NS $BIN/pktgen tx $TX_IF --dst-mac "$DST_MAC" $TX_ARGS \
+        --size "$SIZE" --rate "$RATE" --duration "$DURATION" 2>/dev/null)
+    wait $RX_PID
+    TX_PPS=$(echo "$TX_OUT" | sed -n 's/.*pps \([0-9]*\).*/\1/p')
+    RX_PPS=$(sed -n 's/^rx: seconds.*pps \([0-9]*\).*/\1/p' "$RX_OUT")
+    LOSS=$(sed -n 's/.*lost [0-9]* (\([0-9.]*%\)).*/\1/p' "$RX_OUT")
+    REORDER=$(sed -n 's/.*reordered \([0-9]*\).*/\1/p' "$RX_OUT")
+    LAT_P50=$(sed -n 's/.*p50 \([0-9.]*\).*/\1/p' "$RX_OUT")
+    LAT_P99=$(sed -n 's/.*p99 \([0-9.]*\).*/\1/p' "$RX_OUT")
+    LAT_MAX=$(sed -n 's/.*max \([0-9.]*\)$/\1/p' "$RX_OUT")
+    printf "%-18s %12s %12s %10s %10s %10s %10s %10s\n" "$SIZE" "${TX_PPS:--}" "${RX_PPS:-0}" "${LOSS:-100%}" \
+        "${REORDER:--}" "${LAT_P50:--}us" "${LAT_P99:--}us" "${LAT_MAX:--}us"
+    rm -f "$RX_OUT"
+done
+
+if [ "$MODE" = "router" ]; then
+    # Latency inside the router over all frame sizes, sampled by the router's trace
+    sleep 5
+    echo
+    awk '/LATENCY TRACE/ { table = ""; start = NR } start && NR - start < 12 { table = table $0 "\n" } END { printf "%s", table }' \
+        bench_router.log
+    rm -f bench_router.log
+fi
+
+kill -9 $DUT_PID
+rm -f "$DUT_CONFIG"
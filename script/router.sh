@@ -16,6 +16,8 @@ done
 # enable ip forward for R2 & R4
 ip netns exec R2 sh -c "echo 1 > /proc/sys/net/ipv4/conf/all/forwarding"
 ip netns exec R4 sh -c "echo 1 > /proc/sys/net/ipv4/conf/all/forwarding"
+# disable kernel IPv6 stack in R3, where the mini-router runs
+ip netns exec R3 sh -c "echo 1 > /proc/sys/net/ipv6/conf/default/disable_ipv6"
 
 # R1 <-> R2
 ip l add r1r2 netns R1 type veth peer name r2r1 netns R2
@@ -33,8 +35,10 @@ ip netns exec R2 ethtool -K r2r1 tx off
 ip l add r2r3 netns R2 type veth peer name r3r2 netns R3
 
 ip netns exec R2 ip a add 10.0.2.9/24 dev r2r3
+ip netns exec R2 ip -6 a add 2001:db8:2::9/64 dev r2r3 nodad
 ip netns exec R2 ip l set r2r3 up
 ip netns exec R2 ethtool -K r2r3 tx off
+ip netns exec R2 ip -6 r add 2001:db8:3::/64 via 2001:db8:2::1
 
 # ip netns exec R3 ip a add 10.0.2.1/24 dev r3r2
 ip netns exec R3 ip l set r3r2 up
@@ -48,8 +52,10 @@ ip netns exec R3 ip l set r3r4 up
 ip netns exec R3 ethtool -K r3r4 tx off
 
 ip netns exec R4 ip a add 10.0.3.9/24 dev r4r3
+ip netns exec R4 ip -6 a add 2001:db8:3::9/64 dev r4r3 nodad
 ip netns exec R4 ip l set r4r3 up
 ip netns exec R4 ethtool -K r4r3 tx off
+ip netns exec R4 ip -6 r add 2001:db8:2::/64 via 2001:db8:3::1
 
 # R4 <-> R5
 ip l add r4r5 netns R4 type veth peer name r5r4 netns R5
@@ -0,0 +1,187 @@
+#!/usr/bin/env bash
+
+# Scale suite: forwarding rate, RIP convergence time, memory and CPU of the router over the number of interfaces,
+# RIP routes and flows. Run from the script directory after building with -DMAX_IF at least the largest interface
+# count, e.g. cmake .. -DCMAKE_BUILD_TYPE=Release -DMAX_IF=256
+# Usage: sudo bash scale.sh [results_file]
+#
+#     DUT (router)                  SH (BIRD, pktgen)
+#       d0 <------------------------> h0       pktgen tx
+#       d1 <------------------------> h1       BIRD RIP announcing the routes, pktgen rx
+#       ...                          ...
+#       dN-1 <----------------------> hN-1
+#   172.16.i.1/24               172.16.i.2/24
+#
+# Routes are /24 prefixes from 30.0.0.0 announced via h1, traffic is spread over one address of each route.
+# Each dimension is swept with the other two at their baseline, set by environment variables:
+#   IF_COUNTS="2 16 64 256" ROUTE_COUNTS="1000 10000 100000" FLOW_COUNTS="1 1000 1000000"
+#   BASE_IFS=2 BASE_ROUTES=1000 BASE_FLOWS=1 SIZE=64 RATE=0 DURATION=5 CONVERGE_TIMEOUT=300
+# One JSON object per scenario is appended to the results file, scale_results.jsonl by default.
+
+RESULTS=${1:-scale_results.jsonl}
+IF_COUNTS=${IF_COUNTS:-"2 16 64 256"}
+ROUTE_COUNTS=${ROUTE_COUNTS:-"1000 10000 100000"}
+FLOW_COUNTS=${FLOW_COUNTS:-"1 1000 1000000"}
+BASE_IFS=${BASE_IFS:-2}
+BASE_ROUTES=${BASE_ROUTES:-1000}
+BASE_FLOWS=${BASE_FLOWS:-1}
+SIZE=${SIZE:-64}
+RATE=${RATE:-0}
+DURATION=${DURATION:-5}
+CONVERGE_TIMEOUT=${CONVERGE_TIMEOUT:-300}
+BIN=../build/bin
+WORK=$(mktemp -d)
+SOCK=/tmp/router-scale.sock
+VERSION=$(git describe --always --dirty 2>/dev/null || echo unknown)
+CLK_TCK=$(getconf CLK_TCK)
+
+function setup_topology() {
+    local IFS_N=$1
+    for NS in DUT SH; do
+        ip netns delete $NS 2>/dev/null || true
+        ip netns add $NS
+        ip -n $NS l set lo up
+    done
+    # disable kernel IPv6 stack in DUT, where the mini-router runs
+    ip netns exec DUT sh -c "echo 1 > /proc/sys/net/ipv6/conf/default/disable_ipv6"
+    for ((i = 0; i < IFS_N; i++)); do
+        ip l add d$i netns DUT type veth peer name h$i netns SH
+        ip -n SH a add 172.16.$i.2/24 dev h$i
+        ip -n DUT l set d$i up
+        ip -n SH l set h$i up
+        ip netns exec DUT ethtool -K d$i tx off >/dev/null     # Disable linux checksum verfication
+        ip netns exec SH ethtool -K h$i tx off >/dev/null
+    done
+}
+
+function write_router_config() {
+    local IFS_N=$1 ROUTES=$2
+    {
+        echo '{'
+        echo '  "interfaces": ['
+        for ((i = 0; i < IFS_N; i++)); do
+            printf '    {"if_name": "d%d", "ip": "172.16.%d.1", "mask": "255.255.255.0"}%s\n' $i $i \
+                "$([ $i -lt $((IFS_N - 1)) ] && echo ,)"
+        done
+        echo '  ],'
+        echo "  \"memory\": {\"route_table_size\": $((ROUTES + IFS_N + 1024))},"
+        echo "  \"control\": {\"socket\": \"$SOCK\"}"
+        echo '}'
+    } >"$WORK/router.json"
+}
+
+function write_bird_config() {
+    local ROUTES=$1
+    awk -v n=$ROUTES 'BEGIN {
+        for (i = 0; i < n; i++) {
+            printf "route %d.%d.%d.0/24 via \"lo\";\n", 30 + int(i / 65536), int(i / 256) % 256, i % 256
+        }
+    }' >"$WORK/static.conf"
+    cat >"$WORK/bird.conf" <<EOF
+# bird version 1.6
+
+router id 2.2.2.2;
+
+protocol device {
+}
+
+protocol static {
+    include "$WORK/static.conf";
+}
+
+protocol rip {
+    import none;
+    export all;
+    interface "h1" {
+        version 2;      # Use RIPv2
+        update time 5;
+    };
+}
+EOF
+}
+
+# Number of routes the router learned from RIP
+function rip_routes() {
+    # Interface names are lower case, so the RIP source column is the only upper case R of a line
+    $BIN/routerctl --socket $SOCK route match R limit 0 2>/dev/null | sed -n 's/^0 of \([0-9]*\) entries.*/\1/p'
+}
+
+# User + system CPU ticks of a process
+function cpu_ticks() {
+    awk '{ print $14 + $15 }' /proc/$1/stat
+}
+
+function run_scenario() {
+    local IFS_N=$1 ROUTES=$2 FLOWS=$3
+    echo "Scenario: $IFS_N interfaces, $ROUTES routes, $FLOWS flows"
+    setup_topology $IFS_N
+    write_router_config $IFS_N $ROUTES
+    write_bird_config $ROUTES
+
+    ip netns exec DUT $BIN/router "$WORK/router.json" >"$WORK/router.log" 2>&1 &
+    local DUT_PID=$!
+    for ((i = 0; i < 50 && ! -S $SOCK; i++)); do sleep 0.1; done
+
+    # RIP convergence: from BIRD start until the router holds all announced routes
+    local START=$(date +%s.%N) LEARNED=0 CONVERGENCE=null
+    ip netns exec SH bird -c "$WORK/bird.conf" -s "$WORK/bird.ctl" -P "$WORK/bird.pid"
+    while true; do
+        LEARNED=$(rip_routes)
+        local ELAPSED=$(echo "$(date +%s.%N) - $START" | bc)
+        if [ "${LEARNED:-0}" -ge "$ROUTES" ]; then
+            CONVERGENCE=$(printf "%.2f" "$ELAPSED")
+            break
+        elif (( $(echo "$ELAPSED > $CONVERGE_TIMEOUT" | bc) )); then
+            echo "RIP did not converge within $CONVERGE_TIMEOUT seconds, $LEARNED of $ROUTES routes learned"
+            break
+        fi
+        sleep 0.2
+    done
+
+    # Forwarding rate: one destination in each route, flows spread over source ports and addresses
+    local DST_MAC=$(ip netns exec DUT cat /sys/class/net/d0/address)
+    local TX_ARGS="--src-ip 172.16.0.2 --dst-ip 30.0.0.1 --dst-spread $ROUTES --dst-stride 256 --flows $FLOWS"
+    # Warm up, so that the router resolves its next hop before measuring
+    ip netns exec SH $BIN/pktgen tx h0 --dst-mac "$DST_MAC" $TX_ARGS --count 100 --rate 100 >/dev/null 2>&1
+    local RX_OUT=$WORK/rx.out
+    ip netns exec SH $BIN/pktgen rx h1 --duration $((DURATION + 3)) >"$RX_OUT" 2>/dev/null &
+    local RX_PID=$!
+    sleep 0.5
+    local TICKS_BEFORE=$(cpu_ticks $DUT_PID)
+    local TX_OUT=$(ip netns exec SH $BIN/pktgen tx h0 --dst-mac "$DST_MAC" $TX_ARGS \
+        --size "$SIZE" --rate "$RATE" --duration "$DURATION" 2>/dev/null)
+    local TICKS_AFTER=$(cpu_ticks $DUT_PID)
+    wait $RX_PID
+    local TX_PPS=$(echo "$TX_OUT" | sed -n 's/.*pps \([0-9]*\).*/\1/p')
+    local RX_PPS=$(sed -n 's/^rx: seconds.*pps \([0-9]*\).*/\1/p' "$RX_OUT")
+    local LOSS=$(sed -n 's/.*lost [0-9]* (\([0-9.]*\)%).*/\1/p' "$RX_OUT")
+    local CPU=$(echo "scale=1; ($TICKS_AFTER - $TICKS_BEFORE) * 100 / $CLK_TCK / $DURATION" | bc)
+    local RSS=$(awk '/^VmRSS/ { print $2 }' /proc/$DUT_PID/status)
+
+    printf '{"version": "%s", "time": "%s", "interfaces": %d, "routes": %d, "flows": %d, "size": %d, ' \
+        "$VERSION" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" $IFS_N $ROUTES $FLOWS $SIZE >>"$RESULTS"
+    printf '"tx_pps": %s, "rx_pps": %s, "loss_pct": %s, "rip_convergence_sec": %s, "rip_routes": %s, ' \
+        "${TX_PPS:-0}" "${RX_PPS:-0}" "${LOSS:-100}" "$CONVERGENCE" "${LEARNED:-0}" >>"$RESULTS"
+    printf '"rss_kb": %s, "cpu_pct": %s}\n' "${RSS:-0}" "${CPU:-0}" >>"$RESULTS"
+    tail -n 1 "$RESULTS"
+
+    kill $(cat "$WORK/bird.pid") 2>/dev/null
+    kill -9 $DUT_PID
+    wait $DUT_PID 2>/dev/null
+    rm -f $SOCK
+}
+
+for N in $IF_COUNTS; do
+    run_scenario $N $BASE_ROUTES $BASE_FLOWS
+done
+# Baseline is only run by the first sweep, if it has the baseline interface count
+for N in $ROUTE_COUNTS; do
+    [[ " $IF_COUNTS " == *" $BASE_IFS "* && $N -eq $BASE_ROUTES ]] || run_scenario $BASE_IFS $N $BASE_FLOWS
+done
+for N in $FLOW_COUNTS; do
+    [[ " $IF_COUNTS " == *" $BASE_IFS "* && $N -eq $BASE_FLOWS ]] || run_scenario $BASE_IFS $BASE_ROUTES $N
+done
+
+ip netns delete DUT
+ip netns delete SH
+rm -rf "$WORK"
@@ -0,0 +1,55 @@
+#include "arena.h"
+#include <stdio.h>
+#include <sys/mman.h>
+
+#define HUGEPAGE_SIZE (2UL << 20)
+#define ARENA_ALIGN 64
+
+RC arena_init(arena_t *arena, size_t capacity, bool hugepage) {
+    arena->used = 0;
+    arena->hugepage = false;
+    arena->base = MAP_FAILED;
+    if (hugepage) {
+        // Hugepages are reserved up front, so only use them when the pool is configured for it
+        arena->capacity = (capacity + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+        arena->base = mmap(NULL, arena->capacity, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (arena->base == MAP_FAILED) {
+            fprintf(stderr, "Cannot map %zu bytes of hugepages, falling back to normal pages\n", arena->capacity);
+        } else {
+            arena->hugepage = true;
+        }
+    }
+    if (arena->base == MAP_FAILED) {
+        arena->capacity = capacity;
+        arena->base = mmap(NULL, arena->capacity, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (arena->base == MAP_FAILED) {
+            perror("mmap()");
+            return OVERFLOW_ERROR;
+        }
+        if (hugepage) {
+            // Transparent hugepages still cut TLB misses when explicit hugepages are not available
+            madvise(arena->base, arena->capacity, MADV_HUGEPAGE);
+        }
+    }
+    return 0;
+}
+
+void arena_destroy(arena_t *arena) {
+    if (arena->base != NULL && arena->base != MAP_FAILED) {
+        munmap(arena->base, arena->capacity);
+    }
+    arena->base = NULL;
+    arena->capacity = arena->used = 0;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (start + size > arena->capacity) {
+        return NULL;
+    }
+    arena->used = start + size;
+    // Anonymous mapping is zero filled
+    return arena->base + start;
+}
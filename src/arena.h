@@ -0,0 +1,42 @@
+#pragma once
+
+#include "error.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+// ===== ARENA =====
+// Bump allocator over one anonymous mapping, optionally backed by hugepages. The whole capacity is reserved up front
+// but pages are only committed when touched, so a table can grow in place up to the arena capacity without moving.
+typedef struct arena {
+    uint8_t *base;
+    size_t capacity;
+    size_t used;
+    bool hugepage;      // Actually backed by hugepages
+} arena_t;
+
+RC arena_init(arena_t *arena, size_t capacity, bool hugepage);
+
+void arena_destroy(arena_t *arena);
+
+// Return memory aligned to 64 bytes, or NULL if the arena is exhausted. Memory is zeroed.
+void *arena_alloc(arena_t *arena, size_t size);
+
+// Grow the array at the end of arena from *capacity to 2 * *capacity elements (at least min_capacity), in place.
+// The array must be the last allocation of the arena, e.g. the only one.
+static inline RC arena_grow(arena_t *arena, void *array, size_t elem_size, int *capacity, int min_capacity) {
+    size_t offset = (uint8_t *) array - arena->base;
+    if (offset + (size_t) *capacity * elem_size != arena->used) {
+        return OVERFLOW_ERROR;
+    }
+    size_t max_capacity = (arena->capacity - offset) / elem_size;
+    size_t new_capacity = *capacity > 0 ? 2 * (size_t) *capacity : (size_t) min_capacity;
+    if (new_capacity > max_capacity) {
+        new_capacity = max_capacity;
+    }
+    if (new_capacity <= (size_t) *capacity) {
+        return OVERFLOW_ERROR;
+    }
+    arena->used = offset + new_capacity * elem_size;
+    *capacity = (int) new_capacity;
+    return 0;
+}
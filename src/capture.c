@@ -0,0 +1,391 @@
+#include "capture.h"
+#include "config.h"
+#include <pcap/pcap.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+const char *drop_reason_names[NUM_DROP_REASONS] = {
+        [DROP_NONE] = "none",
+        [DROP_INVALID] = "invalid",
+        [DROP_POLICED] = "policed",
+        [DROP_QUEUE_FULL] = "queue_full",
+        [DROP_BAD_CHECKSUM] = "bad_checksum",
+        [DROP_NO_ROUTE] = "no_route",
+        [DROP_TTL_EXCEEDED] = "ttl_exceeded",
+        [DROP_NO_NEIGHBOR] = "no_neighbor",
+        [DROP_UNSUPPORTED] = "unsupported",
+        [DROP_VLAN_FILTER] = "vlan_filter",
+        [DROP_STORM] = "storm",
+        [DROP_TOO_BIG] = "too_big",
+};
+
+volatile bool capture_enabled = false;
+
+// Longest stall of forwarding for a free ring slot in lossless mode
+#define CAPTURE_LOSSLESS_WAIT_NS 1000000
+
+// ===== CAPTURE RING =====
+// Single producer (forwarding thread), single consumer (writer thread), lock free.
+typedef struct capture_slot {
+    struct timespec ts;
+    uint32_t caplen;
+    uint32_t len;
+    int16_t if_idx;
+    uint8_t dir;
+    uint8_t reason;
+    // Route chosen for transmitted packet
+    bool has_route;
+    char route_if_name[IF_NAMESIZE];   // Copied here, configs are swapped and freed under the writer
+    uint8_t route_prefix_len;
+    in_addr_t route_dst;
+    in_addr_t route_next_hop;
+    uint8_t data[];
+} capture_slot_t;
+
+static struct {
+    uint8_t *slots;
+    size_t slot_size;
+    uint32_t mask;
+    _Atomic uint32_t head;      // Written by consumer
+    _Atomic uint32_t tail;      // Written by producer
+} ring;
+
+static struct {
+    uint64_t captured;
+    uint64_t filtered;
+    uint64_t lost;              // Ring overflow, or lossless wait timed out
+    _Atomic uint64_t written;
+} capture_stats;
+
+// Pending route annotation for the next transmitted packet
+static struct {
+    bool valid;
+    in_addr_t dst_ip;
+    in_addr_t mask;
+    in_addr_t next_hop;
+    int if_idx;
+} pending_route;
+
+static struct bpf_program bpf;
+static bool has_bpf;
+static pthread_t writer_thread;
+static volatile bool writer_running;
+// Set by SIGUSR1 before the writer runs, started by the forwarding thread in capture_poll()
+static volatile sig_atomic_t start_requested;
+static FILE *capture_file;
+static pcap_t *mirror_handle;
+
+static inline capture_slot_t *ring_slot(uint32_t idx) {
+    return (capture_slot_t *) (ring.slots + (idx & ring.mask) * ring.slot_size);
+}
+
+static uint64_t clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Lossless mode waits for the writer to free a slot, but never longer than CAPTURE_LOSSLESS_WAIT_NS
+static bool ring_wait(uint32_t tail) {
+    if (!capture_config.lossless) {
+        return false;
+    }
+    uint64_t deadline = clock_ns() + CAPTURE_LOSSLESS_WAIT_NS;
+    while (tail - atomic_load_explicit(&ring.head, memory_order_acquire) > ring.mask) {
+        if (!writer_running || clock_ns() >= deadline) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void capture_set_route(in_addr_t dst_ip, in_addr_t mask, in_addr_t next_hop, int if_idx) {
+    if (__builtin_expect(capture_enabled, 0)) {
+        pending_route.valid = true;
+        pending_route.dst_ip = dst_ip;
+        pending_route.mask = mask;
+        pending_route.next_hop = next_hop;
+        pending_route.if_idx = if_idx;
+    }
+}
+
+void capture_packet(int dir, int if_idx, const struct ether_header *eth_hdr, const uint8_t *data, size_t len,
+                    drop_reason_t reason) {
+    bool has_route = pending_route.valid && dir == CAPTURE_TX;
+    if (dir == CAPTURE_TX) {
+        pending_route.valid = false;
+    }
+    // Selection by direction, interface and drop reason
+    if (!(capture_config.directions & dir) || (capture_config.if_idx >= 0 && capture_config.if_idx != if_idx) ||
+        (dir == CAPTURE_DROP && capture_config.drop_reasons && !(capture_config.drop_reasons & (1u << reason)))) {
+        return;
+    }
+    size_t hdr_len = eth_hdr ? sizeof(struct ether_header) : 0;
+    size_t frame_len = hdr_len + len;
+    size_t caplen = frame_len < (size_t) capture_config.snaplen ? frame_len : (size_t) capture_config.snaplen;
+    uint32_t tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring.head, memory_order_acquire) > ring.mask && !ring_wait(tail)) {
+        capture_stats.lost++;
+        return;
+    }
+    capture_slot_t *slot = ring_slot(tail);
+    if (eth_hdr) {
+        memcpy(slot->data, eth_hdr, sizeof(struct ether_header));
+    }
+    memcpy(slot->data + hdr_len, data, caplen - hdr_len);
+    // Selection by BPF expression, evaluated on the assembled frame
+    if (has_bpf) {
+        struct pcap_pkthdr pkthdr = {.caplen = caplen, .len = frame_len};
+        if (pcap_offline_filter(&bpf, &pkthdr, slot->data) == 0) {
+            capture_stats.filtered++;
+            return;
+        }
+    }
+    clock_gettime(CLOCK_REALTIME, &slot->ts);
+    slot->caplen = caplen;
+    slot->len = frame_len;
+    slot->if_idx = if_idx;
+    slot->dir = dir;
+    slot->reason = reason;
+    slot->has_route = has_route;
+    if (has_route) {
+        slot->route_dst = pending_route.dst_ip;
+        slot->route_prefix_len = __builtin_popcount(pending_route.mask);
+        slot->route_next_hop = pending_route.next_hop;
+        const char *if_name = if_active(pending_route.if_idx) ? config->if_names[pending_route.if_idx] : "-";
+        strncpy(slot->route_if_name, if_name, sizeof(slot->route_if_name) - 1);
+        slot->route_if_name[sizeof(slot->route_if_name) - 1] = '\0';
+    }
+    atomic_store_explicit(&ring.tail, tail + 1, memory_order_release);
+    capture_stats.captured++;
+}
+
+// ===== PCAPNG WRITER =====
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_IF_NAME 2
+#define PCAPNG_EPB_FLAGS 2
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_ALIGN(len) (((len) + 3) & ~3u)
+
+static void write_option(FILE *fp, uint16_t code, const void *value, uint16_t len) {
+    static const uint8_t padding[4] = {0};
+    fwrite(&code, sizeof(code), 1, fp);
+    fwrite(&len, sizeof(len), 1, fp);
+    fwrite(value, 1, len, fp);
+    fwrite(padding, 1, PCAPNG_ALIGN(len) - len, fp);
+}
+
+// opt_endofopt has no value
+static void write_option_end(FILE *fp) {
+    uint16_t end[2] = {PCAPNG_OPT_END, 0};
+    fwrite(end, sizeof(end), 1, fp);
+}
+
+static void write_header(FILE *fp) {
+    // Section header block
+    uint32_t shb[] = {PCAPNG_SHB, 28, PCAPNG_BYTE_ORDER_MAGIC, 1 /* major 1, minor 0 */, 0xffffffff, 0xffffffff, 28};
+    fwrite(shb, sizeof(shb), 1, fp);
+    // One interface description block per interface slot, interface id is if_idx. Slots of all interfaces
+    // are written, an interface added by a later config reload shows up with an empty name.
+    for (int i = 0; i < MAX_IF; i++) {
+        const char *name = i < config->num_if && if_active(i) ? config->if_names[i] : "";
+        uint16_t name_len = strlen(name);
+        uint32_t block_len = 20 + 4 + PCAPNG_ALIGN(name_len) + 4;
+        uint32_t idb[] = {PCAPNG_IDB, block_len, PCAPNG_LINKTYPE_ETHERNET, capture_config.snaplen};
+        fwrite(idb, sizeof(idb), 1, fp);
+        write_option(fp, PCAPNG_IF_NAME, name, name_len);
+        write_option_end(fp);
+        fwrite(&block_len, sizeof(block_len), 1, fp);
+    }
+}
+
+static void write_packet(FILE *fp, const capture_slot_t *slot) {
+    static const uint8_t padding[4] = {0};
+    // Router decision as comment
+    char comment[256];
+    int comment_len = snprintf(comment, sizeof(comment), "dir=%s",
+                               slot->dir == CAPTURE_RX ? "rx" : slot->dir == CAPTURE_TX ? "tx" : "drop");
+    if (slot->dir == CAPTURE_DROP) {
+        comment_len += snprintf(comment + comment_len, sizeof(comment) - comment_len, " reason=%s",
+                                drop_reason_names[slot->reason]);
+    }
+    if (slot->has_route) {
+        comment_len += snprintf(comment + comment_len, sizeof(comment) - comment_len, " route=%s/%d",
+                                ip2str(slot->route_dst), slot->route_prefix_len);
+        comment_len += snprintf(comment + comment_len, sizeof(comment) - comment_len, " via=%s dev=%s",
+                                ip2str(slot->route_next_hop), slot->route_if_name);
+    }
+    // Inbound / outbound in bits 0-1 of flags
+    uint32_t flags = slot->dir == CAPTURE_TX ? 2 : 1;
+    uint32_t block_len = 28 + PCAPNG_ALIGN(slot->caplen) + 4 + PCAPNG_ALIGN(comment_len) + 4 + 4 + 4 + 4;
+    uint64_t ts = (uint64_t) slot->ts.tv_sec * 1000000 + slot->ts.tv_nsec / 1000;
+    uint32_t epb[] = {PCAPNG_EPB, block_len, slot->if_idx, ts >> 32, (uint32_t) ts, slot->caplen, slot->len};
+    fwrite(epb, sizeof(epb), 1, fp);
+    fwrite(slot->data, 1, slot->caplen, fp);
+    fwrite(padding, 1, PCAPNG_ALIGN(slot->caplen) - slot->caplen, fp);
+    write_option(fp, PCAPNG_OPT_COMMENT, comment, comment_len);
+    write_option(fp, PCAPNG_EPB_FLAGS, &flags, sizeof(flags));
+    write_option_end(fp);
+    fwrite(&block_len, sizeof(block_len), 1, fp);
+}
+
+static void *capture_writer(void *arg) {
+    bool flush_pending = false;
+    while (writer_running) {
+        uint32_t head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&ring.tail, memory_order_acquire);
+        if (head == tail) {
+            if (capture_file && flush_pending) {
+                fflush(capture_file);
+                flush_pending = false;
+            }
+            // Poll often only while capturing
+            usleep(capture_enabled ? 1000 : 100000);
+            continue;
+        }
+        flush_pending = true;
+        for (; head != tail; head++) {
+            capture_slot_t *slot = ring_slot(head);
+            if (mirror_handle) {
+                pcap_inject(mirror_handle, slot->data, slot->caplen);
+            } else {
+                write_packet(capture_file, slot);
+            }
+            atomic_fetch_add_explicit(&capture_stats.written, 1, memory_order_relaxed);
+        }
+        atomic_store_explicit(&ring.head, head, memory_order_release);
+    }
+    return NULL;
+}
+
+static void capture_toggle(int signum) {
+    if (writer_running) {
+        capture_enabled = !capture_enabled;
+    } else {
+        start_requested = 1;
+    }
+}
+
+void capture_set_enabled(bool enabled) {
+    if (writer_running) {
+        capture_enabled = enabled;
+    }
+}
+
+// Open the output and start the writer. Runs on the forwarding thread, which owns the config read by write_header.
+static RC capture_start() {
+    if (capture_config.file == NULL && capture_config.mirror_if == NULL) {
+        capture_config.file = strdup("capture.pcapng");
+    }
+    char error_buffer[PCAP_ERRBUF_SIZE];
+    if (capture_config.filter) {
+        pcap_t *dead = pcap_open_dead(DLT_EN10MB, capture_config.snaplen);
+        if (pcap_compile(dead, &bpf, capture_config.filter, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+            fprintf(stderr, "Invalid capture filter \"%s\": %s\n", capture_config.filter, pcap_geterr(dead));
+            pcap_close(dead);
+            return CONFIG_INIT_FAIL;
+        }
+        pcap_close(dead);
+        has_bpf = true;
+    }
+    if (capture_config.mirror_if) {
+        mirror_handle = pcap_open_live(capture_config.mirror_if, BUFSIZ, 0, 1, error_buffer);
+        if (mirror_handle == NULL) {
+            fprintf(stderr, "Cannot open mirror interface %s\n", capture_config.mirror_if);
+            return CONFIG_INIT_FAIL;
+        }
+    } else {
+        capture_file = fopen(capture_config.file, "wb");
+        if (capture_file == NULL) {
+            perror("fopen()");
+            return CONFIG_INIT_FAIL;
+        }
+        write_header(capture_file);
+    }
+    ring.slot_size = (sizeof(capture_slot_t) + capture_config.snaplen + 7) & ~7u;
+    ring.mask = capture_config.ring_size - 1;
+    ring.slots = malloc(ring.slot_size * capture_config.ring_size);
+    if (ring.slots == NULL) {
+        fprintf(stderr, "Cannot allocate capture ring\n");
+        return CONFIG_INIT_FAIL;
+    }
+    writer_running = true;
+    if (pthread_create(&writer_thread, NULL, capture_writer, NULL) != 0) {
+        fprintf(stderr, "Cannot start capture writer\n");
+        writer_running = false;
+        return CONFIG_INIT_FAIL;
+    }
+    return 0;
+}
+
+RC capture_init() {
+    signal(SIGUSR1, capture_toggle);
+    // Without a capture section nothing is opened until SIGUSR1 asks for capture
+    if (!capture_config.configured) {
+        printf("Capture is off, send SIGUSR1 to start it\n");
+        return 0;
+    }
+    RC rc = capture_start();
+    if (rc) {
+        return rc;
+    }
+    capture_enabled = capture_config.enabled;
+    printf("Capture to %s is %s, send SIGUSR1 to toggle\n",
+           capture_config.mirror_if ? capture_config.mirror_if : capture_config.file,
+           capture_enabled ? "on" : "off");
+    return 0;
+}
+
+void capture_poll() {
+    if (__builtin_expect(start_requested, 0)) {
+        start_requested = 0;
+        if (capture_start()) {
+            fprintf(stderr, "Capture not started\n");
+            capture_destroy();
+            return;
+        }
+        capture_enabled = true;
+        printf("Capture to %s is on, send SIGUSR1 to toggle\n",
+               capture_config.mirror_if ? capture_config.mirror_if : capture_config.file);
+    }
+}
+
+void capture_destroy() {
+    capture_enabled = false;
+    if (writer_running) {
+        writer_running = false;
+        pthread_join(writer_thread, NULL);
+    }
+    if (capture_file) {
+        fclose(capture_file);
+        capture_file = NULL;
+    }
+    if (mirror_handle) {
+        pcap_close(mirror_handle);
+        mirror_handle = NULL;
+    }
+    if (has_bpf) {
+        pcap_freecode(&bpf);
+        has_bpf = false;
+    }
+    free(ring.slots);
+    ring.slots = NULL;
+}
+
+void print_capture_stats() {
+    printf("capture: %s, captured %" PRIu64 ", filtered %" PRIu64 ", lost %" PRIu64 ", written %" PRIu64 "\n",
+           capture_enabled ? "on" : "off", capture_stats.captured, capture_stats.filtered, capture_stats.lost,
+           atomic_load(&capture_stats.written));
+}
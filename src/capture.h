@@ -0,0 +1,56 @@
+#pragma once
+
+#include "error.h"
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <inttypes.h>
+
+// Capture direction / selection bits
+#define CAPTURE_RX 0x1
+#define CAPTURE_TX 0x2
+#define CAPTURE_DROP 0x4
+
+// Reason of a dropped packet, recorded into the capture metadata
+typedef enum {
+    DROP_NONE = 0,
+    DROP_INVALID,           // Broken frame / packet, or not addressed to us
+    DROP_POLICED,           // Control plane policer
+    DROP_QUEUE_FULL,        // Receive queue overflow
+    DROP_BAD_CHECKSUM,
+    DROP_NO_ROUTE,
+    DROP_TTL_EXCEEDED,
+    DROP_NO_NEIGHBOR,       // Next hop MAC address unknown
+    DROP_UNSUPPORTED,       // Unsupported protocol
+    DROP_VLAN_FILTER,       // VLAN not allowed on port
+    DROP_STORM,             // Storm control, or port shut down by it
+    DROP_TOO_BIG,           // Larger than the MTU left by tunnel headers
+    NUM_DROP_REASONS,
+} drop_reason_t;
+
+extern const char *drop_reason_names[NUM_DROP_REASONS];
+
+// Checked on every packet: capture costs a single predictable branch when disabled
+extern volatile bool capture_enabled;
+
+#define CAPTURE(dir, if_idx, eth_hdr, data, len, reason) do { \
+    if (__builtin_expect(capture_enabled, 0)) { capture_packet(dir, if_idx, eth_hdr, data, len, reason); } \
+} while (0)
+
+// Start capture writer if the config has a capture section. SIGUSR1 toggles capture at runtime.
+RC capture_init();
+
+// Start the writer asked for by SIGUSR1, called by the forwarding thread between vectors
+void capture_poll();
+
+void capture_destroy();
+
+void capture_set_enabled(bool enabled);
+
+// Queue a packet into the capture ring. A separate ethernet header may be given for packets already stripped of it.
+void capture_packet(int dir, int if_idx, const struct ether_header *eth_hdr, const uint8_t *data, size_t len,
+                    drop_reason_t reason);
+
+// Annotate the next transmitted packet with the route chosen for it
+void capture_set_route(in_addr_t dst_ip, in_addr_t mask, in_addr_t next_hop, int if_idx);
+
+void print_capture_stats();
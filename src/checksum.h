@@ -0,0 +1,41 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+// ===== CHECKSUM =====
+// Accumulate 16-bit words of buffer into a 32-bit partial sum (network byte order preserved)
+static inline uint32_t cksum_add(uint32_t sum, const void *data, size_t len) {
+    const uint8_t *buf = (const uint8_t *) data;
+    size_t i;
+    for (i = 0; i + 1 < len; i += 2) {
+        // Buffer may be of any type, e.g. a uint32_t pseudo header
+        uint16_t word;
+        memcpy(&word, &buf[i], sizeof(word));
+        sum += word;
+    }
+    if (i < len) {
+        // Odd trailing byte is padded with zero, this is the first byte in network byte order
+        uint16_t last = 0;
+        *(uint8_t *) &last = buf[i];
+        sum += last;
+    }
+    return sum;
+}
+
+// Fold a partial sum into the final one's complement checksum
+static inline uint16_t cksum_fold(uint32_t sum) {
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+static inline uint16_t get_cksum16(const uint8_t *packet, size_t len) {
+    return cksum_fold(cksum_add(0, packet, len));
+}
+
+// Update checksum for a 16-bit word changed from old_word to new_word (RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m'))
+static inline uint16_t cksum_update16(uint16_t check, uint16_t old_word, uint16_t new_word) {
+    return cksum_fold((uint32_t) (uint16_t) ~check + (uint16_t) ~old_word + new_word);
+}
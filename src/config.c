@@ -1,56 +1,693 @@
 #include "config.h"
+#include "capture.h"
+#include "rib.h"
 #include <json-c/json.h>
 #include <ifaddrs.h>
 #include <linux/if_packet.h>
+#include <netinet/ether.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <stdlib.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
 
-int NUM_IF;
-in_addr_t if_ips[MAX_IF];
-in_addr_t if_masks[MAX_IF];
-char *if_names[MAX_IF];
-struct ether_addr if_macs[MAX_IF];
+config_t *config;
 
-RC config_init(const char *config_path) {
+// Config published by reload thread, waiting to be swapped in by forwarding thread
+static _Atomic(config_t *) pending_config;
+// Config swapped out last time, released on next swap
+static config_t *retired_config;
+
+capture_config_t capture_config = {
+        .if_idx = -1,
+        .directions = CAPTURE_RX | CAPTURE_TX | CAPTURE_DROP,
+        .snaplen = 2048,
+        .ring_size = 4096,
+};
+
+memory_config_t memory_config = {
+        .packet_buffers = 4096,
+        .route_table_size = 65536,
+        .fib_tbl8_groups = 1024,
+        .arp_table_size = 1024,
+        .mac_table_size = 1024,
+        .route6_table_size = 65536,
+        .neighbor_table_size = 1024,
+};
+
+static RC parse_memory_config(json_object *memory) {
+    json_object *value;
+    if (json_object_object_get_ex(memory, "packet_buffers", &value)) {
+        memory_config.packet_buffers = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(memory, "hugepages", &value)) {
+        memory_config.hugepages = json_object_get_boolean(value);
+    }
+    if (json_object_object_get_ex(memory, "route_table_size", &value)) {
+        memory_config.route_table_size = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(memory, "fib_tbl8_groups", &value)) {
+        memory_config.fib_tbl8_groups = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(memory, "arp_table_size", &value)) {
+        memory_config.arp_table_size = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(memory, "mac_table_size", &value)) {
+        memory_config.mac_table_size = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(memory, "route6_table_size", &value)) {
+        memory_config.route6_table_size = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(memory, "neighbor_table_size", &value)) {
+        memory_config.neighbor_table_size = json_object_get_int(value);
+    }
+    if (memory_config.packet_buffers == 0 || memory_config.route_table_size <= 0 ||
+        memory_config.fib_tbl8_groups <= 0 || memory_config.arp_table_size <= 0 || memory_config.mac_table_size <= 0 ||
+        memory_config.route6_table_size <= 0 || memory_config.neighbor_table_size <= 0) {
+        fprintf(stderr, "Packet buffers and table sizes must be positive\n");
+        return CONFIG_PARSE_FAIL;
+    }
+    return 0;
+}
+
+trace_config_t trace_config;
+
+static RC parse_trace_config(json_object *trace) {
+    json_object *value;
+    if (json_object_object_get_ex(trace, "sample_rate", &value)) {
+        trace_config.sample_rate = json_object_get_int(value);
+    }
+    if (trace_config.sample_rate < 0) {
+        fprintf(stderr, "Trace sample rate must not be negative\n");
+        return CONFIG_PARSE_FAIL;
+    }
+    return 0;
+}
+
+control_config_t control_config;
+
+static RC parse_control_config(json_object *control) {
+    json_object *value;
+    if (json_object_object_get_ex(control, "socket", &value)) {
+        control_config.socket = strdup(json_object_get_string(value));
+    }
+    if (json_object_object_get_ex(control, "dump_interval", &value)) {
+        control_config.dump_interval = json_object_get_int(value);
+    }
+    if (control_config.dump_interval < 0) {
+        fprintf(stderr, "Table dump interval must not be negative\n");
+        return CONFIG_PARSE_FAIL;
+    }
+    return 0;
+}
+
+io_config_t io_config;
+
+const char *io_backend_names[] = {"pcap", "io_uring"};
+
+RC parse_io_backend(const char *name, io_backend_t *backend) {
+    for (int i = 0; i < (int) (sizeof(io_backend_names) / sizeof(io_backend_names[0])); i++) {
+        if (name != NULL && strcmp(name, io_backend_names[i]) == 0) {
+            *backend = i;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Unknown io backend: %s\n", name ? name : "(none)");
+    return CONFIG_PARSE_FAIL;
+}
+
+static RC parse_io_config(json_object *io) {
+    json_object *value;
+    if (json_object_object_get_ex(io, "backend", &value)) {
+        return parse_io_backend(json_object_get_string(value), &io_config.backend);
+    }
+    return 0;
+}
+
+static RC parse_capture_config(json_object *capture, const config_t *cfg) {
+    json_object *value;
+    capture_config.configured = true;
+    if (json_object_object_get_ex(capture, "enabled", &value)) {
+        capture_config.enabled = json_object_get_boolean(value);
+    }
+    if (json_object_object_get_ex(capture, "file", &value)) {
+        capture_config.file = strdup(json_object_get_string(value));
+    }
+    if (json_object_object_get_ex(capture, "mirror_if", &value)) {
+        capture_config.mirror_if = strdup(json_object_get_string(value));
+    }
+    if (json_object_object_get_ex(capture, "filter", &value)) {
+        capture_config.filter = strdup(json_object_get_string(value));
+    }
+    if (json_object_object_get_ex(capture, "snaplen", &value)) {
+        capture_config.snaplen = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(capture, "ring_size", &value)) {
+        capture_config.ring_size = json_object_get_int(value);
+        if (capture_config.ring_size <= 0 || (capture_config.ring_size & (capture_config.ring_size - 1))) {
+            fprintf(stderr, "Capture ring size must be power of 2\n");
+            return CONFIG_PARSE_FAIL;
+        }
+    }
+    if (json_object_object_get_ex(capture, "lossless", &value)) {
+        capture_config.lossless = json_object_get_boolean(value);
+    }
+    if (json_object_object_get_ex(capture, "if_name", &value)) {
+        const char *if_name = json_object_get_string(value);
+        for (capture_config.if_idx = 0; capture_config.if_idx < cfg->num_if; capture_config.if_idx++) {
+            if (cfg->if_names[capture_config.if_idx] && strcmp(cfg->if_names[capture_config.if_idx], if_name) == 0) {
+                break;
+            }
+        }
+        if (capture_config.if_idx == cfg->num_if) {
+            fprintf(stderr, "Unknown capture interface %s\n", if_name);
+            return CONFIG_PARSE_FAIL;
+        }
+    }
+    if (json_object_object_get_ex(capture, "directions", &value)) {
+        capture_config.directions = 0;
+        for (size_t i = 0; i < json_object_array_length(value); i++) {
+            const char *dir = json_object_get_string(json_object_array_get_idx(value, i));
+            if (strcmp(dir, "rx") == 0) {
+                capture_config.directions |= CAPTURE_RX;
+            } else if (strcmp(dir, "tx") == 0) {
+                capture_config.directions |= CAPTURE_TX;
+            } else if (strcmp(dir, "drop") == 0) {
+                capture_config.directions |= CAPTURE_DROP;
+            } else {
+                fprintf(stderr, "Unknown capture direction %s\n", dir);
+                return CONFIG_PARSE_FAIL;
+            }
+        }
+    }
+    if (json_object_object_get_ex(capture, "drop_reasons", &value)) {
+        for (size_t i = 0; i < json_object_array_length(value); i++) {
+            const char *name = json_object_get_string(json_object_array_get_idx(value, i));
+            int reason;
+            for (reason = 0; reason < NUM_DROP_REASONS; reason++) {
+                if (strcmp(drop_reason_names[reason], name) == 0) {
+                    break;
+                }
+            }
+            if (reason == NUM_DROP_REASONS) {
+                fprintf(stderr, "Unknown drop reason %s\n", name);
+                return CONFIG_PARSE_FAIL;
+            }
+            capture_config.drop_reasons |= 1u << reason;
+        }
+    }
+    return 0;
+}
+
+static RC parse_vlan_config(json_object *iface, config_t *cfg, int if_idx) {
+    // Ports default to access ports of VLAN 1
+    const char *mode = json_object_get_string(json_object_object_get(iface, "vlan_mode"));
+    json_object *vlan = json_object_object_get(iface, "vlan");
+    json_object *native_vlan = json_object_object_get(iface, "native_vlan");
+    json_object *vlans = json_object_object_get(iface, "vlans");
+    memset(cfg->if_trunk_vlans[if_idx], 0, sizeof(cfg->if_trunk_vlans[if_idx]));
+    if (mode == NULL || strcmp(mode, "access") == 0) {
+        cfg->if_vlan_modes[if_idx] = VLAN_MODE_ACCESS;
+        cfg->if_pvids[if_idx] = vlan ? json_object_get_int(vlan) : VLAN_DEFAULT;
+        if (cfg->if_pvids[if_idx] == 0 || cfg->if_pvids[if_idx] >= VLAN_MAX - 1) {
+            fprintf(stderr, "Invalid access VLAN %d of interface %s\n", cfg->if_pvids[if_idx], cfg->if_names[if_idx]);
+            return CONFIG_PARSE_FAIL;
+        }
+    } else if (strcmp(mode, "trunk") == 0) {
+        cfg->if_vlan_modes[if_idx] = VLAN_MODE_TRUNK;
+        cfg->if_pvids[if_idx] = native_vlan ? json_object_get_int(native_vlan) : 0;
+        size_t num_vlans = vlans ? json_object_array_length(vlans) : 0;
+        for (size_t i = 0; i < num_vlans; i++) {
+            int vid = json_object_get_int(json_object_array_get_idx(vlans, i));
+            if (vid <= 0 || vid >= VLAN_MAX - 1) {
+                fprintf(stderr, "Invalid trunk VLAN %d of interface %s\n", vid, cfg->if_names[if_idx]);
+                return CONFIG_PARSE_FAIL;
+            }
+            cfg->if_trunk_vlans[if_idx][vid / 64] |= 1ULL << (vid % 64);
+        }
+        if (cfg->if_pvids[if_idx] >= VLAN_MAX - 1) {
+            fprintf(stderr, "Invalid native VLAN %d of interface %s\n", cfg->if_pvids[if_idx], cfg->if_names[if_idx]);
+            return CONFIG_PARSE_FAIL;
+        }
+        if (cfg->if_pvids[if_idx] != 0) {
+            cfg->if_trunk_vlans[if_idx][cfg->if_pvids[if_idx] / 64] |= 1ULL << (cfg->if_pvids[if_idx] % 64);
+        }
+    } else {
+        fprintf(stderr, "Unknown VLAN mode of interface %s: %s\n", cfg->if_names[if_idx], mode);
+        return CONFIG_PARSE_FAIL;
+    }
+    return 0;
+}
+
+const char *storm_class_names[NUM_STORM_CLASSES] = {"broadcast", "multicast", "unknown_unicast"};
+
+static RC parse_storm_config(json_object *iface, config_t *cfg, int if_idx) {
+    storm_config_t *storm = &cfg->if_storms[if_idx];
+    json_object *section, *value;
+    if (!json_object_object_get_ex(iface, "storm_control", &section)) {
+        return 0;
+    }
+    bool negative = false;
+    for (int cls = 0; cls < NUM_STORM_CLASSES; cls++) {
+        if (json_object_object_get_ex(section, storm_class_names[cls], &value)) {
+            negative |= json_object_get_int(value) < 0;
+            storm->rates[cls] = json_object_get_int(value);
+        }
+    }
+    if (json_object_object_get_ex(section, "burst", &value)) {
+        negative |= json_object_get_int(value) < 0;
+        storm->burst = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(section, "shutdown_after", &value)) {
+        storm->shutdown_after = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(section, "recovery", &value)) {
+        storm->recovery = json_object_get_int(value);
+    }
+    if (negative || storm->shutdown_after < 0 || storm->recovery < 0) {
+        fprintf(stderr, "Invalid storm control of interface %s\n", cfg->if_names[if_idx]);
+        return CONFIG_PARSE_FAIL;
+    }
+    printf("Storm control of interface %s: broadcast %u, multicast %u, unknown unicast %u pps\n", cfg->if_names[if_idx],
+           storm->rates[STORM_BROADCAST], storm->rates[STORM_MULTICAST], storm->rates[STORM_UNKNOWN_UNICAST]);
+    return 0;
+}
+
+const char *tunnel_type_names[] = {"none", "vxlan", "gre"};
+
+static RC parse_tunnel_config(json_object *iface, config_t *cfg, int if_idx) {
+    tunnel_config_t *tunnel = &cfg->if_tunnels[if_idx];
+    json_object *section;
+    if (!json_object_object_get_ex(iface, "tunnel", &section)) {
+        return 0;
+    }
+    const char *type = json_object_get_string(json_object_object_get(section, "type"));
+    const char *local = json_object_get_string(json_object_object_get(section, "local"));
+    const char *remote = json_object_get_string(json_object_object_get(section, "remote"));
+    const char *remote_mac = json_object_get_string(json_object_object_get(section, "remote_mac"));
+    if (type != NULL && strcmp(type, "vxlan") == 0) {
+        tunnel->type = TUNNEL_VXLAN;
+    } else if (type != NULL && strcmp(type, "gre") == 0) {
+        tunnel->type = TUNNEL_GRE;
+    } else {
+        fprintf(stderr, "Unknown tunnel type of interface %s: %s\n", cfg->if_names[if_idx], type ? type : "(none)");
+        return CONFIG_PARSE_FAIL;
+    }
+    int vni = json_object_get_int(json_object_object_get(section, "vni"));
+    if (local == NULL || inet_pton(AF_INET, local, &tunnel->local) != 1 ||
+        remote == NULL || inet_pton(AF_INET, remote, &tunnel->remote) != 1 ||
+        (remote_mac != NULL && ether_aton_r(remote_mac, &tunnel->remote_mac) == NULL) ||
+        vni < 0 || vni > 0xffffff) {
+        fprintf(stderr, "Invalid tunnel endpoints, VNI or remote MAC of interface %s\n", cfg->if_names[if_idx]);
+        return CONFIG_PARSE_FAIL;
+    }
+    tunnel->vni = vni;
+    // No device to take a MAC address from, use a locally administered one made of the overlay address
+    uint8_t *mac = cfg->if_macs[if_idx].ether_addr_octet;
+    mac[0] = 0x02;
+    mac[1] = 0x00;
+    memcpy(mac + 2, &cfg->if_ips[if_idx], sizeof(in_addr_t));
+    printf("Tunnel interface %s: %s %s", cfg->if_names[if_idx], tunnel_type_names[tunnel->type], local);
+    printf(" -> %s, VNI %d\n", remote, vni);
+    return 0;
+}
+
+static int find_if(const config_t *cfg, const char *if_name) {
+    if (cfg == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < cfg->num_if; i++) {
+        if (cfg->if_names[i] && strcmp(cfg->if_names[i], if_name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline bool prefix6_contains(const struct in6_addr *prefix, int len, const struct in6_addr *ip6) {
+    int bytes = len / 8, bits = len % 8;
+    return memcmp(ip6->s6_addr, prefix->s6_addr, bytes) == 0 &&
+           (bits == 0 || ((ip6->s6_addr[bytes] ^ prefix->s6_addr[bytes]) & (0xff00 >> bits)) == 0);
+}
+
+static RC parse_static_route6(json_object *route_obj, config_t *cfg, int i) {
+    const char *dst_str = json_object_get_string(json_object_object_get(route_obj, "dst6"));
+    const char *next_hop_str = json_object_get_string(json_object_object_get(route_obj, "next_hop6"));
+    const char *if_name = json_object_get_string(json_object_object_get(route_obj, "if_name"));
+    static_route6_t *route = &cfg->static_routes6[cfg->num_static_routes6++];
+    route->prefix_len = json_object_get_int(json_object_object_get(route_obj, "prefix_len6"));
+    if (dst_str == NULL || next_hop_str == NULL || inet_pton(AF_INET6, dst_str, &route->dst) != 1 ||
+        inet_pton(AF_INET6, next_hop_str, &route->next_hop) != 1 || route->prefix_len < 0 || route->prefix_len > 128) {
+        fprintf(stderr, "Invalid IPv6 static route #%d\n", i);
+        return CONFIG_PARSE_FAIL;
+    }
+    // Forward port is given for a link-local next hop, otherwise the interface whose prefix contains the next hop
+    route->if_idx = -1;
+    if (if_name != NULL) {
+        route->if_idx = find_if(cfg, if_name);
+    } else if (!IN6_IS_ADDR_LINKLOCAL(&route->next_hop)) {
+        for (int if_idx = 0; if_idx < cfg->num_if; if_idx++) {
+            if (cfg->if_names[if_idx] && !IN6_IS_ADDR_UNSPECIFIED(&cfg->if_ip6s[if_idx]) &&
+                prefix6_contains(&cfg->if_ip6s[if_idx], cfg->if_prefix6_lens[if_idx], &route->next_hop)) {
+                route->if_idx = if_idx;
+                break;
+            }
+        }
+    }
+    if (route->if_idx < 0) {
+        fprintf(stderr, "Next hop %s of IPv6 static route #%d is not directly connected\n", next_hop_str, i);
+        return CONFIG_PARSE_FAIL;
+    }
+    printf("Load IPv6 static route %s/%d via %s\n", dst_str, route->prefix_len, next_hop_str);
+    return 0;
+}
+
+static RC parse_static_routes(json_object *routes, config_t *cfg) {
+    int num_routes = json_object_array_length(routes);
+    if (num_routes > MAX_STATIC_ROUTES) {
+        fprintf(stderr, "Too many static routes: %d > %d\n", num_routes, MAX_STATIC_ROUTES);
+        return CONFIG_PARSE_FAIL;
+    }
+    for (int i = 0; i < num_routes; i++) {
+        json_object *route_obj = json_object_array_get_idx(routes, i);
+        if (json_object_object_get_ex(route_obj, "dst6", NULL)) {
+            RC rc = parse_static_route6(route_obj, cfg, i);
+            if (rc) { return rc; }
+            continue;
+        }
+        const char *dst_str = json_object_get_string(json_object_object_get(route_obj, "dst"));
+        const char *mask_str = json_object_get_string(json_object_object_get(route_obj, "mask"));
+        const char *next_hop_str = json_object_get_string(json_object_object_get(route_obj, "next_hop"));
+        static_route_t *route = &cfg->static_routes[cfg->num_static_routes++];
+        if (dst_str == NULL || mask_str == NULL || next_hop_str == NULL ||
+            !inet_aton(dst_str, (struct in_addr *) &route->dst_ip) ||
+            !inet_aton(mask_str, (struct in_addr *) &route->mask) ||
+            !inet_aton(next_hop_str, (struct in_addr *) &route->next_hop)) {
+            fprintf(stderr, "Invalid static route #%d\n", i);
+            return CONFIG_PARSE_FAIL;
+        }
+        route->dst_ip &= route->mask;
+        json_object *distance;
+        route->distance = DISTANCE_STATIC;
+        if (json_object_object_get_ex(route_obj, "distance", &distance)) {
+            route->distance = json_object_get_int(distance);
+            if (route->distance < 0 || route->distance > UINT8_MAX) {
+                fprintf(stderr, "Invalid distance of static route #%d\n", i);
+                return CONFIG_PARSE_FAIL;
+            }
+        }
+        // Forward port is the interface whose subnet contains the next hop
+        route->if_idx = -1;
+        for (int if_idx = 0; if_idx < cfg->num_if; if_idx++) {
+            if (cfg->if_names[if_idx] &&
+                (cfg->if_ips[if_idx] & cfg->if_masks[if_idx]) == (route->next_hop & cfg->if_masks[if_idx])) {
+                route->if_idx = if_idx;
+                break;
+            }
+        }
+        if (route->if_idx < 0) {
+            fprintf(stderr, "Next hop %s of static route #%d is not directly connected\n", next_hop_str, i);
+            return CONFIG_PARSE_FAIL;
+        }
+        printf("Load static route %s/%d via %s\n", dst_str, __builtin_popcount(route->mask), next_hop_str);
+    }
+    return 0;
+}
+
+// Parse config file into cfg. Interfaces already in prev keep their index, new ones take free indices.
+static RC config_load(const char *config_path, const config_t *prev, config_t *cfg) {
+    memset(cfg, 0, sizeof(config_t));
     // Parse config json file to get IF, IP, MASK
     json_object *root = json_object_from_file(config_path);
     if (root == NULL) {
         fprintf(stderr, "Config file parse failed: %s\n", config_path);
         return CONFIG_PARSE_FAIL;
     }
-    NUM_IF = json_object_array_length(root);
-    for (size_t i = 0; i < NUM_IF; i++) {
-        json_object *iface = json_object_array_get_idx(root, i);
+    RC rc = 0;
+    // Config is either an array of interfaces, or an object with interfaces and optional sections
+    json_object *ifaces = root;
+    if (json_object_is_type(root, json_type_object) && !json_object_object_get_ex(root, "interfaces", &ifaces)) {
+        fprintf(stderr, "No interfaces in config file: %s\n", config_path);
+        rc = CONFIG_PARSE_FAIL;
+        goto out;
+    }
+    int num_ifaces = json_object_array_length(ifaces);
+    for (int i = 0; i < num_ifaces; i++) {
+        json_object *iface = json_object_array_get_idx(ifaces, i);
         const char *if_name = json_object_get_string(json_object_object_get(iface, "if_name"));
         const char *ip_str = json_object_get_string(json_object_object_get(iface, "ip"));
         const char *mask_str = json_object_get_string(json_object_object_get(iface, "mask"));
-        if_names[i] = strdup(if_name);
-        inet_aton(ip_str, (struct in_addr *) &if_ips[i]);
-        inet_aton(mask_str, (struct in_addr *) &if_masks[i]);
+        if (if_name == NULL || ip_str == NULL || mask_str == NULL || find_if(cfg, if_name) >= 0) {
+            fprintf(stderr, "Invalid or duplicate interface #%d\n", i);
+            rc = CONFIG_PARSE_FAIL;
+            goto out;
+        }
+        // Keep index of existing interface, otherwise take the first index free in both configs
+        int if_idx = find_if(prev, if_name);
+        if (if_idx < 0) {
+            for (if_idx = 0; if_idx < MAX_IF; if_idx++) {
+                if (cfg->if_names[if_idx] == NULL &&
+                    (prev == NULL || if_idx >= prev->num_if || prev->if_names[if_idx] == NULL)) {
+                    break;
+                }
+            }
+        }
+        if (if_idx >= MAX_IF) {
+            fprintf(stderr, "Too many interfaces in config file, at most %d (MAX_IF build option)\n", MAX_IF);
+            rc = CONFIG_PARSE_FAIL;
+            goto out;
+        }
+        if (if_idx >= cfg->num_if) {
+            cfg->num_if = if_idx + 1;
+        }
+        cfg->if_names[if_idx] = strdup(if_name);
+        inet_aton(ip_str, (struct in_addr *) &cfg->if_ips[if_idx]);
+        inet_aton(mask_str, (struct in_addr *) &cfg->if_masks[if_idx]);
         printf("Load interface %s: %s %s\n", if_name, ip_str, mask_str);
+        // IPv6 address is optional
+        const char *ip6_str = json_object_get_string(json_object_object_get(iface, "ip6"));
+        if (ip6_str != NULL) {
+            if (inet_pton(AF_INET6, ip6_str, &cfg->if_ip6s[if_idx]) != 1) {
+                fprintf(stderr, "Invalid IPv6 address of interface %s: %s\n", if_name, ip6_str);
+                rc = CONFIG_PARSE_FAIL;
+                goto out;
+            }
+            cfg->if_prefix6_lens[if_idx] = json_object_get_int(json_object_object_get(iface, "prefix_len6"));
+            printf("Load interface %s: %s/%d\n", if_name, ip6_str, cfg->if_prefix6_lens[if_idx]);
+        }
+        rc = parse_vlan_config(iface, cfg, if_idx);
+        if (rc) { goto out; }
+        rc = parse_storm_config(iface, cfg, if_idx);
+        if (rc) { goto out; }
+        rc = parse_tunnel_config(iface, cfg, if_idx);
+        if (rc) { goto out; }
+    }
+    json_object *section;
+    if (json_object_is_type(root, json_type_object) && json_object_object_get_ex(root, "routes", &section)) {
+        rc = parse_static_routes(section, cfg);
+        if (rc) { goto out; }
+    }
+    // Capture, memory, trace, control and io are set up once at startup
+    if (prev == NULL && json_object_is_type(root, json_type_object) &&
+        json_object_object_get_ex(root, "capture", &section)) {
+        rc = parse_capture_config(section, cfg);
+        if (rc) { goto out; }
+    }
+    if (prev == NULL && json_object_is_type(root, json_type_object) &&
+        json_object_object_get_ex(root, "memory", &section)) {
+        rc = parse_memory_config(section);
+        if (rc) { goto out; }
+    }
+    if (prev == NULL && json_object_is_type(root, json_type_object) &&
+        json_object_object_get_ex(root, "trace", &section)) {
+        rc = parse_trace_config(section);
+        if (rc) { goto out; }
+    }
+    if (prev == NULL && json_object_is_type(root, json_type_object) &&
+        json_object_object_get_ex(root, "control", &section)) {
+        rc = parse_control_config(section);
+        if (rc) { goto out; }
+    }
+    if (prev == NULL && json_object_is_type(root, json_type_object) &&
+        json_object_object_get_ex(root, "io", &section)) {
+        rc = parse_io_config(section);
+        if (rc) { goto out; }
     }
-    json_object_put(root);
     // Find mac address of interfaces
     struct ifaddrs *ifaddr;
     if (getifaddrs(&ifaddr) < 0) {
         fprintf(stderr, "Cannot get interface address\n");
-        return CONFIG_INIT_FAIL;
+        rc = CONFIG_INIT_FAIL;
+        goto out;
     }
     for (struct ifaddrs *ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-        for (int i = 0; i < NUM_IF; i++) {
-            if (ifa->ifa_addr->sa_family == AF_PACKET && strcmp(ifa->ifa_name, if_names[i]) == 0) {
-                struct ether_addr *mac = &if_macs[i];
-                memcpy(mac, ((struct sockaddr_ll *) ifa->ifa_addr)->sll_addr, sizeof(struct ether_addr));
-                printf("Found MAC address of interface %s: %s\n", if_names[i], mac2str((uint8_t *) mac));
-                break;
-            }
+        int i = find_if(cfg, ifa->ifa_name);
+        if (i >= 0 && cfg->if_tunnels[i].type == TUNNEL_NONE && ifa->ifa_addr != NULL &&
+            ifa->ifa_addr->sa_family == AF_PACKET) {
+            struct ether_addr *mac = &cfg->if_macs[i];
+            memcpy(mac, ((struct sockaddr_ll *) ifa->ifa_addr)->sll_addr, sizeof(struct ether_addr));
+            // Link-local address is fe80::/64 with modified EUI-64 interface identifier
+            uint8_t *ll6 = cfg->if_ll6s[i].s6_addr;
+            ll6[0] = 0xfe;
+            ll6[1] = 0x80;
+            ll6[8] = mac->ether_addr_octet[0] ^ 0x02;
+            ll6[9] = mac->ether_addr_octet[1];
+            ll6[10] = mac->ether_addr_octet[2];
+            ll6[11] = 0xff;
+            ll6[12] = 0xfe;
+            ll6[13] = mac->ether_addr_octet[3];
+            ll6[14] = mac->ether_addr_octet[4];
+            ll6[15] = mac->ether_addr_octet[5];
+            printf("Found MAC address of interface %s: %s\n", cfg->if_names[i], mac2str((uint8_t *) mac));
         }
     }
     freeifaddrs(ifaddr);
-    return 0;
+out:
+    json_object_put(root);
+    return rc;
+}
+
+static void config_free(config_t *cfg) {
+    if (cfg == NULL) {
+        return;
+    }
+    for (int i = 0; i < cfg->num_if; i++) {
+        free(cfg->if_names[i]);
+    }
+    free(cfg);
+}
+
+RC config_init(const char *config_path) {
+    config = malloc(sizeof(config_t));
+    if (config == NULL) {
+        fprintf(stderr, "Cannot allocate config\n");
+        return CONFIG_INIT_FAIL;
+    }
+    return config_load(config_path, NULL, config);
 }
 
 void config_destroy() {
-    for (int i = 0; i < NUM_IF; i++) {
-        free(if_names[i]);
+    config_free(config);
+    config_free(retired_config);
+    config_free(atomic_exchange(&pending_config, NULL));
+    config = retired_config = NULL;
+}
+
+const config_t *config_swap() {
+    config_t *new_config = atomic_load_explicit(&pending_config, memory_order_acquire);
+    if (new_config == NULL) {
+        return NULL;
+    }
+    // Readers on other threads may still hold the retired config for a moment, release it one swap later
+    config_free(retired_config);
+    retired_config = config;
+    config = new_config;
+    // Let reload thread know the config is swapped in, it may read the new current config from now on
+    atomic_store_explicit(&pending_config, NULL, memory_order_release);
+    return retired_config;
+}
+
+// ===== HOT RELOAD =====
+static struct {
+    char *path;
+    char *dir;
+    char *file;
+    config_prepare_fn prepare;
+    int signal_fd;
+    int inotify_fd;
+    pthread_t thread;
+} reloader;
+
+static bool config_reload_triggered() {
+    struct pollfd fds[2] = {
+            {.fd = reloader.signal_fd, .events = POLLIN},
+            {.fd = reloader.inotify_fd, .events = POLLIN},
+    };
+    if (poll(fds, 2, -1) <= 0) {
+        return false;
     }
+    bool triggered = false;
+    if (fds[0].revents & POLLIN) {
+        struct signalfd_siginfo info;
+        if (read(reloader.signal_fd, &info, sizeof(info)) == sizeof(info)) {
+            printf("Received SIGHUP, reloading config %s\n", reloader.path);
+            triggered = true;
+        }
+    }
+    if (fds[1].revents & POLLIN) {
+        // Editors may rewrite the file in place or rename a new file over it, so watch the directory
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t len = read(reloader.inotify_fd, buf, sizeof(buf));
+        for (ssize_t pos = 0; pos < len;) {
+            struct inotify_event *event = (struct inotify_event *) (buf + pos);
+            if (event->len > 0 && strcmp(event->name, reloader.file) == 0) {
+                printf("Config file %s changed, reloading\n", reloader.path);
+                triggered = true;
+            }
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return triggered;
+}
+
+static void *config_reload_loop(void *arg) {
+    while (1) {
+        if (!config_reload_triggered()) {
+            continue;
+        }
+        // Wait until the previous config is swapped in, and diff against it
+        while (atomic_load_explicit(&pending_config, memory_order_acquire) != NULL) {
+            usleep(10000);
+        }
+        config_t *new_config = malloc(sizeof(config_t));
+        if (new_config == NULL) {
+            fprintf(stderr, "Cannot allocate config\n");
+            continue;
+        }
+        if (config_load(reloader.path, config, new_config) ||
+            (reloader.prepare && reloader.prepare(config, new_config))) {
+            fprintf(stderr, "Config reload failed, keep running with current config\n");
+            config_free(new_config);
+            continue;
+        }
+        // Publish with a single pointer swap, picked up by forwarding thread between packets
+        atomic_store_explicit(&pending_config, new_config, memory_order_release);
+    }
+    return NULL;
+}
+
+RC config_reload_init(const char *config_path, config_prepare_fn prepare) {
+    reloader.path = strdup(config_path);
+    char *slash = strrchr(reloader.path, '/');
+    reloader.dir = slash ? strndup(reloader.path, slash - reloader.path + 1) : strdup(".");
+    reloader.file = strdup(slash ? slash + 1 : reloader.path);
+    reloader.prepare = prepare;
+    // SIGHUP is consumed by the reload thread only
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
+        fprintf(stderr, "Cannot block SIGHUP\n");
+        return CONFIG_INIT_FAIL;
+    }
+    reloader.signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (reloader.signal_fd < 0) {
+        perror("signalfd()");
+        return CONFIG_INIT_FAIL;
+    }
+    reloader.inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (reloader.inotify_fd < 0 || inotify_add_watch(reloader.inotify_fd, reloader.dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror("inotify");
+        return CONFIG_INIT_FAIL;
+    }
+    if (pthread_create(&reloader.thread, NULL, config_reload_loop, NULL) != 0) {
+        fprintf(stderr, "Cannot start config reload thread\n");
+        return CONFIG_INIT_FAIL;
+    }
+    return 0;
 }
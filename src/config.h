@@ -6,21 +6,189 @@
 #include <stdio.h>
 
 // Interface config
-#define MAX_IF 16
+#ifndef MAX_IF
+#define MAX_IF 16          // Set by the MAX_IF build option
+#endif
 
-extern int NUM_IF;
-extern char *if_names[MAX_IF];
-extern in_addr_t if_ips[MAX_IF];
-extern in_addr_t if_masks[MAX_IF];
-extern struct ether_addr if_macs[MAX_IF];
+// VLAN config of switch ports
+#define VLAN_MAX 4096
+#define VLAN_DEFAULT 1
+
+typedef enum {
+    VLAN_MODE_ACCESS = 0,
+    VLAN_MODE_TRUNK,
+} vlan_mode_t;
+
+// Storm control of switch ports: per ingress port policers of flooded traffic
+typedef enum {
+    STORM_BROADCAST = 0,
+    STORM_MULTICAST,
+    STORM_UNKNOWN_UNICAST,
+    NUM_STORM_CLASSES,
+} storm_class_t;
+
+extern const char *storm_class_names[NUM_STORM_CLASSES];
+
+typedef struct storm_config {
+    uint32_t rates[NUM_STORM_CLASSES];  // Packets per second, 0 for unlimited
+    uint32_t burst;                     // Bucket depth in packets, a tenth of a second of the rate if 0
+    int shutdown_after;                 // Shut port down after storming for this many seconds, 0 to only drop
+    int recovery;                       // Bring a shut down port back up after this many seconds, 0 to keep it down
+} storm_config_t;
+
+// Tunnel interfaces of the router: overlay interfaces without a device, whose frames are encapsulated towards a
+// remote endpoint over the underlay
+typedef enum {
+    TUNNEL_NONE = 0,
+    TUNNEL_VXLAN,
+    TUNNEL_GRE,
+} tunnel_type_t;
+
+extern const char *tunnel_type_names[];
+
+typedef struct tunnel_config {
+    tunnel_type_t type;
+    in_addr_t local;                // Underlay source address, an address of a device interface
+    in_addr_t remote;               // Underlay address of the far end
+    uint32_t vni;                   // VXLAN network identifier
+    struct ether_addr remote_mac;   // Inner destination MAC of VXLAN frames, learned from received frames if zero
+} tunnel_config_t;
+
+// Static route config
+#define MAX_STATIC_ROUTES 1024
+
+typedef struct static_route {
+    in_addr_t dst_ip;
+    in_addr_t mask;
+    in_addr_t next_hop;
+    int if_idx;
+    int distance;           // Administrative distance, above that of RIP for a route only used when RIP has none
+} static_route_t;
+
+// IPv6 static route, next hop on the interface whose prefix contains it, or on if_name for a link-local next hop
+typedef struct static_route6 {
+    struct in6_addr dst;
+    int prefix_len;
+    struct in6_addr next_hop;
+    int if_idx;
+} static_route6_t;
+
+// Running config. An interface keeps its index across reloads, a removed interface leaves a hole with NULL name.
+typedef struct config {
+    int num_if;
+    char *if_names[MAX_IF];
+    in_addr_t if_ips[MAX_IF];
+    in_addr_t if_masks[MAX_IF];
+    struct ether_addr if_macs[MAX_IF];
+    struct in6_addr if_ip6s[MAX_IF];                    // Global IPv6 address, unspecified if not configured
+    int if_prefix6_lens[MAX_IF];
+    struct in6_addr if_ll6s[MAX_IF];                    // IPv6 link-local address derived from MAC address
+    vlan_mode_t if_vlan_modes[MAX_IF];
+    uint16_t if_pvids[MAX_IF];                          // Access VLAN, or native VLAN of trunk (0 if none)
+    uint64_t if_trunk_vlans[MAX_IF][VLAN_MAX / 64];     // Bitmap of VLANs allowed on trunk
+    storm_config_t if_storms[MAX_IF];
+    tunnel_config_t if_tunnels[MAX_IF];
+    static_route_t static_routes[MAX_STATIC_ROUTES];
+    int num_static_routes;
+    static_route6_t static_routes6[MAX_STATIC_ROUTES];
+    int num_static_routes6;
+} config_t;
+
+// Only swapped by the forwarding thread, so that a packet is always processed against a single config
+extern config_t *config;
+
+static inline bool if_active(int if_idx) {
+    return config->if_names[if_idx] != NULL;
+}
+
+// Tunnel interfaces have no device to receive from or send to
+static inline bool if_is_tunnel(int if_idx) {
+    return config->if_tunnels[if_idx].type != TUNNEL_NONE;
+}
+
+// Capture config
+typedef struct capture_config {
+    bool configured;        // Capture section present, writer started at startup
+    bool enabled;           // Capture from startup, otherwise toggled at runtime
+    char *file;             // Output pcapng file
+    char *mirror_if;        // Mirror interface, used instead of file if set
+    int if_idx;             // Only capture this interface, -1 for all
+    int directions;         // Bitmap of CAPTURE_RX / CAPTURE_TX / CAPTURE_DROP
+    uint32_t drop_reasons;  // Bitmap of captured drop reasons, all if 0
+    char *filter;           // BPF filter expression
+    int snaplen;
+    int ring_size;          // Number of packets in capture ring, must be power of 2
+    bool lossless;          // Stall forwarding up to 1 ms for a free slot when ring is full, then drop
+} capture_config_t;
+
+extern capture_config_t capture_config;
+
+// Memory config, applied at startup. Tables grow on demand up to their size.
+typedef struct memory_config {
+    uint32_t packet_buffers;    // Number of buffers in packet pool
+    bool hugepages;             // Back packet pool and tables by hugepages if available
+    int route_table_size;
+    int fib_tbl8_groups;        // Blocks of 256 addresses under prefixes longer than /24, one per /24 holding any
+    int arp_table_size;
+    int mac_table_size;
+    int route6_table_size;
+    int neighbor_table_size;
+} memory_config_t;
+
+extern memory_config_t memory_config;
+
+// Latency trace config, applied at startup
+typedef struct trace_config {
+    int sample_rate;        // Trace one of every sample_rate packets, 0 to disable
+} trace_config_t;
+
+extern trace_config_t trace_config;
+
+// Control socket config, applied at startup
+typedef struct control_config {
+    char *socket;           // Path of control socket, /tmp/<prog>-<config name>.sock if NULL
+    int dump_interval;      // Print full tables every dump_interval seconds, 0 to only serve them on the socket
+} control_config_t;
+
+extern control_config_t control_config;
+
+// Packet io of the physical layer
+typedef enum {
+    IO_BACKEND_PCAP = 0,
+    IO_BACKEND_IO_URING,        // AF_PACKET sockets behind one io_uring, if built with io_uring support
+} io_backend_t;
+
+extern const char *io_backend_names[];
+
+// Io config, applied at startup
+typedef struct io_config {
+    io_backend_t backend;
+} io_config_t;
+
+extern io_config_t io_config;
+
+// Look up backend by name, return CONFIG_PARSE_FAIL if there is none
+RC parse_io_backend(const char *name, io_backend_t *backend);
 
 // Config init
 RC config_init(const char *config_path);
 
 void config_destroy();
 
+// Start a background thread which reloads the config on SIGHUP or when the config file is rewritten.
+// Must be called before any other thread is created, so that SIGHUP is blocked in all of them.
+// The prepare callback runs in the reload thread before a new config is published, e.g. to open new interfaces.
+typedef RC (*config_prepare_fn)(const config_t *old_config, const config_t *new_config);
+
+RC config_reload_init(const char *config_path, config_prepare_fn prepare);
+
+// Swap in the config published by the reload thread, if any. Return the previous config, or NULL if not swapped.
+// Caller compares both configs to update its state, the previous config is released on the next swap.
+const config_t *config_swap();
+
+// Formatted into a buffer per thread, so that the control thread can format too
 static inline char *mac2str(uint8_t mac[6]) {
-    static char s[18];
+    static _Thread_local char s[18];
     sprintf(s, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     return s;
 }
@@ -29,3 +197,8 @@ static inline char *ip2str(in_addr_t ip) {
     struct in_addr addr = {ip};
     return inet_ntoa(addr);
 }
+
+static inline char *ip62str(const struct in6_addr *ip6) {
+    static _Thread_local char s[INET6_ADDRSTRLEN];
+    return (char *) inet_ntop(AF_INET6, ip6, s, sizeof(s));
+}
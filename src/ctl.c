@@ -0,0 +1,276 @@
+#include "ctl.h"
+#include "physical_layer.h"
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define CTL_MAX_TABLES 8
+#define CTL_REQUEST_SIZE 256
+#define CTL_LINE_SIZE 256
+#define CTL_CLIENT_TIMEOUT 5    // Seconds a client may take to send its request or read the response
+
+static struct {
+    const ctl_table_t *tables[CTL_MAX_TABLES];
+    ctl_snapshot_t snapshots[CTL_MAX_TABLES];
+    int num_tables;
+    atomic_int request;         // Table to snapshot, -1 if none
+    // Rest of the request, written before request by the control thread
+    const char *key;            // Lookup key, NULL to copy entries
+    int offset;
+    int max;
+    int lookup_rc;              // Result of the lookup, written by the forwarding thread
+    sem_t done;                 // Posted by forwarding thread once the snapshot is taken
+    int wakeup_fd;
+    int listen_fd;
+    pthread_t thread;
+} ctl = {.request = -1};
+
+RC ctl_register(const ctl_table_t *table) {
+    if (ctl.num_tables >= CTL_MAX_TABLES) {
+        fprintf(stderr, "Too many control tables\n");
+        return OVERFLOW_ERROR;
+    }
+    ctl.tables[ctl.num_tables++] = table;
+    return 0;
+}
+
+void ctl_serve() {
+    int idx = atomic_load_explicit(&ctl.request, memory_order_acquire);
+    if (idx < 0) {
+        return;
+    }
+    const ctl_table_t *table = ctl.tables[idx];
+    ctl_snapshot_t *snap = &ctl.snapshots[idx];
+    if (ctl.key != NULL) {
+        ctl.lookup_rc = table->lookup(ctl.key, snap->entries);
+        snap->num_entries = ctl.lookup_rc == 0;
+    } else {
+        snap->num_entries = table->snapshot(snap->entries, ctl.offset, ctl.max, &snap->table_size);
+    }
+    // Config may be swapped once the snapshot is handed over, keep the names it refers to
+    for (int i = 0; i < MAX_IF; i++) {
+        const char *name = i < config->num_if && if_active(i) ? config->if_names[i] : "-";
+        strncpy(snap->if_names[i], name, IF_NAMESIZE - 1);
+        snap->if_names[i][IF_NAMESIZE - 1] = '\0';
+    }
+    atomic_store_explicit(&ctl.request, -1, memory_order_release);
+    sem_post(&ctl.done);
+}
+
+bool ctl_pending() {
+    return atomic_load_explicit(&ctl.request, memory_order_relaxed) >= 0;
+}
+
+// Ask forwarding thread for the entry key resolves to, or for at most max entries from the offset-th on, of table
+// idx and wait for them
+static const ctl_snapshot_t *take_snapshot(int idx, const char *key, int offset, int max) {
+    ctl_snapshot_t *snap = &ctl.snapshots[idx];
+    if (snap->entries == NULL) {
+        snap->entries = malloc((size_t) ctl.tables[idx]->max_entries * ctl.tables[idx]->entry_size);
+        if (snap->entries == NULL) {
+            return NULL;
+        }
+    }
+    ctl.key = key;
+    ctl.offset = offset;
+    ctl.max = max;
+    atomic_store_explicit(&ctl.request, idx, memory_order_release);
+    // Wake forwarding thread up in case it waits for packets
+    uint64_t one = 1;
+    if (write(ctl.wakeup_fd, &one, sizeof(one)) < 0) {
+        perror("write()");
+    }
+    while (sem_wait(&ctl.done) != 0 && errno == EINTR) {}
+    return snap;
+}
+
+static void print_tables(FILE *out) {
+    fprintf(out, "Tables:");
+    for (int i = 0; i < ctl.num_tables; i++) {
+        fprintf(out, " %s", ctl.tables[i]->name);
+    }
+    fprintf(out, "\n");
+}
+
+static void handle_request(FILE *out, char *request) {
+    char *save;
+    const char *name = strtok_r(request, " \t\r\n", &save);
+    if (name == NULL || strcmp(name, "tables") == 0) {
+        print_tables(out);
+        return;
+    }
+    int idx;
+    for (idx = 0; idx < ctl.num_tables; idx++) {
+        if (strcmp(ctl.tables[idx]->name, name) == 0) {
+            break;
+        }
+    }
+    if (idx == ctl.num_tables) {
+        fprintf(out, "Unknown table %s. ", name);
+        print_tables(out);
+        return;
+    }
+    const ctl_table_t *table = ctl.tables[idx];
+    const char *key = NULL, *match = NULL;
+    long offset = 0, limit = -1;
+    char *option;
+    while ((option = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        char *value = strtok_r(NULL, " \t\r\n", &save);
+        if (value == NULL) {
+            fprintf(out, "Missing value of %s\n", option);
+            return;
+        } else if (strcmp(option, "lookup") == 0) {
+            key = value;
+        } else if (strcmp(option, "match") == 0) {
+            match = value;
+        } else if (strcmp(option, "offset") == 0 || strcmp(option, "limit") == 0) {
+            char *end;
+            long number = strtol(value, &end, 10);
+            if (*end != '\0' || number < 0) {
+                fprintf(out, "Invalid %s %s\n", option, value);
+                return;
+            }
+            *(option[0] == 'o' ? &offset : &limit) = number;
+        } else {
+            fprintf(out, "Unknown option %s\n", option);
+            return;
+        }
+    }
+    if (key != NULL && table->lookup == NULL) {
+        fprintf(out, "Table %s does not support lookup\n", table->name);
+        return;
+    }
+    // A match filter numbers entries after filtering, so it needs the whole table
+    int copy_offset = 0, copy_max = table->max_entries;
+    if (key == NULL && match == NULL) {
+        copy_offset = offset < table->max_entries ? (int) offset : table->max_entries;
+        if (limit >= 0 && limit < copy_max) {
+            copy_max = (int) limit;
+        }
+    }
+    const ctl_snapshot_t *snap = take_snapshot(idx, key, copy_offset, copy_max);
+    if (snap == NULL) {
+        fprintf(out, "Cannot allocate snapshot of table %s\n", table->name);
+        return;
+    }
+    char line[CTL_LINE_SIZE];
+    fprintf(out, "%s\n", table->header);
+    if (key != NULL) {
+        if (ctl.lookup_rc == CTL_LOOKUP_INVALID) {
+            fprintf(out, "Invalid key %s\n", key);
+        } else if (ctl.lookup_rc == CTL_LOOKUP_NONE) {
+            fprintf(out, "No entry for %s\n", key);
+        } else {
+            table->format(snap, snap->entries, line, sizeof(line));
+            fprintf(out, "%s\n", line);
+        }
+        return;
+    }
+    if (match == NULL) {
+        for (int i = 0; i < snap->num_entries; i++) {
+            table->format(snap, (const uint8_t *) snap->entries + i * table->entry_size, line, sizeof(line));
+            fprintf(out, "%s\n", line);
+        }
+        fprintf(out, "%d of %d entries shown, %d in table\n", snap->num_entries, snap->table_size, snap->table_size);
+        return;
+    }
+    // Entries are numbered after the match filter, so that pages of a filtered table are contiguous
+    long matched = 0, shown = 0;
+    for (int i = 0; i < snap->num_entries; i++) {
+        table->format(snap, (const uint8_t *) snap->entries + i * table->entry_size, line, sizeof(line));
+        if (strstr(line, match) == NULL) {
+            continue;
+        }
+        if (matched++ >= offset && (limit < 0 || shown < limit)) {
+            fprintf(out, "%s\n", line);
+            shown++;
+        }
+    }
+    fprintf(out, "%ld of %ld entries shown, %d in table\n", shown, matched, snap->table_size);
+}
+
+static void *ctl_loop(void *arg) {
+    // A client closing early must not kill the process, writes fail with EPIPE instead
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    while (1) {
+        int fd = accept(ctl.listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                perror("accept()");
+            }
+            continue;
+        }
+        struct timeval timeout = {.tv_sec = CTL_CLIENT_TIMEOUT};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[CTL_REQUEST_SIZE];
+        size_t len = 0;
+        ssize_t n;
+        while (len < sizeof(request) - 1 && (n = read(fd, request + len, sizeof(request) - 1 - len)) > 0) {
+            len += n;
+            if (memchr(request + len - n, '\n', n) != NULL) {
+                break;
+            }
+        }
+        request[len] = '\0';
+        FILE *out = fdopen(fd, "w");
+        if (out == NULL) {
+            close(fd);
+            continue;
+        }
+        handle_request(out, request);
+        fclose(out);
+    }
+    return NULL;
+}
+
+RC ctl_init(const char *prog, const char *config_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (control_config.socket != NULL) {
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", control_config.socket);
+    } else {
+        // Several instances run in network namespaces of one host, name the socket after the config
+        const char *slash = strrchr(config_path, '/');
+        const char *name = slash ? slash + 1 : config_path;
+        const char *dot = strrchr(name, '.');
+        int name_len = dot ? (int) (dot - name) : (int) strlen(name);
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/%s-%.*s.sock", prog, name_len, name);
+    }
+    if (sem_init(&ctl.done, 0, 0) != 0) {
+        perror("sem_init()");
+        return CONFIG_INIT_FAIL;
+    }
+    ctl.wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ctl.wakeup_fd < 0 || physical_add_wakeup(ctl.wakeup_fd)) {
+        fprintf(stderr, "Cannot create control wakeup event\n");
+        return CONFIG_INIT_FAIL;
+    }
+    ctl.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ctl.listen_fd < 0) {
+        perror("socket()");
+        return CONFIG_INIT_FAIL;
+    }
+    // Socket of a previous run is left behind on exit
+    unlink(addr.sun_path);
+    if (bind(ctl.listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(ctl.listen_fd, 4) < 0) {
+        fprintf(stderr, "Cannot listen on control socket %s: %s\n", addr.sun_path, strerror(errno));
+        return CONFIG_INIT_FAIL;
+    }
+    if (pthread_create(&ctl.thread, NULL, ctl_loop, NULL) != 0) {
+        fprintf(stderr, "Cannot start control thread\n");
+        return CONFIG_INIT_FAIL;
+    }
+    printf("Control socket listening on %s\n", addr.sun_path);
+    return 0;
+}
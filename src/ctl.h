@@ -0,0 +1,66 @@
+#pragma once
+
+#include "error.h"
+#include "config.h"
+#include <net/if.h>
+#include <stddef.h>
+#include <string.h>
+
+// ===== CONTROL SOCKET =====
+// Tables are queried over a unix socket by routerctl, instead of being dumped periodically by the forwarding thread.
+// A query is served by a control thread from a snapshot of the table: the forwarding thread only copies the entries
+// between two packet vectors, formatting and filtering happen on the control thread. A lookup copies the one entry
+// found, a page without match filter copies only the entries of the page.
+//
+// Request is one line: <table> [lookup KEY] [match TEXT] [offset N] [limit N]
+// Response is one line per entry, followed by a summary line.
+
+// Entries copied from a table, with the interface names they refer to by index
+typedef struct ctl_snapshot {
+    void *entries;
+    int num_entries;
+    int table_size;             // Entries in use in the table, of which entries holds num_entries
+    char if_names[MAX_IF][IF_NAMESIZE];
+} ctl_snapshot_t;
+
+typedef struct ctl_table {
+    const char *name;
+    const char *header;         // Column names
+    size_t entry_size;
+    int max_entries;
+    // Forwarding thread: copy at most max entries in use, from the offset-th on, to buf. Set *total to the number of
+    // entries in use and return the number copied.
+    int (*snapshot)(void *buf, int offset, int max, int *total);
+    // Control thread: format entry of snapshot into line
+    void (*format)(const ctl_snapshot_t *snap, const void *entry, char *line, size_t size);
+    // Forwarding thread, optional: copy the entry key resolves to into buf and return 0, CTL_LOOKUP_NONE if there is none
+    int (*lookup)(const char *key, void *buf);
+} ctl_table_t;
+
+#define CTL_LOOKUP_NONE (-1)
+#define CTL_LOOKUP_INVALID (-2)     // Key is malformed
+
+// Snapshot of a table whose entries are all in use: copy at most max of its size entries, from offset on
+static inline int ctl_copy_range(void *buf, const void *entries, int size, size_t entry_size, int offset, int max,
+                                 int *total) {
+    int num_entries = offset < size ? size - offset : 0;
+    if (num_entries > max) {
+        num_entries = max;
+    }
+    memcpy(buf, (const uint8_t *) entries + (size_t) offset * entry_size, (size_t) num_entries * entry_size);
+    *total = size;
+    return num_entries;
+}
+
+// Register a table before ctl_init, table must outlive the program
+RC ctl_register(const ctl_table_t *table);
+
+// Listen on the socket of control_config, or /tmp/<prog>-<config name>.sock, and start the control thread.
+// Must be called after config_reload_init.
+RC ctl_init(const char *prog, const char *config_path);
+
+// Forwarding thread, between packet vectors: take the snapshot requested by the control thread, if any
+void ctl_serve();
+
+// Whether a snapshot is requested, i.e. the last receive was woken up by the control thread
+bool ctl_pending();
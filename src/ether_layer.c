@@ -1,6 +1,15 @@
 #include "ether_layer.h"
 #include "physical_layer.h"
+#include "rip.h"
+#include "capture.h"
+#include "arena.h"
+#include "pktbuf.h"
+#include "ctl.h"
 #include <linux/if_arp.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -20,11 +29,14 @@ typedef struct arp_entry {
     struct ether_addr mac;
 } arp_entry_t;
 
-#define ARP_TABLE_CAPACITY 1024
+#define ARP_TABLE_MIN_CAPACITY 64
 
+// Grows in place within its arena, up to the configured ARP table size
 struct {
-    arp_entry_t entries[ARP_TABLE_CAPACITY];
+    arp_entry_t *entries;
     int size;
+    int capacity;
+    arena_t arena;
 } arp_table;
 
 static int arp_find_entry(in_addr_t ip, int if_idx) {
@@ -41,7 +53,9 @@ static RC arp_insert_entry(in_addr_t ip, int if_idx, const struct ether_addr *ma
     int pos = arp_find_entry(ip, if_idx);
     if (pos == arp_table.size) {
         // Entry not found, need to insert new entry
-        if (arp_table.size >= ARP_TABLE_CAPACITY) {
+        if (arp_table.size >= arp_table.capacity && arena_grow(&arp_table.arena, arp_table.entries,
+                                                               sizeof(arp_entry_t), &arp_table.capacity,
+                                                               ARP_TABLE_MIN_CAPACITY)) {
             fprintf(stderr, "ARP Table overflow\n");
             return OVERFLOW_ERROR;
         }
@@ -63,21 +77,59 @@ void print_arp_table() {
     for (int i = 0; i < arp_table.size; i++) {
         arp_entry_t *entry = &arp_table.entries[i];
         printf("| %15s | %17s | %5s |\n",
-               ip2str(entry->ip), mac2str((uint8_t *) &entry->mac), if_names[entry->if_idx]);
+               ip2str(entry->ip), mac2str((uint8_t *) &entry->mac), config->if_names[entry->if_idx]);
     }
     printf("%s\n", separator);
 }
 
+static int arp_snapshot(void *buf, int offset, int max, int *total) {
+    return ctl_copy_range(buf, arp_table.entries, arp_table.size, sizeof(arp_entry_t), offset, max, total);
+}
+
+static void arp_format(const ctl_snapshot_t *snap, const void *entry, char *line, size_t size) {
+    const arp_entry_t *arp = entry;
+    snprintf(line, size, "%-15s %-17s %s", ip2str(arp->ip), mac2str((uint8_t *) &arp->mac), snap->if_names[arp->if_idx]);
+}
+
+// First entry of an IP address on any interface
+static int arp_lookup(const char *key, void *buf) {
+    in_addr_t ip;
+    if (inet_pton(AF_INET, key, &ip) != 1) {
+        return CTL_LOOKUP_INVALID;
+    }
+    for (int i = 0; i < arp_table.size; i++) {
+        if (arp_table.entries[i].ip == ip) {
+            memcpy(buf, &arp_table.entries[i], sizeof(arp_entry_t));
+            return 0;
+        }
+    }
+    return CTL_LOOKUP_NONE;
+}
+
+static ctl_table_t arp_ctl_table = {
+        .name = "arp",
+        .header = "IP              MAC               IF",
+        .entry_size = sizeof(arp_entry_t),
+        .snapshot = arp_snapshot,
+        .format = arp_format,
+        .lookup = arp_lookup,
+};
+
+static tunnel_output_fn ether_tunnel_output;
+
+// Copy an L3 packet built by the router into a packet buffer and send it
 static void send_l3_packet(const uint8_t *l3_packet, size_t l3_len, int if_idx,
                            const struct ether_addr *dst_mac, uint16_t ether_type) {
-    static uint8_t packet[BUFSIZ];
-    size_t len = sizeof(struct ether_header) + l3_len;
-    memcpy(packet + sizeof(struct ether_header), l3_packet, l3_len);
-    struct ether_header *ether_hdr = (struct ether_header *) packet;
-    memcpy(ether_hdr->ether_dhost, dst_mac, sizeof(struct ether_addr));
-    memcpy(ether_hdr->ether_shost, &if_macs[if_idx], sizeof(struct ether_addr));
-    ether_hdr->ether_type = ether_type;
-    send_packet(packet, len, if_idx);
+    pkt_buf_t *pkt = pkt_alloc();
+    if (pkt == NULL || l3_len > PKT_DATA_ROOM - sizeof(struct ether_header)) {
+        fprintf(stderr, "Cannot allocate packet buffer\n");
+        if (pkt) { pkt_free(pkt); }
+        return;
+    }
+    memcpy(pkt->data, l3_packet, l3_len);
+    pkt->len = l3_len;
+    ether_send(pkt, if_idx, dst_mac, ether_type);
+    pkt_free(pkt);
 }
 
 static void send_arp_reply(int if_idx, in_addr_t query_ip, const struct ether_addr *ans_mac,
@@ -95,7 +147,7 @@ static void send_arp_reply(int if_idx, in_addr_t query_ip, const struct ether_ad
     memcpy(&arp_pkt.ar_tha, dst_mac, sizeof(struct ether_addr));
     arp_pkt.ar_tip = dst_ip;
 
-    send_l3_packet((uint8_t *) &arp_pkt, sizeof(arp_pkt), if_idx, dst_mac, htons(ETHERTYPE_ARP));
+    send_l3_packet((uint8_t *) &arp_pkt, sizeof(arp_pkt), if_idx, dst_mac, ETHERTYPE_ARP);
 }
 
 void send_arp_request(int if_idx, in_addr_t ip) {
@@ -107,18 +159,40 @@ void send_arp_request(int if_idx, in_addr_t ip) {
             .ar_pln = sizeof(in_addr_t),
             .ar_op = htons(ARPOP_REQUEST)
     };
-    memcpy(&arp_pkt.ar_sha, &if_macs[if_idx], sizeof(struct ether_addr));
-    arp_pkt.ar_sip = if_ips[if_idx];
+    memcpy(&arp_pkt.ar_sha, &config->if_macs[if_idx], sizeof(struct ether_addr));
+    arp_pkt.ar_sip = config->if_ips[if_idx];
     memset(&arp_pkt.ar_tha, 0, sizeof(struct ether_addr));
     arp_pkt.ar_tip = ip;
 
-    send_l3_packet((uint8_t *) &arp_pkt, sizeof(arp_pkt), if_idx, &BROADCAST_MAC, htons(ETHERTYPE_ARP));
+    send_l3_packet((uint8_t *) &arp_pkt, sizeof(arp_pkt), if_idx, &BROADCAST_MAC, ETHERTYPE_ARP);
+}
+
+RC arp_if_up(int if_idx) {
+    return arp_insert_entry(config->if_ips[if_idx], if_idx, &config->if_macs[if_idx]);
+}
+
+void arp_if_down(int if_idx) {
+    int size = 0;
+    for (int i = 0; i < arp_table.size; i++) {
+        if (arp_table.entries[i].if_idx != if_idx) {
+            arp_table.entries[size++] = arp_table.entries[i];
+        }
+    }
+    arp_table.size = size;
 }
 
-RC ether_init() {
-    RC rc;
-    for (int i = 0; i < NUM_IF; i++) {
-        rc = arp_insert_entry(if_ips[i], i, &if_macs[i]);
+RC ether_init(tunnel_output_fn tunnel_output) {
+    ether_tunnel_output = tunnel_output;
+    RC rc = arena_init(&arp_table.arena, (size_t) memory_config.arp_table_size * sizeof(arp_entry_t),
+                       memory_config.hugepages);
+    if (rc) { return rc; }
+    arp_table.entries = arena_alloc(&arp_table.arena, 0);
+    arp_ctl_table.max_entries = memory_config.arp_table_size;
+    rc = ctl_register(&arp_ctl_table);
+    if (rc) { return rc; }
+    for (int i = 0; i < config->num_if; i++) {
+        if (!if_active(i)) { continue; }
+        rc = arp_if_up(i);
         if (rc) { return rc; }
     }
     return 0;
@@ -126,8 +200,10 @@ RC ether_init() {
 
 static inline bool is_multicast_mac(const struct ether_addr *mac_) {
     // Multicast MAC address of multicast IP is: 01:00:5e:00:00:00 | (IP & 0x007fffff)
+    // Multicast MAC address of multicast IPv6 is: 33:33:00:00:00:00 | (IPv6 & 0xffffffff)
     char *mac = (char *) mac_;
-    return mac[0] == 0x01 && mac[1] == 0x00 && mac[2] == 0x5e && (mac[3] >> 7) == 0x00;
+    return (mac[0] == 0x01 && mac[1] == 0x00 && mac[2] == 0x5e && (mac[3] >> 7) == 0x00) ||
+           (mac[0] == 0x33 && mac[1] == 0x33);
 }
 
 static inline bool is_broadcast_mac(const struct ether_addr *mac) {
@@ -144,7 +220,7 @@ RC arp_get_mac(in_addr_t ip, int if_idx, struct ether_addr *out_mac) {
     } else {
         int pos = arp_find_entry(ip, if_idx);
         if (pos == arp_table.size) {
-            printf("Sending ARP request to %s via %s\n", ip2str(ip), if_names[if_idx]);
+            printf("Sending ARP request to %s via %s\n", ip2str(ip), config->if_names[if_idx]);
             send_arp_request(if_idx, ip);
             return UNKNOWN_MAC_ADDR;
         } else {
@@ -154,84 +230,313 @@ RC arp_get_mac(in_addr_t ip, int if_idx, struct ether_addr *out_mac) {
     return 0;
 }
 
-size_t recv_ip_packet(int timeout_ms, uint8_t *ip_packet, int *out_if_idx,
-                      struct ether_addr *out_src_mac, struct ether_addr *out_dst_mac) {
-    while (1) {
-        uint8_t packet[BUFSIZ];
+// ===== PUNT PATH =====
+// Frames are classified right after the ethernet header. Control traffic (ARP, RIP, ICMP to the router) is punted
+// into a small policed queue, which is drained ahead of the data queue so that floods cannot starve the control plane.
+// Each control class has its own policer, so that e.g. an echo flood cannot take the tokens of RIP and ARP.
+typedef enum {
+    PUNT_DROP = 0,
+    PUNT_DATA,
+    PUNT_ARP,               // ARP and IPv6 neighbor discovery
+    PUNT_RIP,
+    PUNT_ICMP,              // ICMP and ICMPv6 echo to the router
+} punt_class_t;
+
+#define PUNT_NUM_CTRL 3     // Control classes, from PUNT_ARP on
+
+static const char *punt_ctrl_names[PUNT_NUM_CTRL] = {"arp:", "rip:", "icmp:"};
+
+#define RX_BURST 32
+#define CTRL_QUEUE_CAPACITY 64      // must be power of 2
+#define DATA_QUEUE_CAPACITY 256     // must be power of 2
+#define CTRL_BUDGET 16              // control packets processed per loop iteration
+#define CTRL_RATE_PPS 1000          // policer rate of each control class
+#define CTRL_BURST 200              // policer bucket depth of each control class
+
+// Queue of packet buffers, frames are received straight into pool buffers and queued without copying
+typedef struct pkt_queue {
+    pkt_buf_t **slots;
+    uint32_t mask;
+    uint32_t head;
+    uint32_t tail;
+} pkt_queue_t;
+
+static pkt_buf_t *ctrl_slots[CTRL_QUEUE_CAPACITY];
+static pkt_buf_t *data_slots[DATA_QUEUE_CAPACITY];
+static pkt_queue_t ctrl_queue = {ctrl_slots, CTRL_QUEUE_CAPACITY - 1, 0, 0};
+static pkt_queue_t data_queue = {data_slots, DATA_QUEUE_CAPACITY - 1, 0, 0};
+static int ctrl_budget = CTRL_BUDGET;
+
+static struct {
+    uint32_t tokens;
+    uint64_t last_refill;
+} ctrl_policers[PUNT_NUM_CTRL] = {{CTRL_BURST, 0}, {CTRL_BURST, 0}, {CTRL_BURST, 0}};
+
+static struct {
+    struct {
+        uint64_t rx;
+        uint64_t policed;
+        uint64_t queue_full;
+    } ctrl[PUNT_NUM_CTRL];
+    uint64_t data_rx;
+    uint64_t data_queue_full;
+    uint64_t invalid;
+} punt_stats;
+
+static inline bool queue_empty(const pkt_queue_t *q) {
+    return q->head == q->tail;
+}
+
+static inline bool queue_full(const pkt_queue_t *q) {
+    return q->tail - q->head > q->mask;
+}
+
+static inline void queue_push(pkt_queue_t *q, pkt_buf_t *pkt) {
+    q->slots[q->tail++ & q->mask] = pkt;
+}
+
+static inline pkt_buf_t *queue_pop(pkt_queue_t *q) {
+    return q->slots[q->head++ & q->mask];
+}
+
+static bool ctrl_policer_admit(int ctrl) {
+    uint64_t now = get_clock_ms();
+    uint64_t elapsed = now - ctrl_policers[ctrl].last_refill;
+    if (elapsed > 0) {
+        uint64_t tokens = ctrl_policers[ctrl].tokens + elapsed * CTRL_RATE_PPS / 1000;
+        ctrl_policers[ctrl].tokens = tokens > CTRL_BURST ? CTRL_BURST : (uint32_t) tokens;
+        ctrl_policers[ctrl].last_refill = now;
+    }
+    if (ctrl_policers[ctrl].tokens == 0) {
+        return false;
+    }
+    ctrl_policers[ctrl].tokens--;
+    return true;
+}
+
+static inline bool is_my_ip(in_addr_t ip) {
+    for (int i = 0; i < config->num_if; i++) {
+        if (if_active(i) && config->if_ips[i] == ip) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool is_my_ip6(const struct in6_addr *ip6) {
+    for (int i = 0; i < config->num_if; i++) {
+        if (if_active(i) && (IN6_ARE_ADDR_EQUAL(&config->if_ip6s[i], ip6) ||
+                             IN6_ARE_ADDR_EQUAL(&config->if_ll6s[i], ip6))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static punt_class_t classify_frame(const uint8_t *packet, size_t len, int if_idx) {
+    if (len < sizeof(struct ether_header)) {
+        return PUNT_DROP;
+    }
+    const struct ether_header *eth_hdr = (const struct ether_header *) packet;
+    // Check dst mac address
+    if (memcmp(eth_hdr->ether_dhost, &config->if_macs[if_idx], sizeof(struct ether_addr)) != 0 &&
+        !is_multicast_mac((const struct ether_addr *) eth_hdr->ether_dhost) &&
+        !is_broadcast_mac((const struct ether_addr *) eth_hdr->ether_dhost)) {
+        // Target MAC is not broadcast / multicast / router's MAC address
+        return PUNT_DROP;
+    }
+    if (eth_hdr->ether_type == htons(ETHERTYPE_ARP)) {
+        return PUNT_ARP;
+    }
+    if (eth_hdr->ether_type == htons(ETHERTYPE_IP) && len >= sizeof(struct ether_header) + sizeof(struct iphdr)) {
+        const struct iphdr *ip_hdr = (const struct iphdr *) (eth_hdr + 1);
+        size_t ip_hdr_len = ip_hdr->ihl * 4;
+        if (ip_hdr->ihl < 5) {
+            return PUNT_DATA;       // Dropped by ip4-input
+        }
+        if (ip_hdr->protocol == IPPROTO_UDP &&
+            len >= sizeof(struct ether_header) + ip_hdr_len + sizeof(struct udphdr)) {
+            const struct udphdr *udp_hdr = (const struct udphdr *) ((const uint8_t *) ip_hdr + ip_hdr_len);
+            // Transit traffic to port 520 is forwarded like any other
+            if (udp_hdr->dest == htons(RIP_UDP_PORT) &&
+                (ip_hdr->daddr == htonl(RIP_MULTICAST_ADDR) || is_my_ip(ip_hdr->daddr))) {
+                return PUNT_RIP;
+            }
+        } else if (ip_hdr->protocol == IPPROTO_ICMP && is_my_ip(ip_hdr->daddr)) {
+            return PUNT_ICMP;
+        }
+    }
+    if (eth_hdr->ether_type == htons(ETHERTYPE_IPV6) &&
+        len >= sizeof(struct ether_header) + sizeof(struct ip6_hdr) + sizeof(struct icmp6_hdr)) {
+        const struct ip6_hdr *ip6_hdr = (const struct ip6_hdr *) (eth_hdr + 1);
+        if (ip6_hdr->ip6_nxt == IPPROTO_ICMPV6) {
+            const struct icmp6_hdr *icmp6_hdr = (const struct icmp6_hdr *) (ip6_hdr + 1);
+            // Neighbor discovery, or echo request to router
+            if (icmp6_hdr->icmp6_type >= ND_ROUTER_SOLICIT && icmp6_hdr->icmp6_type <= ND_REDIRECT) {
+                return PUNT_ARP;
+            }
+            if (icmp6_hdr->icmp6_type == ICMP6_ECHO_REQUEST && is_my_ip6(&ip6_hdr->ip6_dst)) {
+                return PUNT_ICMP;
+            }
+        }
+    }
+    return PUNT_DATA;
+}
+
+// Pull in up to RX_BURST frames and sort them into the control / data queues. Return the number of frames received.
+static int punt_poll(int timeout_ms) {
+    int num_recv;
+    for (num_recv = 0; num_recv < RX_BURST; num_recv++) {
+        pkt_buf_t *pkt = pkt_alloc();
+        if (pkt == NULL) {
+            // Pool exhausted, leave frames in the kernel until queued packets are released
+            break;
+        }
+        uint8_t *packet = pkt->data;
         int if_idx;
-        uint32_t recv_len = recv_packet(timeout_ms, packet, &if_idx);
-        if (recv_len == 0) {
-            return 0;
+        size_t len = recv_packet(num_recv == 0 ? timeout_ms : 0, packet, &if_idx, &pkt->rx_ns);
+        if (len == 0) {
+            pkt_free(pkt);
+            break;
         }
-        if (recv_len >= sizeof(struct ether_header)) {
-            // Handle ethernet protocol
-            struct ether_header *eth_hdr = (struct ether_header *) packet;
-            // Check dst mac address
-            int dst_mac_is_me = memcmp(eth_hdr->ether_dhost, &if_macs[if_idx], sizeof(struct ether_addr)) == 0;
-            if (!dst_mac_is_me && !is_multicast_mac((struct ether_addr *) eth_hdr->ether_dhost) &&
-                !is_broadcast_mac((struct ether_addr *) eth_hdr->ether_dhost)) {
-                // Target MAC is not broadcast / multicast / router's MAC address
-                fprintf(stderr, "Dest MAC address %s is not broadcast or multicast or router's address\n",
-                        mac2str(eth_hdr->ether_dhost));
+        pkt->len = len;
+        pkt->if_idx = if_idx;
+        punt_class_t cls = classify_frame(packet, len, if_idx);
+        if (cls >= PUNT_ARP) {
+            int ctrl = cls - PUNT_ARP;
+            punt_stats.ctrl[ctrl].rx++;
+            if (!ctrl_policer_admit(ctrl)) {
+                punt_stats.ctrl[ctrl].policed++;
+                CAPTURE(CAPTURE_DROP, if_idx, NULL, packet, len, DROP_POLICED);
+            } else if (queue_full(&ctrl_queue)) {
+                punt_stats.ctrl[ctrl].queue_full++;
+                CAPTURE(CAPTURE_DROP, if_idx, NULL, packet, len, DROP_QUEUE_FULL);
+            } else {
+                queue_push(&ctrl_queue, pkt);
                 continue;
             }
-            // Handle ip/arp protocol
-            if (eth_hdr->ether_type == htons(ETHERTYPE_IP)) {
-                // Got ip packet
-                size_t ip_len = recv_len - sizeof(struct ether_header);
-                memcpy(ip_packet, packet + sizeof(struct ether_header), ip_len);
-                *out_if_idx = if_idx;
-                memcpy(out_src_mac, eth_hdr->ether_shost, sizeof(struct ether_addr));
-                memcpy(out_dst_mac, eth_hdr->ether_dhost, sizeof(struct ether_addr));
-                return ip_len;
-            } else if (eth_hdr->ether_type == htons(ETHERTYPE_ARP)) {
-                uint8_t *arp_packet = packet + sizeof(struct ether_header);
-                size_t arp_len = recv_len - sizeof(struct ether_header);
-                if (arp_len != sizeof(arp_packet_t)) {
-                    fprintf(stderr, "Broken ARP packet\n");
-                    continue;
-                }
-                arp_packet_t *arp_pkt = (arp_packet_t *) arp_packet;
-                struct ether_addr src_mac, dst_mac;
-                in_addr_t src_ip, dst_ip;
-                memcpy(&src_mac, &arp_pkt->ar_sha, sizeof(struct ether_addr));
-                src_ip = arp_pkt->ar_sip;
-                memcpy(&dst_mac, &arp_pkt->ar_tha, sizeof(struct ether_addr));
-                dst_ip = arp_pkt->ar_tip;
-
-                if (arp_pkt->hdr.ar_op == htons(ARPOP_REPLY)) {
-                    // ARP reply, learn it
-                    arp_insert_entry(src_ip, if_idx, &src_mac);
-                    printf("Learned ARP: %s at %s from %s\n",
-                           mac2str((uint8_t *) &src_mac), ip2str(src_ip), if_names[if_idx]);
-                } else if (arp_pkt->hdr.ar_op == htons(ARPOP_REQUEST)) {
-                    // ARP request
-                    int my_if;
-                    for (my_if = 0; my_if < NUM_IF; my_if++) {
-                        if (if_ips[my_if] == dst_ip) {
-                            break;
-                        }
-                    }
-                    if (my_if < NUM_IF) {
-                        // request my IP, send ARP reply
-                        printf("Sending ARP reply: %s is at %s\n",
-                               ip2str(if_ips[my_if]), mac2str((uint8_t *) &if_macs[my_if]));
-                        send_arp_reply(if_idx, if_ips[my_if], &if_macs[my_if], src_ip, &src_mac);
-                    } else {
-                        fprintf(stderr, "Unknown MAC address of %s\n", ip2str(dst_ip));
-                    }
-                } else {
-                    fprintf(stderr, "Unsupported ARP Type\n");
-                }
+        } else if (cls == PUNT_DATA) {
+            punt_stats.data_rx++;
+            if (queue_full(&data_queue)) {
+                punt_stats.data_queue_full++;
+                CAPTURE(CAPTURE_DROP, if_idx, NULL, packet, len, DROP_QUEUE_FULL);
             } else {
-                fprintf(stderr, "Unsupported ethernet type: %04x\n", ntohs(eth_hdr->ether_type));
+                queue_push(&data_queue, pkt);
+                continue;
+            }
+        } else {
+            punt_stats.invalid++;
+            CAPTURE(CAPTURE_DROP, if_idx, NULL, packet, len, DROP_INVALID);
+        }
+        pkt_free(pkt);
+    }
+    return num_recv;
+}
+
+int recv_frames(int timeout_ms, pkt_buf_t **pkts, int max_pkts) {
+    int num_pkts = 0;
+    while (num_pkts < max_pkts) {
+        pkt_buf_t *pkt;
+        if (!queue_empty(&ctrl_queue) && ctrl_budget > 0) {
+            ctrl_budget--;
+            pkt = queue_pop(&ctrl_queue);
+        } else if (!queue_empty(&data_queue)) {
+            pkt = queue_pop(&data_queue);
+        } else if (num_pkts > 0) {
+            break;
+        } else {
+            // Both queues are drained for this iteration: refill control budget and pull in a new burst
+            ctrl_budget = CTRL_BUDGET;
+            bool ctrl_pending = !queue_empty(&ctrl_queue);
+            if (punt_poll(ctrl_pending ? 0 : timeout_ms) == 0 && !ctrl_pending) {
+                return 0;
+            }
+            continue;
+        }
+        if (!if_active(pkt->if_idx)) {
+            // Interface is removed by config reload while the frame is queued
+            pkt_free(pkt);
+            continue;
+        }
+        pkts[num_pkts++] = pkt;
+    }
+    return num_pkts;
+}
+
+void print_punt_stats() {
+    printf("================= PUNT STATS ==================\n");
+    for (int i = 0; i < PUNT_NUM_CTRL; i++) {
+        printf("%-8s rx %" PRIu64 ", policed %" PRIu64 ", queue full %" PRIu64 "\n", punt_ctrl_names[i],
+               punt_stats.ctrl[i].rx, punt_stats.ctrl[i].policed, punt_stats.ctrl[i].queue_full);
+    }
+    printf("data:    rx %" PRIu64 ", queue full %" PRIu64 "\n", punt_stats.data_rx, punt_stats.data_queue_full);
+    printf("invalid: %" PRIu64 "\n", punt_stats.invalid);
+}
+
+void arp_input(const pkt_buf_t *pkt) {
+    int if_idx = pkt->if_idx;
+    if (pkt->len != sizeof(arp_packet_t)) {
+        fprintf(stderr, "Broken ARP packet\n");
+        return;
+    }
+    const arp_packet_t *arp_pkt = (const arp_packet_t *) pkt->data;
+    struct ether_addr src_mac, dst_mac;
+    in_addr_t src_ip, dst_ip;
+    memcpy(&src_mac, &arp_pkt->ar_sha, sizeof(struct ether_addr));
+    src_ip = arp_pkt->ar_sip;
+    memcpy(&dst_mac, &arp_pkt->ar_tha, sizeof(struct ether_addr));
+    dst_ip = arp_pkt->ar_tip;
+
+    if (arp_pkt->hdr.ar_op == htons(ARPOP_REPLY)) {
+        // ARP reply, learn it
+        arp_insert_entry(src_ip, if_idx, &src_mac);
+        printf("Learned ARP: %s at %s from %s\n",
+               mac2str((uint8_t *) &src_mac), ip2str(src_ip), config->if_names[if_idx]);
+    } else if (arp_pkt->hdr.ar_op == htons(ARPOP_REQUEST)) {
+        // ARP request
+        int my_if;
+        for (my_if = 0; my_if < config->num_if; my_if++) {
+            if (if_active(my_if) && config->if_ips[my_if] == dst_ip) {
+                break;
             }
+        }
+        if (my_if < config->num_if) {
+            // request my IP, send ARP reply
+            printf("Sending ARP reply: %s is at %s\n",
+                   ip2str(config->if_ips[my_if]), mac2str((uint8_t *) &config->if_macs[my_if]));
+            send_arp_reply(if_idx, config->if_ips[my_if], &config->if_macs[my_if], src_ip, &src_mac);
         } else {
-            fprintf(stderr, "Broken ethernet packet\n");
+            fprintf(stderr, "Unknown MAC address of %s\n", ip2str(dst_ip));
         }
+    } else {
+        fprintf(stderr, "Unsupported ARP Type\n");
+    }
+}
+
+void ether_push_header(pkt_buf_t *pkt, int if_idx, const struct ether_addr *dst_mac, uint16_t ether_type) {
+    // dst_mac may point into the received header, which is overwritten
+    struct ether_addr dst;
+    memcpy(&dst, dst_mac, sizeof(struct ether_addr));
+    struct ether_header *ether_hdr = (struct ether_header *) pkt_push(pkt, sizeof(struct ether_header));
+    memcpy(ether_hdr->ether_dhost, &dst, sizeof(struct ether_addr));
+    memcpy(ether_hdr->ether_shost, &config->if_macs[if_idx], sizeof(struct ether_addr));
+    ether_hdr->ether_type = htons(ether_type);
+    pkt->tx_if_idx = if_idx;
+}
+
+void ether_send(pkt_buf_t *pkt, int if_idx, const struct ether_addr *dst_mac, uint16_t ether_type) {
+    ether_push_header(pkt, if_idx, dst_mac, ether_type);
+    if (if_is_tunnel(if_idx)) {
+        ether_tunnel_output(pkt);
+        return;
     }
+    send_packet(pkt->data, pkt->len, if_idx);
 }
 
 void send_ip_packet(const uint8_t *ip_packet, size_t ip_len, int if_idx, const struct ether_addr *dst_mac) {
-    send_l3_packet(ip_packet, ip_len, if_idx, dst_mac, htons(ETHERTYPE_IP));
+    send_l3_packet(ip_packet, ip_len, if_idx, dst_mac, ETHERTYPE_IP);
+}
+
+void send_ip6_packet(const uint8_t *ip6_packet, size_t ip6_len, int if_idx, const struct ether_addr *dst_mac) {
+    send_l3_packet(ip6_packet, ip6_len, if_idx, dst_mac, ETHERTYPE_IPV6);
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "error.h"
+#include "pktbuf.h"
 #include <net/ethernet.h>
 #include <arpa/inet.h>
 
@@ -10,9 +11,39 @@ RC arp_get_mac(in_addr_t ip, int if_idx, struct ether_addr *mac);
 
 void print_arp_table();
 
-RC ether_init();
+void print_punt_stats();
 
-size_t recv_ip_packet(int timeout_ms, uint8_t *ip_packet, int *out_if_idx,
-                      struct ether_addr *out_src_mac, struct ether_addr *out_dst_mac);
+// Called by ether_send for a frame on a tunnel interface, to encapsulate and send it over the underlay. The caller
+// still owns pkt.
+typedef void (*tunnel_output_fn)(pkt_buf_t *pkt);
 
+RC ether_init(tunnel_output_fn tunnel_output);
+
+// Add ARP entry of interface's own address, or flush all entries learned on interface, on config reload
+RC arp_if_up(int if_idx);
+
+void arp_if_down(int if_idx);
+
+// Receive up to max_pkts frames of active interfaces, control frames first within their budget. The frames are owned
+// by the caller, who sends or frees them.
+int recv_frames(int timeout_ms, pkt_buf_t **pkts, int max_pkts);
+
+// Ethernet header of a received frame whose header is pulled, until a header is pushed for sending
+static inline struct ether_header *rx_eth_header(const pkt_buf_t *pkt) {
+    return (struct ether_header *) (pkt->data - sizeof(struct ether_header));
+}
+
+// Handle an ARP packet, ethernet header pulled
+void arp_input(const pkt_buf_t *pkt);
+
+// Push ethernet header from interface if_idx to dst_mac, and set transmit interface. Ether type in host byte order.
+void ether_push_header(pkt_buf_t *pkt, int if_idx, const struct ether_addr *dst_mac, uint16_t ether_type);
+
+// Push ethernet header and send the L3 packet of pkt right away, in place, through the tunnel output on tunnel
+// interfaces. The caller still owns pkt.
+void ether_send(pkt_buf_t *pkt, int if_idx, const struct ether_addr *dst_mac, uint16_t ether_type);
+
+// Copy an L3 packet the router built elsewhere, e.g. on the stack, into a packet buffer and send it
 void send_ip_packet(const uint8_t *ip_packet, size_t ip_len, int if_idx, const struct ether_addr *dst_mac);
+
+void send_ip6_packet(const uint8_t *ip6_packet, size_t ip6_len, int if_idx, const struct ether_addr *dst_mac);
@@ -0,0 +1,235 @@
+#include "fib.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAS_AVX2_PATH 1
+#endif
+
+#define FIB_MAX_GROUPS (1 << 22)    // tbl8 indices of AVX2 gathers are signed 32-bit
+#define FIB_PREFETCH_AHEAD 8        // Addresses between a prefetch and the lookup it serves
+
+static inline uint32_t make_entry(uint32_t nh, int len) {
+    return FIB_VALID | (uint32_t) len << FIB_DEPTH_SHIFT | nh;
+}
+
+static inline int entry_depth(uint32_t entry) {
+    return (int) (entry >> FIB_DEPTH_SHIFT) & 0x3f;
+}
+
+static inline uint32_t *get_group(const fib_t *fib, uint32_t tbl24_entry) {
+    return &fib->tbl8[(size_t) (tbl24_entry & FIB_VALUE_MASK) * FIB_TBL8_GROUP_SIZE];
+}
+
+static inline uint32_t prefix_bits(in_addr_t prefix, int len) {
+    return len == 0 ? 0 : ntohl(prefix) & (~0u << (32 - len));
+}
+
+static void lookup_burst_scalar(const fib_t *fib, const in_addr_t *addrs, int n, uint32_t *results);
+
+static void (*lookup_burst_fn)(const fib_t *, const in_addr_t *, int, uint32_t *) = lookup_burst_scalar;
+
+#ifdef HAS_AVX2_PATH
+static void lookup_burst_avx2(const fib_t *fib, const in_addr_t *addrs, int n, uint32_t *results);
+#endif
+
+RC fib_init(fib_t *fib, uint32_t num_groups, bool hugepage) {
+    if (num_groups > FIB_MAX_GROUPS) {
+        fprintf(stderr, "Too many FIB tbl8 groups %u, at most %u\n", num_groups, FIB_MAX_GROUPS);
+        return OUT_OF_RANGE_ERROR;
+    }
+    size_t tbl24_size = FIB_TBL24_SIZE * sizeof(uint32_t);
+    size_t tbl8_size = (size_t) num_groups * FIB_TBL8_GROUP_SIZE * sizeof(uint32_t);
+    size_t free_size = num_groups * sizeof(uint32_t);
+    // Each allocation is aligned to 64 bytes
+    RC rc = arena_init(&fib->arena, tbl24_size + tbl8_size + free_size + 3 * 64, hugepage);
+    if (rc) { return rc; }
+    // Fresh pages are zero, which is an invalid entry
+    fib->tbl24 = arena_alloc(&fib->arena, tbl24_size);
+    fib->tbl8 = arena_alloc(&fib->arena, tbl8_size);
+    fib->free_groups = arena_alloc(&fib->arena, free_size);
+    for (uint32_t i = 0; i < num_groups; i++) {
+        fib->free_groups[i] = num_groups - 1 - i;
+    }
+    fib->num_free_groups = fib->num_groups = num_groups;
+    fib_set_scalar(false);
+    return 0;
+}
+
+void fib_destroy(fib_t *fib) {
+    arena_destroy(&fib->arena);
+}
+
+void fib_set_scalar(bool scalar) {
+    lookup_burst_fn = lookup_burst_scalar;
+#ifdef HAS_AVX2_PATH
+    if (!scalar && __builtin_cpu_supports("avx2")) {
+        lookup_burst_fn = lookup_burst_avx2;
+    }
+#endif
+}
+
+// Set entry unless it is set by a longer prefix
+static inline void add_entry(uint32_t *entry, uint32_t value, int len) {
+    if (!(*entry & FIB_VALID) || entry_depth(*entry) <= len) {
+        *entry = value;
+    }
+}
+
+// Reset entry if it is set by the deleted prefix
+static inline void del_entry(uint32_t *entry, uint32_t value, int len) {
+    if ((*entry & FIB_VALID) && entry_depth(*entry) == len) {
+        *entry = value;
+    }
+}
+
+RC fib_add(fib_t *fib, in_addr_t prefix, int len, uint32_t nh) {
+    if (len < 0 || len > 32 || nh > FIB_MAX_NEXT_HOP) {
+        fprintf(stderr, "Invalid FIB prefix length %d or next hop %u\n", len, nh);
+        return OUT_OF_RANGE_ERROR;
+    }
+    uint32_t ip = prefix_bits(prefix, len);
+    uint32_t value = make_entry(nh, len);
+    if (len <= 24) {
+        uint32_t start = ip >> 8, end = start + (1u << (24 - len));
+        for (uint32_t i = start; i < end; i++) {
+            uint32_t *entry = &fib->tbl24[i];
+            if (*entry & FIB_EXT) {
+                uint32_t *group = get_group(fib, *entry);
+                for (int j = 0; j < FIB_TBL8_GROUP_SIZE; j++) {
+                    add_entry(&group[j], value, len);
+                }
+            } else {
+                add_entry(entry, value, len);
+            }
+        }
+        return 0;
+    }
+    uint32_t *entry = &fib->tbl24[ip >> 8];
+    if (!(*entry & FIB_EXT)) {
+        if (fib->num_free_groups == 0) {
+            fprintf(stderr, "FIB tbl8 groups exhausted\n");
+            return OVERFLOW_ERROR;
+        }
+        uint32_t group_idx = fib->free_groups[--fib->num_free_groups];
+        uint32_t *group = &fib->tbl8[(size_t) group_idx * FIB_TBL8_GROUP_SIZE];
+        // Addresses of the group not under the new prefix keep the prefix covering the whole /24
+        for (int j = 0; j < FIB_TBL8_GROUP_SIZE; j++) {
+            group[j] = *entry;
+        }
+        *entry = FIB_VALID | FIB_EXT | group_idx;
+    }
+    uint32_t *group = get_group(fib, *entry);
+    uint32_t start = ip & 0xff, end = start + (1u << (32 - len));
+    for (uint32_t j = start; j < end; j++) {
+        add_entry(&group[j], value, len);
+    }
+    return 0;
+}
+
+// Fold a tbl8 group back into its tbl24 entry once no prefix longer than /24 is left in it
+static void try_free_group(fib_t *fib, uint32_t idx24) {
+    uint32_t group_idx = fib->tbl24[idx24] & FIB_VALUE_MASK;
+    const uint32_t *group = get_group(fib, fib->tbl24[idx24]);
+    uint32_t first = group[0];
+    if ((first & FIB_VALID) && entry_depth(first) > 24) {
+        return;
+    }
+    for (int j = 1; j < FIB_TBL8_GROUP_SIZE; j++) {
+        if (group[j] != first) {
+            return;
+        }
+    }
+    fib->tbl24[idx24] = first;
+    fib->free_groups[fib->num_free_groups++] = group_idx;
+}
+
+void fib_del(fib_t *fib, in_addr_t prefix, int len, uint32_t sub_nh, int sub_len) {
+    if (len < 0 || len > 32) {
+        return;
+    }
+    uint32_t ip = prefix_bits(prefix, len);
+    uint32_t value = sub_nh == FIB_NO_ROUTE ? 0 : make_entry(sub_nh, sub_len);
+    if (len <= 24) {
+        uint32_t start = ip >> 8, end = start + (1u << (24 - len));
+        for (uint32_t i = start; i < end; i++) {
+            uint32_t *entry = &fib->tbl24[i];
+            if (*entry & FIB_EXT) {
+                uint32_t *group = get_group(fib, *entry);
+                for (int j = 0; j < FIB_TBL8_GROUP_SIZE; j++) {
+                    del_entry(&group[j], value, len);
+                }
+                try_free_group(fib, i);
+            } else {
+                del_entry(entry, value, len);
+            }
+        }
+        return;
+    }
+    uint32_t idx24 = ip >> 8;
+    if (!(fib->tbl24[idx24] & FIB_EXT)) {
+        return;
+    }
+    uint32_t *group = get_group(fib, fib->tbl24[idx24]);
+    uint32_t start = ip & 0xff, end = start + (1u << (32 - len));
+    for (uint32_t j = start; j < end; j++) {
+        del_entry(&group[j], value, len);
+    }
+    try_free_group(fib, idx24);
+}
+
+static void lookup_burst_scalar(const fib_t *fib, const in_addr_t *addrs, int n, uint32_t *results) {
+    for (int i = 0; i < n && i < FIB_PREFETCH_AHEAD; i++) {
+        __builtin_prefetch(&fib->tbl24[ntohl(addrs[i]) >> 8]);
+    }
+    for (int i = 0; i < n; i++) {
+        if (i + FIB_PREFETCH_AHEAD < n) {
+            __builtin_prefetch(&fib->tbl24[ntohl(addrs[i + FIB_PREFETCH_AHEAD]) >> 8]);
+        }
+        results[i] = fib_lookup(fib, addrs[i]);
+    }
+}
+
+#ifdef HAS_AVX2_PATH
+__attribute__((target("avx2")))
+static void lookup_burst_avx2(const fib_t *fib, const in_addr_t *addrs, int n, uint32_t *results) {
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i ext_bit = _mm256_set1_epi32(FIB_EXT);
+    const __m256i valid_bit = _mm256_set1_epi32((int) FIB_VALID);
+    const __m256i value_mask = _mm256_set1_epi32(FIB_VALUE_MASK);
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    const __m256i no_route = _mm256_set1_epi32(-1);
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        // Gathers overlap the misses of 8 addresses, prefetch the next 8 as well
+        for (int j = i + 8; j < i + 16 && j < n; j++) {
+            __builtin_prefetch(&fib->tbl24[ntohl(addrs[j]) >> 8]);
+        }
+        __m256i ip = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) &addrs[i]), bswap);
+        __m256i entry = _mm256_i32gather_epi32((const int *) fib->tbl24, _mm256_srli_epi32(ip, 8), 4);
+        __m256i ext = _mm256_cmpeq_epi32(_mm256_and_si256(entry, ext_bit), ext_bit);
+        if (!_mm256_testz_si256(ext, ext)) {
+            __m256i idx8 = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(entry, value_mask), 8),
+                                            _mm256_and_si256(ip, low_byte));
+            entry = _mm256_mask_i32gather_epi32(entry, (const int *) fib->tbl8, idx8, ext, 4);
+        }
+        __m256i valid = _mm256_cmpeq_epi32(_mm256_and_si256(entry, valid_bit), valid_bit);
+        __m256i result = _mm256_blendv_epi8(no_route, _mm256_and_si256(entry, value_mask), valid);
+        _mm256_storeu_si256((__m256i *) &results[i], result);
+    }
+    for (; i < n; i++) {
+        results[i] = fib_lookup(fib, addrs[i]);
+    }
+}
+#endif
+
+void fib_lookup_burst(const fib_t *fib, const in_addr_t *addrs, int n, uint32_t *results) {
+    lookup_burst_fn(fib, addrs, n, results);
+}
+
+void print_fib_stats(const fib_t *fib) {
+    printf("FIB: tbl8 groups used %u / %u, burst lookup %s\n", fib->num_groups - fib->num_free_groups,
+           fib->num_groups, lookup_burst_fn == lookup_burst_scalar ? "scalar" : "AVX2");
+}
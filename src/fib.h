@@ -0,0 +1,63 @@
+#pragma once
+
+#include "error.h"
+#include "arena.h"
+#include <arpa/inet.h>
+#include <inttypes.h>
+
+// ===== IPv4 FIB =====
+// DIR-24-8 longest prefix match (Gupta et al.): the first 24 bits of the address index tbl24 directly, prefixes
+// longer than /24 extend their tbl24 entry into a group of 256 tbl8 entries. A lookup costs one memory access, two
+// for addresses under prefixes longer than /24. Each entry carries the length of the prefix it was set by, so that
+// adding a prefix never overwrites entries of longer ones.
+#define FIB_NO_ROUTE UINT32_MAX
+#define FIB_MAX_NEXT_HOP 0xffffff
+
+#define FIB_VALID 0x80000000u
+#define FIB_EXT 0x40000000u     // tbl24 entry points to a tbl8 group
+#define FIB_DEPTH_SHIFT 24
+#define FIB_VALUE_MASK 0xffffff
+
+#define FIB_TBL24_SIZE (1 << 24)
+#define FIB_TBL8_GROUP_SIZE 256
+
+typedef struct fib {
+    uint32_t *tbl24;
+    uint32_t *tbl8;
+    uint32_t *free_groups;      // Stack of free tbl8 groups
+    uint32_t num_free_groups;
+    uint32_t num_groups;
+    arena_t arena;
+} fib_t;
+
+// Reserve tables for num_groups tbl8 groups. tbl24 takes 64 MB of address space, pages are committed as routes are
+// added.
+RC fib_init(fib_t *fib, uint32_t num_groups, bool hugepage);
+
+void fib_destroy(fib_t *fib);
+
+// Add or replace prefix (network byte order) / len with next hop index nh <= FIB_MAX_NEXT_HOP
+RC fib_add(fib_t *fib, in_addr_t prefix, int len, uint32_t nh);
+
+// Delete prefix / len. Addresses it covered fall back to the next longest prefix covering it, given by the caller as
+// sub_nh / sub_len, or FIB_NO_ROUTE if there is none.
+void fib_del(fib_t *fib, in_addr_t prefix, int len, uint32_t sub_nh, int sub_len);
+
+// Return next hop of the longest matching prefix, or FIB_NO_ROUTE
+static inline uint32_t fib_lookup(const fib_t *fib, in_addr_t addr) {
+    uint32_t ip = ntohl(addr);
+    uint32_t entry = fib->tbl24[ip >> 8];
+    if (entry & FIB_EXT) {
+        entry = fib->tbl8[(entry & FIB_VALUE_MASK) * FIB_TBL8_GROUP_SIZE + (ip & 0xff)];
+    }
+    return entry & FIB_VALID ? entry & FIB_VALUE_MASK : FIB_NO_ROUTE;
+}
+
+// Look up n addresses at once, overlapping their cache misses: entries of later addresses are prefetched while earlier
+// ones are resolved, and 8 addresses are looked up per AVX2 gather where the CPU supports it
+void fib_lookup_burst(const fib_t *fib, const in_addr_t *addrs, int n, uint32_t *results);
+
+// Force the portable burst lookup even if AVX2 is available, for benchmarks
+void fib_set_scalar(bool scalar);
+
+void print_fib_stats(const fib_t *fib);
@@ -0,0 +1,503 @@
+#include "fib.h"
+#include "lpm6.h"
+#include <endian.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Microbenchmark of IPv4 FIB lookups over a large synthetic table: one address at a time with fib_lookup(), against
+// fib_lookup_burst() with the scalar prefetching path and the AVX2 path. Destinations are drawn uniformly over the
+// routes, or Zipf distributed so that few routes take most of the traffic, as on a real router. The IPv6 LPM is
+// measured the same way over its own table.
+
+#define VERIFY_SAMPLES 1000
+
+typedef struct bench_route {
+    in_addr_t prefix;
+    int len;
+} bench_route_t;
+
+// Share of each prefix length in the table, roughly that of a full BGP table
+static const struct {
+    int len;
+    int weight;
+} len_weights[] = {
+        {8,  1},
+        {12, 2},
+        {16, 20},
+        {18, 20},
+        {20, 60},
+        {22, 120},
+        {23, 100},
+        {24, 600},
+        {28, 40},
+        {32, 37},
+};
+
+typedef struct bench_route6 {
+    uint64_t hi;        // Prefix bits in host byte order, as in lpm6
+    uint64_t lo;
+    int len;
+} bench_route6_t;
+
+// Share of each IPv6 prefix length, roughly that of a full BGP table
+static const struct {
+    int len;
+    int weight;
+} len6_weights[] = {
+        {20,  1},
+        {24,  2},
+        {28,  3},
+        {29,  10},
+        {32,  60},
+        {36,  10},
+        {40,  20},
+        {44,  40},
+        {48,  250},
+        {56,  5},
+        {64,  3},
+        {128, 1},
+};
+
+static struct {
+    int routes;
+    int routes6;
+    int lookups;
+    int burst;
+    double zipf;
+    int rounds;
+    bool hugepages;
+} opts = {
+        .routes = 500000,
+        .routes6 = 100000,
+        .lookups = 1 << 22,
+        .burst = 32,
+        .zipf = 1.0,
+        .rounds = 5,
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t rng_next() {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static inline uint64_t get_ns() {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (uint64_t) tp.tv_sec * 1000000000 + (uint64_t) tp.tv_nsec;
+}
+
+static inline in_addr_t len_to_mask(int len) {
+    return len == 0 ? 0 : htonl(~0u << (32 - len));
+}
+
+static void usage() {
+    printf("Usage: ./fib_bench [options]\n"
+           "Options:\n"
+           "  --routes N     Number of prefixes in the table (default 500000)\n"
+           "  --routes6 N    Number of prefixes in the IPv6 table, 0 to skip it (default 100000)\n"
+           "  --lookups N    Number of destinations per pass (default 4194304)\n"
+           "  --burst N      Addresses per burst lookup (default 32)\n"
+           "  --zipf S       Skew of Zipf distributed destinations (default 1.0)\n"
+           "  --rounds N     Passes per measurement, the best is reported (default 5)\n"
+           "  --hugepages    Back the FIB by hugepages\n");
+}
+
+static RC parse_opts(int argc, char **argv) {
+    static const struct option long_opts[] = {
+            {"routes",    required_argument, NULL, 'n'},
+            {"routes6",   required_argument, NULL, '6'},
+            {"lookups",   required_argument, NULL, 'l'},
+            {"burst",     required_argument, NULL, 'b'},
+            {"zipf",      required_argument, NULL, 'z'},
+            {"rounds",    required_argument, NULL, 'r'},
+            {"hugepages", no_argument,       NULL, 'h'},
+            {NULL, 0,                        NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                opts.routes = atoi(optarg);
+                break;
+            case '6':
+                opts.routes6 = atoi(optarg);
+                break;
+            case 'l':
+                opts.lookups = atoi(optarg);
+                break;
+            case 'b':
+                opts.burst = atoi(optarg);
+                break;
+            case 'z':
+                opts.zipf = atof(optarg);
+                break;
+            case 'r':
+                opts.rounds = atoi(optarg);
+                break;
+            case 'h':
+                opts.hugepages = true;
+                break;
+            default:
+                return CONFIG_PARSE_FAIL;
+        }
+    }
+    if (opts.routes <= 0 || opts.routes > FIB_MAX_NEXT_HOP || opts.routes6 < 0 || opts.lookups <= 0 ||
+        opts.burst <= 0 || opts.rounds <= 0 || opts.zipf <= 0) {
+        fprintf(stderr, "Options must be positive, and routes at most %d\n", FIB_MAX_NEXT_HOP);
+        return CONFIG_PARSE_FAIL;
+    }
+    return 0;
+}
+
+static int random_len() {
+    static int total = 0;
+    if (total == 0) {
+        for (size_t i = 0; i < sizeof(len_weights) / sizeof(len_weights[0]); i++) {
+            total += len_weights[i].weight;
+        }
+    }
+    int pick = (int) (rng_next() % total);
+    for (size_t i = 0; i < sizeof(len_weights) / sizeof(len_weights[0]); i++) {
+        pick -= len_weights[i].weight;
+        if (pick < 0) {
+            return len_weights[i].len;
+        }
+    }
+    return 24;
+}
+
+static int random_len6() {
+    static int total = 0;
+    if (total == 0) {
+        for (size_t i = 0; i < sizeof(len6_weights) / sizeof(len6_weights[0]); i++) {
+            total += len6_weights[i].weight;
+        }
+    }
+    int pick = (int) (rng_next() % total);
+    for (size_t i = 0; i < sizeof(len6_weights) / sizeof(len6_weights[0]); i++) {
+        pick -= len6_weights[i].weight;
+        if (pick < 0) {
+            return len6_weights[i].len;
+        }
+    }
+    return 48;
+}
+
+static RC build_table(fib_t *fib, bench_route_t *routes) {
+    uint32_t num_groups = 0;
+    for (int i = 0; i < opts.routes; i++) {
+        int len = random_len();
+        in_addr_t prefix = (in_addr_t) rng_next() & len_to_mask(len);
+        routes[i] = (bench_route_t) {prefix, len};
+        num_groups += len > 24;
+    }
+    // Long prefixes may share groups, this is an upper bound
+    RC rc = fib_init(fib, num_groups, opts.hugepages);
+    if (rc) { return rc; }
+    uint64_t start = get_ns();
+    for (int i = 0; i < opts.routes; i++) {
+        rc = fib_add(fib, routes[i].prefix, routes[i].len, i);
+        if (rc) { return rc; }
+    }
+    printf("Added %d routes in %.1f ms, tbl24 %s\n", opts.routes, (get_ns() - start) / 1e6,
+           fib->arena.hugepage ? "on hugepages" : "on normal pages");
+    print_fib_stats(fib);
+    return 0;
+}
+
+// Random address within route
+static inline in_addr_t address_in(const bench_route_t *route) {
+    return route->prefix | ((in_addr_t) rng_next() & ~len_to_mask(route->len));
+}
+
+// Route of each destination, uniform or Zipf distributed over num_routes routes
+static RC pick_routes(int num_routes, bool zipf, int *picks) {
+    if (!zipf) {
+        for (int i = 0; i < opts.lookups; i++) {
+            picks[i] = (int) (rng_next() % num_routes);
+        }
+        return 0;
+    }
+    // Route i has rank i, routes are in random order already
+    double *cdf = malloc(num_routes * sizeof(double));
+    if (cdf == NULL) {
+        return OVERFLOW_ERROR;
+    }
+    double sum = 0;
+    for (int i = 0; i < num_routes; i++) {
+        sum += 1.0 / pow(i + 1, opts.zipf);
+        cdf[i] = sum;
+    }
+    for (int i = 0; i < opts.lookups; i++) {
+        double u = (double) (rng_next() >> 11) / (double) (1ULL << 53) * sum;
+        int lo = 0, hi = num_routes - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        picks[i] = lo;
+    }
+    free(cdf);
+    return 0;
+}
+
+// Longest prefix match by linear scan
+static uint32_t lookup_linear(const bench_route_t *routes, in_addr_t addr) {
+    uint32_t best = FIB_NO_ROUTE;
+    int best_len = -1;
+    for (int i = 0; i < opts.routes; i++) {
+        // Later duplicates replace earlier ones in the FIB
+        if (routes[i].len >= best_len && (addr & len_to_mask(routes[i].len)) == routes[i].prefix) {
+            best = i;
+            best_len = routes[i].len;
+        }
+    }
+    return best;
+}
+
+static RC verify(const fib_t *fib, const bench_route_t *routes, const in_addr_t *addrs, uint32_t *results) {
+    fib_lookup_burst(fib, addrs, opts.lookups, results);
+    for (int i = 0; i < opts.lookups; i++) {
+        uint32_t expected = i < VERIFY_SAMPLES ? lookup_linear(routes, addrs[i]) : fib_lookup(fib, addrs[i]);
+        if (results[i] != expected) {
+            fprintf(stderr, "Lookup mismatch for %s: %u, expected %u\n", inet_ntoa(*(struct in_addr *) &addrs[i]),
+                    results[i], expected);
+            return OUT_OF_RANGE_ERROR;
+        }
+    }
+    return 0;
+}
+
+typedef enum {
+    PATH_SINGLE = 0,
+    PATH_BURST_SCALAR,
+    PATH_BURST_AVX2,
+    NUM_PATHS,
+} path_t;
+
+static const char *path_names[NUM_PATHS] = {"single", "burst scalar", "burst AVX2"};
+
+// Return best ns per lookup over all rounds
+static double measure(const fib_t *fib, path_t path, const in_addr_t *addrs, uint32_t *results) {
+    fib_set_scalar(path == PATH_BURST_SCALAR);
+    uint64_t best = UINT64_MAX;
+    for (int round = 0; round < opts.rounds; round++) {
+        uint64_t start = get_ns();
+        if (path == PATH_SINGLE) {
+            for (int i = 0; i < opts.lookups; i++) {
+                results[i] = fib_lookup(fib, addrs[i]);
+            }
+        } else {
+            for (int i = 0; i < opts.lookups; i += opts.burst) {
+                int n = opts.lookups - i < opts.burst ? opts.lookups - i : opts.burst;
+                fib_lookup_burst(fib, &addrs[i], n, &results[i]);
+            }
+        }
+        uint64_t elapsed = get_ns() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return (double) best / opts.lookups;
+}
+
+// ===== IPv6 =====
+static inline void mask6(uint64_t *hi, uint64_t *lo, int len) {
+    *hi = len == 0 ? 0 : len < 64 ? *hi & ~0ULL << (64 - len) : *hi;
+    *lo = len <= 64 ? 0 : len < 128 ? *lo & ~0ULL << (128 - len) : *lo;
+}
+
+static inline struct in6_addr u64_to_addr(uint64_t hi, uint64_t lo) {
+    struct in6_addr addr;
+    uint64_t words[2] = {htobe64(hi), htobe64(lo)};
+    memcpy(&addr, words, sizeof(addr));
+    return addr;
+}
+
+static RC build_table6(lpm6_t *lpm, bench_route6_t *routes) {
+    RC rc = lpm6_init(lpm, opts.routes6);
+    if (rc) { return rc; }
+    uint64_t start = get_ns();
+    for (int i = 0; i < opts.routes6; i++) {
+        int len = random_len6();
+        uint64_t hi = rng_next(), lo = rng_next();
+        mask6(&hi, &lo, len);
+        routes[i] = (bench_route6_t) {hi, lo, len};
+        struct in6_addr prefix = u64_to_addr(hi, lo);
+        rc = lpm6_add(lpm, &prefix, len, i);
+        if (rc) { return rc; }
+    }
+    rc = lpm6_build(lpm);
+    if (rc) { return rc; }
+    printf("Added %d IPv6 routes in %.1f ms, %d prefix lengths\n", opts.routes6, (get_ns() - start) / 1e6,
+           lpm->num_lengths);
+    return 0;
+}
+
+// Random address within route
+static inline struct in6_addr address_in6(const bench_route6_t *route) {
+    uint64_t hi = rng_next(), lo = rng_next(), mask_hi = ~0ULL, mask_lo = ~0ULL;
+    mask6(&mask_hi, &mask_lo, route->len);
+    return u64_to_addr(route->hi | (hi & ~mask_hi), route->lo | (lo & ~mask_lo));
+}
+
+// Longest prefix match by linear scan
+static uint32_t lookup_linear6(const bench_route6_t *routes, const struct in6_addr *addr) {
+    uint64_t words[2];
+    memcpy(words, addr, sizeof(words));
+    uint32_t best = LPM6_NO_ROUTE;
+    int best_len = -1;
+    for (int i = 0; i < opts.routes6; i++) {
+        uint64_t hi = be64toh(words[0]), lo = be64toh(words[1]);
+        mask6(&hi, &lo, routes[i].len);
+        // Later duplicates replace earlier ones in the LPM
+        if (routes[i].len >= best_len && hi == routes[i].hi && lo == routes[i].lo) {
+            best = i;
+            best_len = routes[i].len;
+        }
+    }
+    return best;
+}
+
+static RC verify6(const lpm6_t *lpm, const bench_route6_t *routes, const struct in6_addr *addrs, uint32_t *results) {
+    lpm6_lookup_burst(lpm, addrs, opts.lookups, results);
+    for (int i = 0; i < opts.lookups; i++) {
+        uint32_t expected = i < VERIFY_SAMPLES ? lookup_linear6(routes, &addrs[i]) : lpm6_lookup(lpm, &addrs[i]);
+        if (results[i] != expected) {
+            char s[INET6_ADDRSTRLEN];
+            fprintf(stderr, "Lookup mismatch for %s: %u, expected %u\n", inet_ntop(AF_INET6, &addrs[i], s, sizeof(s)),
+                    results[i], expected);
+            return OUT_OF_RANGE_ERROR;
+        }
+    }
+    return 0;
+}
+
+// Return best ns per lookup over all rounds
+static double measure6(const lpm6_t *lpm, bool burst, const struct in6_addr *addrs, uint32_t *results) {
+    uint64_t best = UINT64_MAX;
+    for (int round = 0; round < opts.rounds; round++) {
+        uint64_t start = get_ns();
+        if (!burst) {
+            for (int i = 0; i < opts.lookups; i++) {
+                results[i] = lpm6_lookup(lpm, &addrs[i]);
+            }
+        } else {
+            for (int i = 0; i < opts.lookups; i += opts.burst) {
+                int n = opts.lookups - i < opts.burst ? opts.lookups - i : opts.burst;
+                lpm6_lookup_burst(lpm, &addrs[i], n, &results[i]);
+            }
+        }
+        uint64_t elapsed = get_ns() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return (double) best / opts.lookups;
+}
+
+static RC bench_lpm6(int *picks, uint32_t *results) {
+    bench_route6_t *routes = malloc(opts.routes6 * sizeof(bench_route6_t));
+    struct in6_addr *addrs = malloc(opts.lookups * sizeof(struct in6_addr));
+    if (routes == NULL || addrs == NULL) {
+        fprintf(stderr, "Cannot allocate benchmark arrays\n");
+        free(routes);
+        free(addrs);
+        return OVERFLOW_ERROR;
+    }
+    lpm6_t lpm;
+    RC rc = build_table6(&lpm, routes);
+    printf("================== LPM6 LOOKUP ===================\n");
+    char separator[] = "+---------+--------------+-----------+-----------+";
+    printf("%s\n", separator);
+    printf("| %7s | %12s | %9s | %9s |\n", "DEST", "PATH", "NS/LOOKUP", "MLOOKUP/S");
+    printf("%s\n", separator);
+    for (int dist = 0; dist < 2 && rc == 0; dist++) {
+        rc = pick_routes(opts.routes6, dist == 1, picks);
+        if (rc) { break; }
+        for (int i = 0; i < opts.lookups; i++) {
+            addrs[i] = address_in6(&routes[picks[i]]);
+        }
+        rc = verify6(&lpm, routes, addrs, results);
+        if (rc) { break; }
+        for (int burst = 0; burst < 2; burst++) {
+            double ns = measure6(&lpm, burst, addrs, results);
+            printf("| %7s | %12s | %9.2f | %9.1f |\n", dist == 0 ? "uniform" : "zipf", burst ? "burst" : "single", ns,
+                   1000 / ns);
+        }
+    }
+    printf("%s\n", separator);
+    lpm6_destroy(&lpm);
+    free(routes);
+    free(addrs);
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    if (parse_opts(argc, argv)) {
+        usage();
+        return 1;
+    }
+    bench_route_t *routes = malloc(opts.routes * sizeof(bench_route_t));
+    in_addr_t *addrs = malloc(opts.lookups * sizeof(in_addr_t));
+    uint32_t *results = malloc(opts.lookups * sizeof(uint32_t));
+    int *picks = malloc(opts.lookups * sizeof(int));
+    if (routes == NULL || addrs == NULL || results == NULL || picks == NULL) {
+        fprintf(stderr, "Cannot allocate benchmark arrays\n");
+        return 1;
+    }
+    fib_t fib;
+    RC rc = build_table(&fib, routes);
+    if (rc) { return rc; }
+    bool has_avx2 = false;
+#if defined(__x86_64__)
+    has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    printf("=================== FIB LOOKUP ===================\n");
+    char separator[] = "+---------+--------------+-----------+-----------+";
+    printf("%s\n", separator);
+    printf("| %7s | %12s | %9s | %9s |\n", "DEST", "PATH", "NS/LOOKUP", "MLOOKUP/S");
+    printf("%s\n", separator);
+    for (int dist = 0; dist < 2; dist++) {
+        const char *dist_name = dist == 0 ? "uniform" : "zipf";
+        rc = pick_routes(opts.routes, dist == 1, picks);
+        if (rc) { return rc; }
+        for (int i = 0; i < opts.lookups; i++) {
+            addrs[i] = address_in(&routes[picks[i]]);
+        }
+        rc = verify(&fib, routes, addrs, results);
+        if (rc) { return rc; }
+        for (path_t path = 0; path < NUM_PATHS; path++) {
+            if (path == PATH_BURST_AVX2 && !has_avx2) {
+                continue;
+            }
+            double ns = measure(&fib, path, addrs, results);
+            printf("| %7s | %12s | %9.2f | %9.1f |\n", dist_name, path_names[path], ns, 1000 / ns);
+        }
+    }
+    printf("%s\n", separator);
+    fib_destroy(&fib);
+    if (opts.routes6 > 0) {
+        rc = bench_lpm6(picks, results);
+        if (rc) { return rc; }
+    }
+    free(routes);
+    free(addrs);
+    free(results);
+    free(picks);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "graph.h"
+#include <stdio.h>
+
+graph_node_t *graph_nodes;
+static int num_graph_nodes;
+
+RC graph_init(graph_node_t *nodes, int num_nodes) {
+    for (int i = 0; i < num_nodes; i++) {
+        if (nodes[i].name == NULL || nodes[i].fn == NULL) {
+            fprintf(stderr, "Graph node %d is not registered\n", i);
+            return CONFIG_INIT_FAIL;
+        }
+        nodes[i].num_pending = 0;
+    }
+    graph_nodes = nodes;
+    num_graph_nodes = num_nodes;
+    return 0;
+}
+
+void graph_dispatch() {
+    bool pending;
+    do {
+        pending = false;
+        for (int i = 0; i < num_graph_nodes; i++) {
+            graph_node_t *node = &graph_nodes[i];
+            int num_pkts = node->num_pending;
+            if (num_pkts == 0) {
+                continue;
+            }
+            // Nodes never enqueue to themselves, so the vector is stable while the node runs
+            node->num_pending = 0;
+            uint64_t start = read_ticks();
+            node->fn(node->pending, num_pkts);
+            node->clocks += read_ticks() - start;
+            node->calls++;
+            node->packets += num_pkts;
+            TRACE_STAMP(node->trace_stage);
+            pending = true;
+        }
+    } while (pending);
+    TRACE_END();
+}
+
+void print_graph_stats() {
+    printf("=========================== GRAPH NODES ===========================\n");
+    char separator[] = "+-----------------+------------+------------+--------+------------+";
+    printf("%s\n", separator);
+    printf("| %15s | %10s | %10s | %6s | %10s |\n", "NODE", "CALLS", "PACKETS", "VEC", "CLOCKS/PKT");
+    printf("%s\n", separator);
+    for (int i = 0; i < num_graph_nodes; i++) {
+        graph_node_t *node = &graph_nodes[i];
+        double vector_size = node->calls ? (double) node->packets / (double) node->calls : 0;
+        double clocks = node->packets ? (double) node->clocks / (double) node->packets : 0;
+        printf("| %15s | %10" PRIu64 " | %10" PRIu64 " | %6.1f | %10.1f |\n",
+               node->name, node->calls, node->packets, vector_size, clocks);
+    }
+    printf("%s\n", separator);
+}
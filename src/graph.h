@@ -0,0 +1,47 @@
+#pragma once
+
+#include "error.h"
+#include "pktbuf.h"
+#include "trace.h"
+#include <inttypes.h>
+
+// ===== PACKET GRAPH =====
+// Packets are processed in vectors, in the style of VPP: a node handles every packet pending for it in one call and
+// hands each packet on to one next node (or frees it), so the code of a node stays hot in the instruction cache for
+// the whole vector. Nodes are dispatched in table order, each node must come after all nodes that feed it and must
+// not enqueue to itself.
+#define GRAPH_VECTOR_SIZE 256
+
+typedef void (*node_fn_t)(pkt_buf_t **pkts, int num_pkts);
+
+typedef struct graph_node {
+    const char *name;
+    node_fn_t fn;
+    trace_stage_t trace_stage;      // Stage this node's time is charged to when tracing
+    int num_pending;
+    pkt_buf_t *pending[GRAPH_VECTOR_SIZE];
+    uint64_t calls;
+    uint64_t packets;
+    uint64_t clocks;                // CPU ticks spent in the node
+} graph_node_t;
+
+extern graph_node_t *graph_nodes;
+
+// Use nodes table as the graph, node indices are used as node ids
+RC graph_init(graph_node_t *nodes, int num_nodes);
+
+// Hand packet to node, it is processed in the current dispatch
+static inline void graph_enqueue(int node_id, pkt_buf_t *pkt) {
+    graph_node_t *node = &graph_nodes[node_id];
+    if (__builtin_expect(node->num_pending == GRAPH_VECTOR_SIZE, 0)) {
+        // Cannot happen when input vectors fit GRAPH_VECTOR_SIZE, since a packet is enqueued to one node at a time
+        pkt_free(pkt);
+        return;
+    }
+    node->pending[node->num_pending++] = pkt;
+}
+
+// Run all nodes until every pending packet is sent or freed
+void graph_dispatch();
+
+void print_graph_stats();
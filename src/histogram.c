@@ -0,0 +1,70 @@
+#include "histogram.h"
+#include <stdio.h>
+#include <string.h>
+
+void hist_reset(hist_t *hist) {
+    memset(hist, 0, sizeof(hist_t));
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+    if (src->count == 0) {
+        return;
+    }
+    if (dst->count == 0 || src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+// Highest value which falls into bucket
+static uint64_t hist_bucket_max(int index) {
+    if (index < HIST_SUB_COUNT) {
+        return index;
+    }
+    int shift = (index - HIST_SUB_COUNT) / (HIST_SUB_COUNT / 2) + 1;
+    uint64_t sub = (index - HIST_SUB_COUNT) % (HIST_SUB_COUNT / 2) + HIST_SUB_COUNT / 2;
+    return ((sub + 1) << shift) - 1;
+}
+
+uint64_t hist_percentile(const hist_t *hist, double percentile) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) (percentile / 100 * hist->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t acc = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        acc += hist->buckets[i];
+        if (acc >= rank) {
+            uint64_t value = hist_bucket_max(i);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+void print_hist_table(const char *title, const char *names[], const hist_t *hists, int num_hists) {
+    printf("========================================= %s =========================================\n", title);
+    char separator[] = "+----------+------------+----------+----------+----------+----------+----------+----------+";
+    printf("%s\n", separator);
+    printf("| %8s | %10s | %8s | %8s | %8s | %8s | %8s | %8s |\n",
+           "STAGE", "COUNT", "MIN(us)", "AVG(us)", "P50(us)", "P99(us)", "P999(us)", "MAX(us)");
+    printf("%s\n", separator);
+    for (int i = 0; i < num_hists; i++) {
+        const hist_t *hist = &hists[i];
+        printf("| %8s | %10" PRIu64 " | %8.1f | %8.1f | %8.1f | %8.1f | %8.1f | %8.1f |\n", names[i], hist->count,
+               hist->min / 1e3, hist->count ? (double) hist->sum / hist->count / 1e3 : 0,
+               hist_percentile(hist, 50) / 1e3, hist_percentile(hist, 99) / 1e3,
+               hist_percentile(hist, 99.9) / 1e3, hist->max / 1e3);
+    }
+    printf("%s\n", separator);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// ===== HISTOGRAM =====
+// Log-linear histogram in the style of HdrHistogram: each power of 2 is split into HIST_SUB_COUNT / 2 linear
+// sub-buckets, so recorded values keep 3% relative precision over the full uint64_t range at fixed size.
+#define HIST_SUB_BITS 6
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_SUB_COUNT + (64 - HIST_SUB_BITS) * (HIST_SUB_COUNT / 2))
+
+typedef struct hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+static inline int hist_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT) {
+        return (int) value;
+    }
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS + 1;
+    int sub = (int) (value >> shift) - HIST_SUB_COUNT / 2;
+    return HIST_SUB_COUNT + (shift - 1) * (HIST_SUB_COUNT / 2) + sub;
+}
+
+static inline void hist_record(hist_t *hist, uint64_t value) {
+    hist->buckets[hist_index(value)]++;
+    hist->count++;
+    hist->sum += value;
+    if (value < hist->min || hist->count == 1) {
+        hist->min = value;
+    }
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+void hist_reset(hist_t *hist);
+
+// Add all values of src into dst
+void hist_merge(hist_t *dst, const hist_t *src);
+
+// Value at percentile (0 - 100), as the highest value equivalent to the bucket it falls into
+uint64_t hist_percentile(const hist_t *hist, double percentile);
+
+// Print histograms as a table in microseconds, values are recorded in nanoseconds
+void print_hist_table(const char *title, const char *names[], const hist_t *hists, int num_hists);
@@ -0,0 +1,644 @@
+#include "ipv6.h"
+#include "ether_layer.h"
+#include "config.h"
+#include "checksum.h"
+#include "lpm6.h"
+#include "ctl.h"
+#include "arena.h"
+#include "rib.h"
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <stdio.h>
+#include <string.h>
+
+#define IP6_DEF_HLIM 64
+#define ND_HLIM 255
+#define IP6_MIN_MTU 1280
+
+// ===== NEIGHBOR CACHE =====
+typedef struct neighbor_entry {
+    struct in6_addr ip6;
+    int if_idx;
+    struct ether_addr mac;
+} neighbor_entry_t;
+
+// Sized from config at startup, allocated from its own arena
+static struct {
+    neighbor_entry_t *entries;
+    int size;
+    int capacity;
+    int32_t *slots;     // Hash of (IPv6, interface) to entry index, -1 if empty
+    uint32_t slot_mask;
+    arena_t arena;
+} neighbor_table;
+
+static RC neighbor_table_init() {
+    neighbor_table.capacity = memory_config.neighbor_table_size;
+    // At least twice as many slots as entries, power of 2
+    uint32_t num_slots = 1;
+    while (num_slots < 2 * (uint32_t) neighbor_table.capacity) {
+        num_slots <<= 1;
+    }
+    neighbor_table.slot_mask = num_slots - 1;
+    RC rc = arena_init(&neighbor_table.arena,
+                       neighbor_table.capacity * sizeof(neighbor_entry_t) + num_slots * sizeof(int32_t) + 128,
+                       memory_config.hugepages);
+    if (rc) { return rc; }
+    neighbor_table.entries = arena_alloc(&neighbor_table.arena, neighbor_table.capacity * sizeof(neighbor_entry_t));
+    neighbor_table.slots = arena_alloc(&neighbor_table.arena, num_slots * sizeof(int32_t));
+    memset(neighbor_table.slots, -1, num_slots * sizeof(int32_t));
+    neighbor_table.size = 0;
+    return 0;
+}
+
+static inline uint32_t hash_neighbor(const struct in6_addr *ip6, int if_idx) {
+    uint64_t hi, lo;
+    memcpy(&hi, ip6->s6_addr, sizeof(hi));
+    memcpy(&lo, ip6->s6_addr + 8, sizeof(lo));
+    uint64_t key = (hi * 0x9e3779b97f4a7c15ULL) ^ lo ^ (uint64_t) if_idx;
+    key *= 0x9e3779b97f4a7c15ULL;
+    return (uint32_t) (key >> 32);
+}
+
+static int32_t *nd_find_slot(const struct in6_addr *ip6, int if_idx) {
+    uint32_t pos = hash_neighbor(ip6, if_idx) & neighbor_table.slot_mask;
+    while (neighbor_table.slots[pos] >= 0) {
+        neighbor_entry_t *entry = &neighbor_table.entries[neighbor_table.slots[pos]];
+        if (IN6_ARE_ADDR_EQUAL(&entry->ip6, ip6) && entry->if_idx == if_idx) {
+            break;
+        }
+        pos = (pos + 1) & neighbor_table.slot_mask;
+    }
+    return &neighbor_table.slots[pos];
+}
+
+// Entries are removed by compaction, after which the slots are refilled
+static void nd_rebuild_slots() {
+    memset(neighbor_table.slots, -1, (neighbor_table.slot_mask + 1) * sizeof(int32_t));
+    for (int i = 0; i < neighbor_table.size; i++) {
+        *nd_find_slot(&neighbor_table.entries[i].ip6, neighbor_table.entries[i].if_idx) = i;
+    }
+}
+
+static RC nd_insert_entry(const struct in6_addr *ip6, int if_idx, const struct ether_addr *mac) {
+    int32_t *slot = nd_find_slot(ip6, if_idx);
+    if (*slot < 0) {
+        // Entry not found, need to insert new entry
+        if (neighbor_table.size >= neighbor_table.capacity) {
+            fprintf(stderr, "Neighbor table overflow\n");
+            return OVERFLOW_ERROR;
+        }
+        *slot = neighbor_table.size++;
+        printf("Learned neighbor: %s at %s from %s\n", ip62str(ip6), mac2str((uint8_t *) mac), config->if_names[if_idx]);
+    }
+    neighbor_entry_t *entry = &neighbor_table.entries[*slot];
+    entry->ip6 = *ip6;
+    entry->if_idx = if_idx;
+    memcpy(&entry->mac, mac, sizeof(struct ether_addr));
+    return 0;
+}
+
+void print_neighbor_table() {
+    printf("=========================== NEIGHBOR TABLE ===========================\n");
+    char separator[] = "+-----------------------------------------+-------------------+-------+";
+    printf("%s\n", separator);
+    printf("| %39s | %17s | %5s |\n", "IPv6", "MAC", "IF");
+    printf("%s\n", separator);
+    for (int i = 0; i < neighbor_table.size; i++) {
+        neighbor_entry_t *entry = &neighbor_table.entries[i];
+        printf("| %39s | %17s | %5s |\n",
+               ip62str(&entry->ip6), mac2str((uint8_t *) &entry->mac), config->if_names[entry->if_idx]);
+    }
+    printf("%s\n", separator);
+}
+
+static int neighbor_snapshot(void *buf, int offset, int max, int *total) {
+    return ctl_copy_range(buf, neighbor_table.entries, neighbor_table.size, sizeof(neighbor_entry_t), offset, max,
+                          total);
+}
+
+static void neighbor_format(const ctl_snapshot_t *snap, const void *entry, char *line, size_t size) {
+    const neighbor_entry_t *neighbor = entry;
+    snprintf(line, size, "%-39s %-17s %s", ip62str(&neighbor->ip6), mac2str((uint8_t *) &neighbor->mac),
+             snap->if_names[neighbor->if_idx]);
+}
+
+// First entry of an IPv6 address on any interface
+static int neighbor_lookup(const char *key, void *buf) {
+    struct in6_addr ip6;
+    if (inet_pton(AF_INET6, key, &ip6) != 1) {
+        return CTL_LOOKUP_INVALID;
+    }
+    for (int i = 0; i < neighbor_table.size; i++) {
+        if (IN6_ARE_ADDR_EQUAL(&neighbor_table.entries[i].ip6, &ip6)) {
+            memcpy(buf, &neighbor_table.entries[i], sizeof(neighbor_entry_t));
+            return 0;
+        }
+    }
+    return CTL_LOOKUP_NONE;
+}
+
+static ctl_table_t neighbor_ctl_table = {
+        .name = "neighbor",
+        .header = "IPv6                                    MAC               IF",
+        .entry_size = sizeof(neighbor_entry_t),
+        .snapshot = neighbor_snapshot,
+        .format = neighbor_format,
+        .lookup = neighbor_lookup,
+};
+
+// ===== ROUTE TABLE =====
+#define ROUTE6_TABLE_MIN_CAPACITY 256
+
+// Grows in place within its arena, up to the configured IPv6 route table size
+static struct {
+    route6_entry_t *entries;
+    int size;
+    int capacity;
+    int *free;          // Entries removed by config reload, reused by the next inserts
+    int num_free;
+    arena_t arena;
+} route6_table;
+
+// Longest prefix match index into route6_table, rebuilt by ip6_commit_routes
+static lpm6_t route6_lpm;
+
+RC insert_route6(const struct in6_addr *prefix, int prefix_len, const struct in6_addr *next_hop, int if_idx,
+                 route_source_t source) {
+    // A prefix has one entry, which is updated in place. The LPM index refers to entries by position.
+    int pos = (int) lpm6_find(&route6_lpm, prefix, prefix_len);
+    if (pos != (int) LPM6_NO_ROUTE && route6_table.entries[pos].source < source) {
+        // Connected prefix wins over a static route of the same prefix
+        return 0;
+    }
+    if (pos == (int) LPM6_NO_ROUTE) {
+        if (route6_table.num_free > 0) {
+            pos = route6_table.free[route6_table.num_free - 1];
+        } else if (route6_table.size < route6_table.capacity ||
+                   !arena_grow(&route6_table.arena, route6_table.entries, sizeof(route6_entry_t),
+                               &route6_table.capacity, ROUTE6_TABLE_MIN_CAPACITY)) {
+            pos = route6_table.size;
+        } else {
+            fprintf(stderr, "IPv6 route table overflow\n");
+            return OVERFLOW_ERROR;
+        }
+        RC rc = lpm6_add(&route6_lpm, prefix, prefix_len, pos);
+        if (rc) { return rc; }
+        if (pos == route6_table.size) {
+            route6_table.size++;
+        } else {
+            route6_table.num_free--;
+        }
+    }
+    route6_table.entries[pos] = (route6_entry_t) {
+            .prefix = *prefix,
+            .prefix_len = prefix_len,
+            .next_hop = *next_hop,
+            .if_idx = if_idx,
+            .source = source,
+    };
+    return 0;
+}
+
+static void del_route6(int pos) {
+    route6_entry_t *route = &route6_table.entries[pos];
+    lpm6_del(&route6_lpm, &route->prefix, route->prefix_len);
+    route->if_idx = -1;
+    route6_table.free[route6_table.num_free++] = pos;
+}
+
+void ip6_del_routes_from(route_source_t source) {
+    for (int i = 0; i < route6_table.size; i++) {
+        if (route6_table.entries[i].if_idx >= 0 && route6_table.entries[i].source == source) {
+            del_route6(i);
+        }
+    }
+}
+
+RC ip6_insert_static_routes() {
+    for (int i = 0; i < config->num_static_routes6; i++) {
+        const static_route6_t *route = &config->static_routes6[i];
+        RC rc = insert_route6(&route->dst, route->prefix_len, &route->next_hop, route->if_idx, ROUTE_STATIC);
+        if (rc) { return rc; }
+    }
+    return 0;
+}
+
+void ip6_commit_routes() {
+    lpm6_build(&route6_lpm);
+}
+
+#define ROUTE6_BURST 64
+
+void route6_lookup_burst(const struct in6_addr *addrs, int n, const route6_entry_t **routes) {
+    uint32_t route_idxs[ROUTE6_BURST];
+    for (int start = 0; start < n; start += ROUTE6_BURST) {
+        int num = n - start < ROUTE6_BURST ? n - start : ROUTE6_BURST;
+        lpm6_lookup_burst(&route6_lpm, &addrs[start], num, route_idxs);
+        for (int i = 0; i < num; i++) {
+            routes[start + i] = route_idxs[i] == LPM6_NO_ROUTE ? NULL : &route6_table.entries[route_idxs[i]];
+        }
+    }
+}
+
+void print_route6_table() {
+    printf("================================================ ROUTE6 TABLE ================================================\n");
+    char separator[] = "+---------------------------------------------+-----------------------------------------+-------+--------+";
+    printf("%s\n", separator);
+    printf("| %43s | %39s | %5s | %6s |\n", "PREFIX / LEN", "NEXT_HOP", "IF", "SOURCE");
+    printf("%s\n", separator);
+    for (int i = 0; i < route6_table.size; i++) {
+        route6_entry_t *route = &route6_table.entries[i];
+        if (route->if_idx < 0) {
+            continue;
+        }
+        char prefix[INET6_ADDRSTRLEN];
+        strcpy(prefix, ip62str(&route->prefix));
+        printf("| %39s/%3d | %39s | %5s | %6s |\n", prefix, route->prefix_len, ip62str(&route->next_hop),
+               config->if_names[route->if_idx], route_source_names[route->source]);
+    }
+    printf("%s\n", separator);
+}
+
+static int route6_snapshot(void *buf, int offset, int max, int *total) {
+    route6_entry_t *entries = buf;
+    int num_entries = 0, in_use = 0;
+    for (int i = 0; i < route6_table.size; i++) {
+        if (route6_table.entries[i].if_idx >= 0 && in_use++ >= offset && num_entries < max) {
+            entries[num_entries++] = route6_table.entries[i];
+        }
+    }
+    *total = in_use;
+    return num_entries;
+}
+
+static void route6_format(const ctl_snapshot_t *snap, const void *entry, char *line, size_t size) {
+    const route6_entry_t *route = entry;
+    char prefix[INET6_ADDRSTRLEN + 4];
+    snprintf(prefix, sizeof(prefix), "%s/%d", ip62str(&route->prefix), route->prefix_len);
+    snprintf(line, size, "%-43s %-39s %-9s %s", prefix, ip62str(&route->next_hop), snap->if_names[route->if_idx],
+             route_source_names[route->source]);
+}
+
+// Route an address resolves to in the LPM index, as forwarding sees it
+static int route6_lookup(const char *key, void *buf) {
+    struct in6_addr ip6;
+    if (inet_pton(AF_INET6, key, &ip6) != 1) {
+        return CTL_LOOKUP_INVALID;
+    }
+    uint32_t pos = lpm6_lookup(&route6_lpm, &ip6);
+    if (pos == LPM6_NO_ROUTE) {
+        return CTL_LOOKUP_NONE;
+    }
+    memcpy(buf, &route6_table.entries[pos], sizeof(route6_entry_t));
+    return 0;
+}
+
+static ctl_table_t route6_ctl_table = {
+        .name = "route6",
+        .header = "PREFIX / LEN                                NEXT_HOP                                IF        SOURCE",
+        .entry_size = sizeof(route6_entry_t),
+        .snapshot = route6_snapshot,
+        .format = route6_format,
+        .lookup = route6_lookup,
+};
+
+// ===== ADDRESS =====
+static inline bool is_my_ip6(const struct in6_addr *ip6) {
+    for (int i = 0; i < config->num_if; i++) {
+        if (if_active(i) && (IN6_ARE_ADDR_EQUAL(&config->if_ip6s[i], ip6) ||
+                             IN6_ARE_ADDR_EQUAL(&config->if_ll6s[i], ip6))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Source address of router generated packets on interface if_idx
+static inline const struct in6_addr *if_src_ip6(int if_idx, const struct in6_addr *dst_ip6) {
+    if (IN6_IS_ADDR_LINKLOCAL(dst_ip6) || IN6_IS_ADDR_MULTICAST(dst_ip6) || IN6_IS_ADDR_UNSPECIFIED(&config->if_ip6s[if_idx])) {
+        return &config->if_ll6s[if_idx];
+    }
+    return &config->if_ip6s[if_idx];
+}
+
+static inline void multicast_mac6(const struct in6_addr *ip6, struct ether_addr *mac) {
+    // Multicast MAC address of multicast IPv6 is: 33:33:00:00:00:00 | (IPv6 & 0xffffffff)
+    mac->ether_addr_octet[0] = 0x33;
+    mac->ether_addr_octet[1] = 0x33;
+    memcpy(&mac->ether_addr_octet[2], &ip6->s6_addr[12], 4);
+}
+
+// ===== ICMPv6 =====
+static inline void set_icmp6_checksum(struct ip6_hdr *ip6_hdr) {
+    struct icmp6_hdr *icmp6_hdr = (struct icmp6_hdr *) (ip6_hdr + 1);
+    size_t icmp6_len = ntohs(ip6_hdr->ip6_plen);
+    // Pseudo header: source, destination, upper layer length and next header
+    uint32_t sum = 0;
+    sum = cksum_add(sum, &ip6_hdr->ip6_src, sizeof(struct in6_addr));
+    sum = cksum_add(sum, &ip6_hdr->ip6_dst, sizeof(struct in6_addr));
+    uint32_t pseudo[2] = {htonl(icmp6_len), htonl(IPPROTO_ICMPV6)};
+    sum = cksum_add(sum, pseudo, sizeof(pseudo));
+    icmp6_hdr->icmp6_cksum = 0;
+    icmp6_hdr->icmp6_cksum = cksum_fold(cksum_add(sum, icmp6_hdr, icmp6_len));
+}
+
+static inline bool check_icmp6_checksum(struct ip6_hdr *ip6_hdr) {
+    struct icmp6_hdr *icmp6_hdr = (struct icmp6_hdr *) (ip6_hdr + 1);
+    uint16_t org_cksum = icmp6_hdr->icmp6_cksum;
+    set_icmp6_checksum(ip6_hdr);
+    bool ok = org_cksum == icmp6_hdr->icmp6_cksum;
+    icmp6_hdr->icmp6_cksum = org_cksum;
+    return ok;
+}
+
+static inline void init_ip6_hdr(struct ip6_hdr *ip6_hdr, size_t payload_len, uint8_t hop_limit,
+                                const struct in6_addr *src, const struct in6_addr *dst) {
+    *ip6_hdr = (struct ip6_hdr) {
+            .ip6_flow = htonl(6 << 28),
+            .ip6_plen = htons(payload_len),
+            .ip6_nxt = IPPROTO_ICMPV6,
+            .ip6_hlim = hop_limit,
+            .ip6_src = *src,
+            .ip6_dst = *dst,
+    };
+}
+
+// Build an ICMPv6 error about ip6_packet into packet, which holds IP6_MIN_MTU bytes. mtu is reported by Packet Too
+// Big. Return its length, 0 if the packet must not be answered.
+static size_t build_icmp6_error(uint8_t *packet, const uint8_t *ip6_packet, size_t ip6_len, int if_idx, uint8_t type,
+                                uint8_t code, uint32_t mtu) {
+    const struct ip6_hdr *org_hdr = (const struct ip6_hdr *) ip6_packet;
+    // RFC 4443 2.4: never answer multicast / unspecified sources, nor ICMPv6 error messages
+    if (IN6_IS_ADDR_MULTICAST(&org_hdr->ip6_src) || IN6_IS_ADDR_UNSPECIFIED(&org_hdr->ip6_src) ||
+        IN6_IS_ADDR_MULTICAST(&org_hdr->ip6_dst)) {
+        return 0;
+    }
+    if (org_hdr->ip6_nxt == IPPROTO_ICMPV6 && ip6_len >= sizeof(struct ip6_hdr) + sizeof(struct icmp6_hdr) &&
+        !(((const struct icmp6_hdr *) (org_hdr + 1))->icmp6_type & ICMP6_INFOMSG_MASK)) {
+        return 0;
+    }
+    struct ip6_hdr *ip6_hdr = (struct ip6_hdr *) packet;
+    struct icmp6_hdr *icmp6_hdr = (struct icmp6_hdr *) (ip6_hdr + 1);
+    // ICMPv6 payload is as much of invoking packet as possible without exceeding the minimum MTU
+    size_t body_len = ip6_len;
+    size_t max_body_len = IP6_MIN_MTU - sizeof(struct ip6_hdr) - sizeof(struct icmp6_hdr);
+    if (body_len > max_body_len) {
+        body_len = max_body_len;
+    }
+    memcpy(icmp6_hdr + 1, ip6_packet, body_len);
+    *icmp6_hdr = (struct icmp6_hdr) {
+            .icmp6_type = type,
+            .icmp6_code = code,
+    };
+    icmp6_hdr->icmp6_mtu = htonl(mtu);
+    size_t icmp6_len = sizeof(struct icmp6_hdr) + body_len;
+    struct in6_addr dst = org_hdr->ip6_src;
+    init_ip6_hdr(ip6_hdr, icmp6_len, IP6_DEF_HLIM, if_src_ip6(if_idx, &dst), &dst);
+    set_icmp6_checksum(ip6_hdr);
+    return sizeof(struct ip6_hdr) + icmp6_len;
+}
+
+void send_icmp6_error(const uint8_t *ip6_packet, size_t ip6_len, int if_idx, uint8_t type, uint8_t code,
+                      const struct ether_addr *dst_mac) {
+    uint8_t packet[IP6_MIN_MTU];
+    size_t len = build_icmp6_error(packet, ip6_packet, ip6_len, if_idx, type, code, 0);
+    if (len > 0) {
+        send_ip6_packet(packet, len, if_idx, dst_mac);
+    }
+}
+
+bool make_icmp6_error(pkt_buf_t *pkt, uint8_t type, uint8_t code, uint32_t mtu) {
+    uint8_t packet[IP6_MIN_MTU];
+    size_t len = build_icmp6_error(packet, pkt->data, pkt->len, pkt->if_idx, type, code, mtu);
+    if (len == 0) {
+        return false;
+    }
+    memcpy(pkt->data, packet, len);
+    pkt->len = len;
+    return true;
+}
+
+// ===== NDP =====
+typedef struct __attribute__((__packed__)) nd_opt_lladdr {
+    struct nd_opt_hdr hdr;
+    struct ether_addr mac;
+} nd_opt_lladdr_t;
+
+// Find link-layer address option of given type in NDP options
+static const struct ether_addr *nd_find_lladdr(const uint8_t *opts, size_t opts_len, uint8_t type) {
+    while (opts_len >= sizeof(struct nd_opt_hdr)) {
+        const struct nd_opt_hdr *opt = (const struct nd_opt_hdr *) opts;
+        size_t opt_len = opt->nd_opt_len * 8;
+        if (opt_len == 0 || opt_len > opts_len) {
+            return NULL;
+        }
+        if (opt->nd_opt_type == type && opt_len >= sizeof(nd_opt_lladdr_t)) {
+            return &((const nd_opt_lladdr_t *) opt)->mac;
+        }
+        opts += opt_len;
+        opts_len -= opt_len;
+    }
+    return NULL;
+}
+
+static void send_neighbor_solicit(int if_idx, const struct in6_addr *target) {
+    uint8_t packet[sizeof(struct ip6_hdr) + sizeof(struct nd_neighbor_solicit) + sizeof(nd_opt_lladdr_t)];
+    struct ip6_hdr *ip6_hdr = (struct ip6_hdr *) packet;
+    struct nd_neighbor_solicit *ns = (struct nd_neighbor_solicit *) (ip6_hdr + 1);
+    nd_opt_lladdr_t *opt = (nd_opt_lladdr_t *) (ns + 1);
+    *ns = (struct nd_neighbor_solicit) {
+            .nd_ns_type = ND_NEIGHBOR_SOLICIT,
+            .nd_ns_target = *target,
+    };
+    opt->hdr = (struct nd_opt_hdr) {.nd_opt_type = ND_OPT_SOURCE_LINKADDR, .nd_opt_len = 1};
+    memcpy(&opt->mac, &config->if_macs[if_idx], sizeof(struct ether_addr));
+    // Solicited-node multicast address: ff02::1:ff00:0 | (target & 0xffffff)
+    struct in6_addr dst = {{{0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xff}}};
+    memcpy(&dst.s6_addr[13], &target->s6_addr[13], 3);
+    init_ip6_hdr(ip6_hdr, sizeof(packet) - sizeof(struct ip6_hdr), ND_HLIM, if_src_ip6(if_idx, target), &dst);
+    set_icmp6_checksum(ip6_hdr);
+    struct ether_addr dst_mac;
+    multicast_mac6(&dst, &dst_mac);
+    send_ip6_packet(packet, sizeof(packet), if_idx, &dst_mac);
+}
+
+static void send_neighbor_advert(int if_idx, const struct in6_addr *target, const struct in6_addr *dst,
+                                 const struct ether_addr *dst_mac) {
+    uint8_t packet[sizeof(struct ip6_hdr) + sizeof(struct nd_neighbor_advert) + sizeof(nd_opt_lladdr_t)];
+    struct ip6_hdr *ip6_hdr = (struct ip6_hdr *) packet;
+    struct nd_neighbor_advert *na = (struct nd_neighbor_advert *) (ip6_hdr + 1);
+    nd_opt_lladdr_t *opt = (nd_opt_lladdr_t *) (na + 1);
+    *na = (struct nd_neighbor_advert) {
+            .nd_na_type = ND_NEIGHBOR_ADVERT,
+            .nd_na_flags_reserved = ND_NA_FLAG_ROUTER | ND_NA_FLAG_SOLICITED | ND_NA_FLAG_OVERRIDE,
+            .nd_na_target = *target,
+    };
+    opt->hdr = (struct nd_opt_hdr) {.nd_opt_type = ND_OPT_TARGET_LINKADDR, .nd_opt_len = 1};
+    memcpy(&opt->mac, &config->if_macs[if_idx], sizeof(struct ether_addr));
+    init_ip6_hdr(ip6_hdr, sizeof(packet) - sizeof(struct ip6_hdr), ND_HLIM, target, dst);
+    set_icmp6_checksum(ip6_hdr);
+    send_ip6_packet(packet, sizeof(packet), if_idx, dst_mac);
+}
+
+RC nd_get_mac(const struct in6_addr *ip6, int if_idx, struct ether_addr *out_mac) {
+    if (IN6_IS_ADDR_MULTICAST(ip6)) {
+        multicast_mac6(ip6, out_mac);
+        return 0;
+    }
+    int32_t pos = *nd_find_slot(ip6, if_idx);
+    if (pos < 0) {
+        printf("Sending neighbor solicitation to %s via %s\n", ip62str(ip6), config->if_names[if_idx]);
+        send_neighbor_solicit(if_idx, ip6);
+        return UNKNOWN_MAC_ADDR;
+    }
+    memcpy(out_mac, &neighbor_table.entries[pos].mac, sizeof(struct ether_addr));
+    return 0;
+}
+
+static void handle_icmp6_packet(pkt_buf_t *pkt, const struct ether_addr *src_mac) {
+    size_t ip6_len = pkt->len;
+    int if_idx = pkt->if_idx;
+    struct ip6_hdr *ip6_hdr = (struct ip6_hdr *) pkt->data;
+    size_t icmp6_len = ip6_len - sizeof(struct ip6_hdr);
+    if (icmp6_len < sizeof(struct icmp6_hdr) || !check_icmp6_checksum(ip6_hdr)) {
+        fprintf(stderr, "Broken ICMPv6 packet\n");
+        return;
+    }
+    struct icmp6_hdr *icmp6_hdr = (struct icmp6_hdr *) (ip6_hdr + 1);
+    switch (icmp6_hdr->icmp6_type) {
+        case ND_NEIGHBOR_SOLICIT: {
+            struct nd_neighbor_solicit *ns = (struct nd_neighbor_solicit *) icmp6_hdr;
+            // RFC 4861 7.1.1: hop limit must be 255 so that the message comes from the link
+            if (icmp6_len < sizeof(*ns) || ip6_hdr->ip6_hlim != ND_HLIM) { break; }
+            if (!IN6_ARE_ADDR_EQUAL(&ns->nd_ns_target, &config->if_ip6s[if_idx]) &&
+                !IN6_ARE_ADDR_EQUAL(&ns->nd_ns_target, &config->if_ll6s[if_idx])) {
+                break;
+            }
+            struct in6_addr dst = ip6_hdr->ip6_src;
+            struct ether_addr dst_mac = *src_mac;
+            if (IN6_IS_ADDR_UNSPECIFIED(&dst)) {
+                // Duplicate address detection, answer to all-nodes
+                dst = (struct in6_addr) {{{0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01}}};
+                multicast_mac6(&dst, &dst_mac);
+            } else {
+                const struct ether_addr *lladdr = nd_find_lladdr((uint8_t *) (ns + 1), icmp6_len - sizeof(*ns),
+                                                                 ND_OPT_SOURCE_LINKADDR);
+                if (lladdr) {
+                    nd_insert_entry(&ip6_hdr->ip6_src, if_idx, lladdr);
+                    dst_mac = *lladdr;
+                }
+            }
+            printf("Sending neighbor advertisement: %s is at %s\n",
+                   ip62str(&ns->nd_ns_target), mac2str((uint8_t *) &config->if_macs[if_idx]));
+            struct in6_addr target = ns->nd_ns_target;
+            send_neighbor_advert(if_idx, &target, &dst, &dst_mac);
+            break;
+        }
+        case ND_NEIGHBOR_ADVERT: {
+            struct nd_neighbor_advert *na = (struct nd_neighbor_advert *) icmp6_hdr;
+            if (icmp6_len < sizeof(*na) || ip6_hdr->ip6_hlim != ND_HLIM) { break; }
+            const struct ether_addr *lladdr = nd_find_lladdr((uint8_t *) (na + 1), icmp6_len - sizeof(*na),
+                                                             ND_OPT_TARGET_LINKADDR);
+            nd_insert_entry(&na->nd_na_target, if_idx, lladdr ? lladdr : src_mac);
+            break;
+        }
+        case ICMP6_ECHO_REQUEST: {
+            if (!is_my_ip6(&ip6_hdr->ip6_dst)) { break; }
+            printf("Sending ICMPv6 reply to %s via %s\n", ip62str(&ip6_hdr->ip6_src), config->if_names[if_idx]);
+            icmp6_hdr->icmp6_type = ICMP6_ECHO_REPLY;
+            struct in6_addr tmp = ip6_hdr->ip6_src;
+            ip6_hdr->ip6_src = ip6_hdr->ip6_dst;
+            ip6_hdr->ip6_dst = tmp;
+            ip6_hdr->ip6_hlim = IP6_DEF_HLIM;
+            set_icmp6_checksum(ip6_hdr);
+            ether_send(pkt, if_idx, src_mac, ETHERTYPE_IPV6);
+            break;
+        }
+        case ND_ROUTER_SOLICIT:
+        case ND_ROUTER_ADVERT:
+        case ND_REDIRECT:
+        case ICMP6_ECHO_REPLY:
+            break;
+        default:
+            fprintf(stderr, "Unsupported ICMPv6 type %02x\n", icmp6_hdr->icmp6_type);
+    }
+}
+
+// ===== IPv6 =====
+bool ip6_validate(pkt_buf_t *pkt) {
+    if (pkt->len < sizeof(struct ip6_hdr)) { return false; }
+    const struct ip6_hdr *ip6_hdr = (const struct ip6_hdr *) pkt->data;
+    if ((ntohl(ip6_hdr->ip6_flow) >> 28) != 6) { return false; }
+    size_t payload_len = ntohs(ip6_hdr->ip6_plen);
+    if (sizeof(struct ip6_hdr) + payload_len > pkt->len) { return false; }
+    // Strip ethernet padding
+    pkt->len = sizeof(struct ip6_hdr) + payload_len;
+    return true;
+}
+
+bool ip6_is_local(const struct in6_addr *dst_ip6) {
+    return IN6_IS_ADDR_MULTICAST(dst_ip6) || is_my_ip6(dst_ip6);
+}
+
+void ip6_local_input(pkt_buf_t *pkt) {
+    const struct ip6_hdr *ip6_hdr = (const struct ip6_hdr *) pkt->data;
+    if (ip6_hdr->ip6_nxt == IPPROTO_ICMPV6) {
+        handle_icmp6_packet(pkt, (const struct ether_addr *) rx_eth_header(pkt)->ether_shost);
+    } else if (!IN6_IS_ADDR_MULTICAST(&ip6_hdr->ip6_dst)) {
+        fprintf(stderr, "Unsupported IPv6 next header %02x\n", ip6_hdr->ip6_nxt);
+    }
+}
+
+RC ip6_if_up(int if_idx) {
+    // Insert interface prefix into route table
+    if (IN6_IS_ADDR_UNSPECIFIED(&config->if_ip6s[if_idx])) {
+        return 0;
+    }
+    struct in6_addr direct = IN6ADDR_ANY_INIT;
+    return insert_route6(&config->if_ip6s[if_idx], config->if_prefix6_lens[if_idx], &direct, if_idx, ROUTE_CONNECTED);
+}
+
+void ip6_if_down(int if_idx) {
+    int size = 0;
+    for (int i = 0; i < neighbor_table.size; i++) {
+        if (neighbor_table.entries[i].if_idx != if_idx) {
+            neighbor_table.entries[size++] = neighbor_table.entries[i];
+        }
+    }
+    neighbor_table.size = size;
+    nd_rebuild_slots();
+    for (int i = 0; i < route6_table.size; i++) {
+        if (route6_table.entries[i].if_idx == if_idx) {
+            del_route6(i);
+        }
+    }
+}
+
+RC ip6_init() {
+    RC rc = neighbor_table_init();
+    if (rc) { return rc; }
+    // Free list first, at full size, as the entries grow at the end of the arena
+    int route6_table_size = memory_config.route6_table_size;
+    rc = arena_init(&route6_table.arena, (size_t) route6_table_size * (sizeof(int) + sizeof(route6_entry_t)) + 128,
+                    memory_config.hugepages);
+    if (rc) { return rc; }
+    route6_table.free = arena_alloc(&route6_table.arena, (size_t) route6_table_size * sizeof(int));
+    route6_table.entries = arena_alloc(&route6_table.arena, 0);
+    rc = lpm6_init(&route6_lpm, 1024);
+    if (rc) { return rc; }
+    neighbor_ctl_table.max_entries = neighbor_table.capacity;
+    rc = ctl_register(&neighbor_ctl_table);
+    if (rc) { return rc; }
+    route6_ctl_table.max_entries = route6_table_size;
+    rc = ctl_register(&route6_ctl_table);
+    if (rc) { return rc; }
+    for (int i = 0; i < config->num_if; i++) {
+        if (!if_active(i)) { continue; }
+        rc = ip6_if_up(i);
+        if (rc) { return rc; }
+    }
+    rc = ip6_insert_static_routes();
+    if (rc) { return rc; }
+    return lpm6_build(&route6_lpm);
+}
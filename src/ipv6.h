@@ -0,0 +1,66 @@
+#pragma once
+
+#include "error.h"
+#include "pktbuf.h"
+#include "rib.h"
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+RC ip6_init();
+
+// Add connected route of interface, or flush its neighbors and routes, on config reload
+RC ip6_if_up(int if_idx);
+
+void ip6_if_down(int if_idx);
+
+typedef struct route6_entry {
+    struct in6_addr prefix;     // Destination prefix
+    int prefix_len;             // Prefix length
+    struct in6_addr next_hop;   // Next hop IPv6 address (unspecified if direct)
+    int if_idx;                 // Forward port, -1 if removed
+    route_source_t source;
+} route6_entry_t;
+
+// Check version and length of the IPv6 packet at pkt->data, ethernet header pulled, and strip ethernet padding
+bool ip6_validate(pkt_buf_t *pkt);
+
+// Whether a packet to dst_ip6 is for the router: multicast or an address of an interface
+bool ip6_is_local(const struct in6_addr *dst_ip6);
+
+// Handle an IPv6 packet to the router: NDP and ICMPv6 echo. Replies are sent from pkt in place, which the caller
+// still frees.
+void ip6_local_input(pkt_buf_t *pkt);
+
+// Route of each of n addresses, NULL if there is none. Routes are valid until the next ip6_commit_routes.
+void route6_lookup_burst(const struct in6_addr *addrs, int n, const route6_entry_t **routes);
+
+// Next hop MAC address on interface if_idx. If unknown, solicit it and return UNKNOWN_MAC_ADDR.
+RC nd_get_mac(const struct in6_addr *ip6, int if_idx, struct ether_addr *out_mac);
+
+// Send an ICMPv6 error about the IPv6 packet ip6_packet, received on if_idx from dst_mac, back to its source
+void send_icmp6_error(const uint8_t *ip6_packet, size_t ip6_len, int if_idx, uint8_t type, uint8_t code,
+                      const struct ether_addr *dst_mac);
+
+// Turn the IPv6 packet at pkt->data, received on pkt->if_idx, into an ICMPv6 error to its source, to be routed like a
+// forwarded packet. mtu is reported by Packet Too Big. Return false if the packet must not be answered.
+bool make_icmp6_error(pkt_buf_t *pkt, uint8_t type, uint8_t code, uint32_t mtu);
+
+// Add a route, or replace the route of the same prefix unless that one is connected. Lookups see it after
+// ip6_commit_routes.
+RC insert_route6(const struct in6_addr *prefix, int prefix_len, const struct in6_addr *next_hop, int if_idx,
+                 route_source_t source);
+
+// Delete all routes of source
+void ip6_del_routes_from(route_source_t source);
+
+// Add the IPv6 static routes of the running config
+RC ip6_insert_static_routes();
+
+// Apply route changes to the lookup structure, between vectors
+void ip6_commit_routes();
+
+void print_neighbor_table();
+
+void print_route6_table();
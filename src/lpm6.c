@@ -0,0 +1,347 @@
+#include "lpm6.h"
+#include <endian.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline void addr_to_u64(const struct in6_addr *addr, uint64_t *hi, uint64_t *lo) {
+    uint64_t words[2];
+    memcpy(words, addr, sizeof(words));
+    *hi = be64toh(words[0]);
+    *lo = be64toh(words[1]);
+}
+
+static inline void mask_prefix(uint64_t *hi, uint64_t *lo, int len) {
+    if (len == 0) {
+        *hi = 0;
+        *lo = 0;
+    } else if (len <= 64) {
+        *hi &= ~0ULL << (64 - len);
+        *lo = 0;
+    } else if (len < 128) {
+        *lo &= ~0ULL << (128 - len);
+    }
+}
+
+static inline uint32_t hash_prefix(uint64_t hi, uint64_t lo, int len) {
+    uint64_t h = (hi * 0x9e3779b97f4a7c15ULL) ^ (lo * 0xc2b2ae3d27d4eb4fULL) ^ ((uint64_t) len << 56);
+    return (uint32_t) (h ^ (h >> 29) ^ (h >> 47));
+}
+
+static lpm6_slot_t *find_slot(const lpm6_t *lpm, uint64_t hi, uint64_t lo, int len) {
+    uint32_t pos = hash_prefix(hi, lo, len) & lpm->slot_mask;
+    while (lpm->slots[pos].used) {
+        lpm6_slot_t *slot = &lpm->slots[pos];
+        if (slot->len == len && slot->hi == hi && slot->lo == lo) {
+            return slot;
+        }
+        pos = (pos + 1) & lpm->slot_mask;
+    }
+    return NULL;
+}
+
+static lpm6_slot_t *insert_slot(lpm6_slot_t *slots, uint32_t slot_mask, uint64_t hi, uint64_t lo, int len) {
+    uint32_t pos = hash_prefix(hi, lo, len) & slot_mask;
+    while (slots[pos].used) {
+        lpm6_slot_t *slot = &slots[pos];
+        if (slot->len == len && slot->hi == hi && slot->lo == lo) {
+            return slot;
+        }
+        pos = (pos + 1) & slot_mask;
+    }
+    lpm6_slot_t *slot = &slots[pos];
+    *slot = (lpm6_slot_t) {
+            .hi = hi,
+            .lo = lo,
+            .len = len,
+            .used = 1,
+            .nh = LPM6_NO_ROUTE,
+            .bmp = LPM6_NO_ROUTE,
+    };
+    return slot;
+}
+
+static RC rebuild_rule_index(lpm6_t *lpm) {
+    uint32_t capacity = 16;
+    while (capacity < (uint32_t) lpm->rule_capacity * 2) {
+        capacity <<= 1;
+    }
+    int32_t *index = malloc(capacity * sizeof(int32_t));
+    if (index == NULL) {
+        return OVERFLOW_ERROR;
+    }
+    free(lpm->rule_index);
+    lpm->rule_index = index;
+    lpm->rule_index_mask = capacity - 1;
+    memset(index, -1, capacity * sizeof(int32_t));
+    for (int i = 0; i < lpm->num_rules; i++) {
+        const lpm6_rule_t *rule = &lpm->rules[i];
+        uint32_t pos = hash_prefix(rule->hi, rule->lo, rule->len) & lpm->rule_index_mask;
+        while (index[pos] >= 0) {
+            pos = (pos + 1) & lpm->rule_index_mask;
+        }
+        index[pos] = i;
+    }
+    return 0;
+}
+
+// Return position in rule index of this prefix, or of the empty bucket where it should be inserted
+static uint32_t find_rule(const lpm6_t *lpm, uint64_t hi, uint64_t lo, int len) {
+    uint32_t pos = hash_prefix(hi, lo, len) & lpm->rule_index_mask;
+    while (lpm->rule_index[pos] >= 0) {
+        const lpm6_rule_t *rule = &lpm->rules[lpm->rule_index[pos]];
+        if (rule->len == len && rule->hi == hi && rule->lo == lo) {
+            break;
+        }
+        pos = (pos + 1) & lpm->rule_index_mask;
+    }
+    return pos;
+}
+
+RC lpm6_init(lpm6_t *lpm, int capacity) {
+    memset(lpm, 0, sizeof(lpm6_t));
+    lpm->dirty = true;
+    lpm->rule_capacity = capacity > 0 ? capacity : 16;
+    lpm->rules = malloc(lpm->rule_capacity * sizeof(lpm6_rule_t));
+    if (lpm->rules == NULL || rebuild_rule_index(lpm)) {
+        fprintf(stderr, "Cannot allocate IPv6 route table\n");
+        return OVERFLOW_ERROR;
+    }
+    return lpm6_build(lpm);
+}
+
+void lpm6_destroy(lpm6_t *lpm) {
+    free(lpm->rules);
+    free(lpm->rule_index);
+    free(lpm->slots);
+    memset(lpm, 0, sizeof(lpm6_t));
+}
+
+RC lpm6_add(lpm6_t *lpm, const struct in6_addr *prefix, int len, uint32_t nh) {
+    if (len < 0 || len > 128) {
+        return OUT_OF_RANGE_ERROR;
+    }
+    uint64_t hi, lo;
+    addr_to_u64(prefix, &hi, &lo);
+    mask_prefix(&hi, &lo, len);
+    uint32_t pos = find_rule(lpm, hi, lo, len);
+    if (lpm->rule_index[pos] < 0) {
+        // New prefix
+        if (lpm->num_rules == lpm->rule_capacity) {
+            lpm6_rule_t *rules = realloc(lpm->rules, 2 * lpm->rule_capacity * sizeof(lpm6_rule_t));
+            if (rules == NULL) {
+                fprintf(stderr, "IPv6 route table overflow\n");
+                return OVERFLOW_ERROR;
+            }
+            lpm->rules = rules;
+            lpm->rule_capacity *= 2;
+            if (rebuild_rule_index(lpm)) {
+                fprintf(stderr, "IPv6 route table overflow\n");
+                return OVERFLOW_ERROR;
+            }
+            pos = find_rule(lpm, hi, lo, len);
+        }
+        lpm->rule_index[pos] = lpm->num_rules++;
+    }
+    lpm->rules[lpm->rule_index[pos]] = (lpm6_rule_t) {.hi = hi, .lo = lo, .len = len, .nh = nh};
+    lpm->dirty = true;
+    return 0;
+}
+
+uint32_t lpm6_find(const lpm6_t *lpm, const struct in6_addr *prefix, int len) {
+    if (len < 0 || len > 128) {
+        return LPM6_NO_ROUTE;
+    }
+    uint64_t hi, lo;
+    addr_to_u64(prefix, &hi, &lo);
+    mask_prefix(&hi, &lo, len);
+    int idx = lpm->rule_index[find_rule(lpm, hi, lo, len)];
+    return idx < 0 ? LPM6_NO_ROUTE : lpm->rules[idx].nh;
+}
+
+RC lpm6_del(lpm6_t *lpm, const struct in6_addr *prefix, int len) {
+    if (len < 0 || len > 128) {
+        return OUT_OF_RANGE_ERROR;
+    }
+    uint64_t hi, lo;
+    addr_to_u64(prefix, &hi, &lo);
+    mask_prefix(&hi, &lo, len);
+    uint32_t pos = find_rule(lpm, hi, lo, len);
+    int idx = lpm->rule_index[pos];
+    if (idx < 0) {
+        return OUT_OF_RANGE_ERROR;
+    }
+    // Backward shift deletion keeps linear probing chains intact
+    uint32_t mask = lpm->rule_index_mask;
+    uint32_t hole = pos;
+    for (uint32_t next = (hole + 1) & mask; lpm->rule_index[next] >= 0; next = (next + 1) & mask) {
+        const lpm6_rule_t *rule = &lpm->rules[lpm->rule_index[next]];
+        uint32_t home = hash_prefix(rule->hi, rule->lo, rule->len) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            lpm->rule_index[hole] = lpm->rule_index[next];
+            hole = next;
+        }
+    }
+    lpm->rule_index[hole] = -1;
+    // Move last rule into the freed position
+    int last = --lpm->num_rules;
+    if (idx != last) {
+        lpm6_rule_t *moved = &lpm->rules[last];
+        lpm->rule_index[find_rule(lpm, moved->hi, moved->lo, moved->len)] = idx;
+        lpm->rules[idx] = *moved;
+    }
+    lpm->dirty = true;
+    return 0;
+}
+
+RC lpm6_build(lpm6_t *lpm) {
+    if (!lpm->dirty) {
+        return 0;
+    }
+    // Each rule plants at most log2(129) markers, keep load factor under 1/2
+    uint32_t capacity = 16;
+    while (capacity < (uint32_t) lpm->num_rules * 9 * 2) {
+        capacity <<= 1;
+    }
+    if (capacity != lpm->slot_mask + 1 || lpm->slots == NULL) {
+        // Lookups keep using the current table if the new one cannot be allocated, the build is retried later
+        lpm6_slot_t *slots = malloc(capacity * sizeof(lpm6_slot_t));
+        if (slots == NULL) {
+            fprintf(stderr, "Cannot allocate IPv6 lookup table\n");
+            return OVERFLOW_ERROR;
+        }
+        free(lpm->slots);
+        lpm->slots = slots;
+        lpm->slot_mask = capacity - 1;
+    }
+    // Collect distinct prefix lengths
+    bool has_len[129] = {false};
+    for (int i = 0; i < lpm->num_rules; i++) {
+        has_len[lpm->rules[i].len] = true;
+    }
+    lpm->num_lengths = 0;
+    for (int len = 0; len <= 128; len++) {
+        if (has_len[len]) {
+            lpm->lengths[lpm->num_lengths++] = len;
+        }
+    }
+    memset(lpm->slots, 0, capacity * sizeof(lpm6_slot_t));
+    // Insert rules and plant markers along their binary search path
+    for (int i = 0; i < lpm->num_rules; i++) {
+        const lpm6_rule_t *rule = &lpm->rules[i];
+        insert_slot(lpm->slots, lpm->slot_mask, rule->hi, rule->lo, rule->len)->nh = rule->nh;
+        int lo_idx = 0, hi_idx = lpm->num_lengths - 1;
+        while (lo_idx <= hi_idx) {
+            int mid = (lo_idx + hi_idx) / 2;
+            int mid_len = lpm->lengths[mid];
+            if (mid_len == rule->len) {
+                break;
+            } else if (mid_len < rule->len) {
+                uint64_t hi = rule->hi, lo = rule->lo;
+                mask_prefix(&hi, &lo, mid_len);
+                insert_slot(lpm->slots, lpm->slot_mask, hi, lo, mid_len);
+                lo_idx = mid + 1;
+            } else {
+                hi_idx = mid - 1;
+            }
+        }
+    }
+    // Precompute best matching prefix of every slot
+    for (uint32_t pos = 0; pos <= lpm->slot_mask; pos++) {
+        lpm6_slot_t *slot = &lpm->slots[pos];
+        if (!slot->used) {
+            continue;
+        }
+        if (slot->nh != LPM6_NO_ROUTE) {
+            slot->bmp = slot->nh;
+            continue;
+        }
+        for (int j = lpm->num_lengths - 1; j >= 0; j--) {
+            int len = lpm->lengths[j];
+            if (len >= slot->len) {
+                continue;
+            }
+            uint64_t hi = slot->hi, lo = slot->lo;
+            mask_prefix(&hi, &lo, len);
+            lpm6_slot_t *parent = find_slot(lpm, hi, lo, len);
+            if (parent && parent->nh != LPM6_NO_ROUTE) {
+                slot->bmp = parent->nh;
+                break;
+            }
+        }
+    }
+    lpm->dirty = false;
+    return 0;
+}
+
+uint32_t lpm6_lookup(const lpm6_t *lpm, const struct in6_addr *addr) {
+    uint64_t addr_hi, addr_lo;
+    addr_to_u64(addr, &addr_hi, &addr_lo);
+    uint32_t best = LPM6_NO_ROUTE;
+    int lo_idx = 0, hi_idx = lpm->num_lengths - 1;
+    while (lo_idx <= hi_idx) {
+        int mid = (lo_idx + hi_idx) / 2;
+        int len = lpm->lengths[mid];
+        uint64_t hi = addr_hi, lo = addr_lo;
+        mask_prefix(&hi, &lo, len);
+        lpm6_slot_t *slot = find_slot(lpm, hi, lo, len);
+        if (slot) {
+            best = slot->bmp;
+            lo_idx = mid + 1;
+        } else {
+            hi_idx = mid - 1;
+        }
+    }
+    return best;
+}
+
+#define LPM6_BURST 32
+
+void lpm6_lookup_burst(const lpm6_t *lpm, const struct in6_addr *addrs, int n, uint32_t *results) {
+    uint64_t addr_his[LPM6_BURST], addr_los[LPM6_BURST], his[LPM6_BURST], los[LPM6_BURST];
+    int lo_idxs[LPM6_BURST], hi_idxs[LPM6_BURST], lens[LPM6_BURST];
+    uint32_t positions[LPM6_BURST];
+    for (int start = 0; start < n; start += LPM6_BURST) {
+        int num = n - start < LPM6_BURST ? n - start : LPM6_BURST;
+        for (int i = 0; i < num; i++) {
+            addr_to_u64(&addrs[start + i], &addr_his[i], &addr_los[i]);
+            results[start + i] = LPM6_NO_ROUTE;
+            lo_idxs[i] = 0;
+            hi_idxs[i] = lpm->num_lengths - 1;
+        }
+        // All searches advance one step at a time, the slots of a step are prefetched before any is probed so that
+        // their cache misses overlap
+        bool active = lpm->num_lengths > 0;
+        while (active) {
+            for (int i = 0; i < num; i++) {
+                if (lo_idxs[i] > hi_idxs[i]) { continue; }
+                lens[i] = lpm->lengths[(lo_idxs[i] + hi_idxs[i]) / 2];
+                his[i] = addr_his[i];
+                los[i] = addr_los[i];
+                mask_prefix(&his[i], &los[i], lens[i]);
+                positions[i] = hash_prefix(his[i], los[i], lens[i]) & lpm->slot_mask;
+                __builtin_prefetch(&lpm->slots[positions[i]]);
+            }
+            active = false;
+            for (int i = 0; i < num; i++) {
+                if (lo_idxs[i] > hi_idxs[i]) { continue; }
+                int mid = (lo_idxs[i] + hi_idxs[i]) / 2;
+                const lpm6_slot_t *found = NULL;
+                for (uint32_t pos = positions[i]; lpm->slots[pos].used; pos = (pos + 1) & lpm->slot_mask) {
+                    const lpm6_slot_t *slot = &lpm->slots[pos];
+                    if (slot->len == lens[i] && slot->hi == his[i] && slot->lo == los[i]) {
+                        found = slot;
+                        break;
+                    }
+                }
+                if (found) {
+                    results[start + i] = found->bmp;
+                    lo_idxs[i] = mid + 1;
+                } else {
+                    hi_idxs[i] = mid - 1;
+                }
+                active |= lo_idxs[i] <= hi_idxs[i];
+            }
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "error.h"
+#include <netinet/in.h>
+#include <inttypes.h>
+
+// Longest prefix match for 128-bit IPv6 prefixes using binary search on prefix lengths (Waldvogel et al.).
+// Every prefix length in use has its prefixes in one hash table. Markers are planted along the binary search path of
+// each prefix and carry their best matching prefix, so a lookup costs O(log W) hash probes for W distinct lengths.
+
+#define LPM6_NO_ROUTE UINT32_MAX
+
+typedef struct lpm6_slot {
+    uint64_t hi;        // Prefix bits 0-63 in host byte order
+    uint64_t lo;        // Prefix bits 64-127 in host byte order
+    uint8_t len;        // Prefix length
+    uint8_t used;
+    uint32_t nh;        // Next hop of this prefix, LPM6_NO_ROUTE for pure markers
+    uint32_t bmp;       // Next hop of best matching prefix (len <= this length)
+} lpm6_slot_t;
+
+typedef struct lpm6_rule {
+    uint64_t hi;
+    uint64_t lo;
+    uint8_t len;
+    uint32_t nh;
+} lpm6_rule_t;
+
+typedef struct lpm6 {
+    // Rules are the source of truth, the search structure is rebuilt from them by lpm6_build
+    lpm6_rule_t *rules;
+    int num_rules;
+    int rule_capacity;
+    int32_t *rule_index;    // Hash of prefix to rule position, -1 if empty
+    uint32_t rule_index_mask;
+    // Search structure
+    lpm6_slot_t *slots;
+    uint32_t slot_mask;
+    uint8_t lengths[129];   // Distinct prefix lengths in ascending order
+    int num_lengths;
+    bool dirty;             // Rules changed since the last build
+} lpm6_t;
+
+RC lpm6_init(lpm6_t *lpm, int capacity);
+
+void lpm6_destroy(lpm6_t *lpm);
+
+// Insert or update a prefix. Changes are batched and only seen by lookups after lpm6_build().
+RC lpm6_add(lpm6_t *lpm, const struct in6_addr *prefix, int len, uint32_t nh);
+
+RC lpm6_del(lpm6_t *lpm, const struct in6_addr *prefix, int len);
+
+// Next hop of exactly this prefix, including changes not built yet, or LPM6_NO_ROUTE
+uint32_t lpm6_find(const lpm6_t *lpm, const struct in6_addr *prefix, int len);
+
+// Rebuild the search structure if rules changed, outside of the forwarding path. On failure the previous structure is
+// kept for lookups and the rebuild is retried by the next call.
+RC lpm6_build(lpm6_t *lpm);
+
+// Return next hop of the longest matching prefix, or LPM6_NO_ROUTE
+uint32_t lpm6_lookup(const lpm6_t *lpm, const struct in6_addr *addr);
+
+// Look up n addresses at once, interleaving their searches so that their cache misses overlap
+void lpm6_lookup_burst(const lpm6_t *lpm, const struct in6_addr *addrs, int n, uint32_t *results);
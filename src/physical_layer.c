@@ -1,39 +1,160 @@
 #include "physical_layer.h"
+#include "capture.h"
+#include "pktbuf.h"
+#ifdef HAVE_IO_URING
+#include "physical_uring.h"
+#endif
 #include <pcap/pcap.h>
+#include <net/if.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 static pcap_t *pcap_handle[MAX_IF];
+static bool nano_tstamp[MAX_IF];    // Whether pcap timestamps are in nanoseconds rather than microseconds
+static int if_mtus[MAX_IF];
 static int epfd;
+static int wakeup_fd = -1;
 
-RC physical_init() {
-    epfd = epoll_create1(0);
-    if (epfd < 0) {
-        perror("epoll_create1()");
-        return PHYSICAL_INIT_FAIL;
+#define WAKEUP_EVENT MAX_IF     // epoll data of wakeup fd, past all interface indices
+
+#ifdef HAVE_IO_URING
+#define USE_URING (io_config.backend == IO_BACKEND_IO_URING)
+#else
+#define USE_URING false
+// Never called, physical_init fails first
+#define uring_init() PHYSICAL_INIT_FAIL
+#define uring_open(if_idx, if_name) PHYSICAL_INIT_FAIL
+#define uring_attach(if_idx) PHYSICAL_INIT_FAIL
+#define uring_close(if_idx)
+#define uring_add_wakeup(fd) PHYSICAL_INIT_FAIL
+#define uring_send(packet, len, if_idx)
+#define uring_flush()
+#define uring_recv(timeout_ms, packet, out_if_idx, out_rx_ns) 0
+#endif
+
+// MTU of the device, or the ethernet MTU if it cannot be read
+static int read_mtu(const char *if_name) {
+    int mtu = ETH_DATA_LEN;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, if_name, IFNAMSIZ - 1);
+    if (fd >= 0 && ioctl(fd, SIOCGIFMTU, &ifr) == 0) {
+        mtu = ifr.ifr_mtu;
+    } else {
+        fprintf(stderr, "Cannot get MTU of interface %s, assuming %d\n", if_name, mtu);
+    }
+    if (fd >= 0) { close(fd); }
+    return mtu;
+}
+
+int physical_mtu(int if_idx) {
+    return if_mtus[if_idx];
+}
+
+RC physical_open(int if_idx, const char *if_name) {
+    if_mtus[if_idx] = read_mtu(if_name);
+    if (USE_URING) {
+        return uring_open(if_idx, if_name);
     }
     char error_buffer[PCAP_ERRBUF_SIZE];
-    for (int i = 0; i < NUM_IF; i++) {
-        pcap_handle[i] = pcap_open_live(if_names[i], BUFSIZ, 1, 1, error_buffer);
-        if (pcap_handle[i] == NULL) {
-            fprintf(stderr, "Cannot open pcap for interface %s\n", if_names[i]);
-            return PHYSICAL_INIT_FAIL;
-        }
-        pcap_setnonblock(pcap_handle[i], 1, error_buffer);
-        int fd = pcap_get_selectable_fd(pcap_handle[i]);
-        if (fd < 0) {
-            fprintf(stderr, "Cannot get FD of pcap handle. Are you on Linux?\n");
-            return PHYSICAL_INIT_FAIL;
-        }
-        struct epoll_event event;
-        event.events = EPOLLIN;
-        event.data.u32 = i;     // interface index
-        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
-            perror("epoll_ctl()");
+    pcap_t *handle = pcap_create(if_name, error_buffer);
+    if (handle == NULL) {
+        fprintf(stderr, "Cannot open pcap for interface %s\n", if_name);
+        return PHYSICAL_INIT_FAIL;
+    }
+    // Frames must fit into a packet buffer. Receive timestamps are taken by the kernel in nanoseconds.
+    pcap_set_snaplen(handle, PKT_DATA_ROOM);
+    pcap_set_promisc(handle, 1);
+    pcap_set_timeout(handle, 1);
+    pcap_set_tstamp_precision(handle, PCAP_TSTAMP_PRECISION_NANO);
+    int status = pcap_activate(handle);
+    if (status < 0) {
+        fprintf(stderr, "Cannot open pcap for interface %s: %s\n", if_name, pcap_statustostr(status));
+        pcap_close(handle);
+        return PHYSICAL_INIT_FAIL;
+    }
+    nano_tstamp[if_idx] = pcap_get_tstamp_precision(handle) == PCAP_TSTAMP_PRECISION_NANO;
+    pcap_setnonblock(handle, 1, error_buffer);
+    int fd = pcap_get_selectable_fd(handle);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot get FD of pcap handle. Are you on Linux?\n");
+        pcap_close(handle);
+        return PHYSICAL_INIT_FAIL;
+    }
+    pcap_handle[if_idx] = handle;
+    return 0;
+}
+
+RC physical_attach(int if_idx) {
+    if (USE_URING) {
+        return uring_attach(if_idx);
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = if_idx;     // interface index
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, pcap_get_selectable_fd(pcap_handle[if_idx]), &event) < 0) {
+        perror("epoll_ctl()");
+        return PHYSICAL_INIT_FAIL;
+    }
+    return 0;
+}
+
+void physical_close(int if_idx) {
+    if (USE_URING) {
+        uring_close(if_idx);
+        return;
+    }
+    if (pcap_handle[if_idx] == NULL) {
+        return;
+    }
+    // Not attached yet if a config reload is rolled back
+    epoll_ctl(epfd, EPOLL_CTL_DEL, pcap_get_selectable_fd(pcap_handle[if_idx]), NULL);
+    pcap_close(pcap_handle[if_idx]);
+    pcap_handle[if_idx] = NULL;
+}
+
+RC physical_add_wakeup(int fd) {
+    if (USE_URING) {
+        return uring_add_wakeup(fd);
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = WAKEUP_EVENT;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("epoll_ctl()");
+        return PHYSICAL_INIT_FAIL;
+    }
+    wakeup_fd = fd;
+    return 0;
+}
+
+RC physical_init() {
+    if (USE_URING) {
+        RC rc = uring_init();
+        if (rc) { return rc; }
+    } else if (io_config.backend != IO_BACKEND_PCAP) {
+        fprintf(stderr, "Io backend %s is not supported by this build\n", io_backend_names[io_config.backend]);
+        return PHYSICAL_INIT_FAIL;
+    } else {
+        epfd = epoll_create1(0);
+        if (epfd < 0) {
+            perror("epoll_create1()");
             return PHYSICAL_INIT_FAIL;
         }
     }
+    printf("Io backend: %s\n", io_backend_names[io_config.backend]);
+    for (int i = 0; i < config->num_if; i++) {
+        if (!if_active(i) || if_is_tunnel(i)) { continue; }
+        RC rc = physical_open(i, config->if_names[i]);
+        if (rc) { return rc; }
+        rc = physical_attach(i);
+        if (rc) { return rc; }
+    }
     return 0;
 }
 
@@ -44,14 +165,43 @@ uint64_t get_clock_ms() {
 }
 
 void send_packet(const uint8_t *packet, size_t len, int if_idx) {
+    if (USE_URING) {
+        CAPTURE(CAPTURE_TX, if_idx, NULL, packet, len, DROP_NONE);
+        uring_send(packet, len, if_idx);
+        return;
+    }
+    if (pcap_handle[if_idx] == NULL) {
+        return;
+    }
+    CAPTURE(CAPTURE_TX, if_idx, NULL, packet, len, DROP_NONE);
     if (pcap_inject(pcap_handle[if_idx], packet, len) == PCAP_ERROR) {
 //        fprintf(stderr, "pcap error: %s\n", pcap_geterr(pcap_handle[if_idx]));
     }
 }
 
-size_t recv_packet(int timeout_ms, uint8_t *packet, int *out_if_idx) {
+void physical_flush() {
+    if (USE_URING) {
+        uring_flush();
+    }
+}
+
+size_t recv_packet(int timeout_ms, uint8_t *packet, int *out_if_idx, uint64_t *out_rx_ns) {
+    if (USE_URING) {
+        size_t len = uring_recv(timeout_ms, packet, out_if_idx, out_rx_ns);
+        if (len > 0) {
+            CAPTURE(CAPTURE_RX, *out_if_idx, NULL, packet, len, DROP_NONE);
+        }
+        return len;
+    }
     struct epoll_event event;
     int num_events = epoll_wait(epfd, &event, 1, timeout_ms);
+    if (num_events > 0 && event.data.u32 == WAKEUP_EVENT) {
+        uint64_t count;
+        if (read(wakeup_fd, &count, sizeof(count)) < 0) {
+            perror("read()");
+        }
+        return 0;
+    }
     if (num_events > 0) {
         if (event.events & EPOLLIN) {
             int if_idx = event.data.u32;
@@ -61,6 +211,11 @@ size_t recv_packet(int timeout_ms, uint8_t *packet, int *out_if_idx) {
                 // return the first active interface
                 memcpy(packet, next_pkt, hdr.caplen);
                 *out_if_idx = if_idx;
+                if (out_rx_ns != NULL) {
+                    *out_rx_ns = (uint64_t) hdr.ts.tv_sec * 1000000000 +
+                                 (uint64_t) hdr.ts.tv_usec * (nano_tstamp[if_idx] ? 1 : 1000);
+                }
+                CAPTURE(CAPTURE_RX, if_idx, NULL, packet, hdr.caplen, DROP_NONE);
                 return hdr.caplen;
             }
         }
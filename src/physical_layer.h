@@ -6,8 +6,27 @@
 
 RC physical_init();
 
+// Open interface without receiving from it yet, safe from the config reload thread while forwarding runs
+RC physical_open(int if_idx, const char *if_name);
+
+// Start receiving from an opened interface
+RC physical_attach(int if_idx);
+
+void physical_close(int if_idx);
+
+// MTU of an opened interface, read from the kernel when it was opened
+int physical_mtu(int if_idx);
+
+// Make recv_packet return early, without a frame, whenever fd becomes readable. fd is drained by recv_packet.
+RC physical_add_wakeup(int fd);
+
 uint64_t get_clock_ms();
 
+// Frames may be queued by the backend until physical_flush, or until recv_packet waits for frames
 void send_packet(const uint8_t *packet, size_t len, int if_idx);
 
-size_t recv_packet(int timeout_ms, uint8_t *packet, int *out_if_idx);
+// Hand queued frames to the kernel, once per burst
+void physical_flush();
+
+// Receive a frame from any interface. Kernel receive time (CLOCK_REALTIME, ns) is returned if out_rx_ns is not NULL.
+size_t recv_packet(int timeout_ms, uint8_t *packet, int *out_if_idx, uint64_t *out_rx_ns);
@@ -0,0 +1,419 @@
+#include "physical_uring.h"
+#include "config.h"
+#include "pktbuf.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define URING_SQ_ENTRIES 512
+#define URING_CQ_ENTRIES 4096       // Multishot receives post a CQE per frame, room for bursts of all interfaces
+#define URING_RX_BUFS 1024          // Provided buffers, a power of two
+#define URING_TX_SLOTS 256          // Frames queued or in flight on send
+#define URING_BUF_SIZE 2048
+#define URING_BUF_GROUP 0
+#define URING_RCVBUF (2 * 1024 * 1024)
+
+// Space of the receive timestamp in each buffer, between the recvmsg header and the frame
+#define URING_CONTROL_LEN CMSG_SPACE(sizeof(struct timespec))
+#define URING_HDR_LEN (sizeof(struct io_uring_recvmsg_out) + URING_CONTROL_LEN)
+
+// user_data of an SQE: kind, generation of the socket it was submitted for, and interface index or send slot
+enum {
+    URING_RX = 1,
+    URING_TX,
+    URING_WAKEUP,
+    URING_CANCEL,
+};
+
+static inline uint64_t make_user_data(uint64_t kind, uint32_t gen, uint32_t idx) {
+    return kind << 56 | (uint64_t) (gen & 0xffffff) << 32 | idx;
+}
+
+// Frame taken off the CQ, not returned by uring_recv yet
+typedef struct rx_frame {
+    uint16_t bid;
+    int if_idx;
+} rx_frame_t;
+
+static struct {
+    int fd;
+    // Submission queue, shared with the kernel
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;     // SQEs filled in, published to the kernel on enter
+    struct io_uring_sqe *sqes;
+    // Completion queue, shared with the kernel
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    // Provided receive buffers
+    struct io_uring_buf_ring *buf_ring;
+    uint16_t buf_ring_tail;
+    uint8_t *rx_bufs;
+    rx_frame_t rx_frames[URING_RX_BUFS];    // Each holds a buffer, so there are never more
+    unsigned rx_head, rx_tail;
+    // Send slots
+    uint8_t *tx_bufs;
+    uint16_t free_tx[URING_TX_SLOTS];
+    int num_free_tx;
+    // Sockets
+    int sock[MAX_IF];
+    uint32_t gen[MAX_IF];       // Incremented on close, CQEs of an earlier socket are dropped
+    bool attached[MAX_IF];
+    bool armed[MAX_IF];         // Multishot receive is pending
+    struct msghdr msgs[MAX_IF];
+    int wakeup_fd;
+    bool wakeup_armed;
+    bool wakeup_pending;
+} uring = {.fd = -1, .wakeup_fd = -1};
+
+static int uring_enter(unsigned min_complete, int timeout_ms) {
+    atomic_store_explicit(uring.sq_tail, uring.sq_local_tail, memory_order_release);
+    unsigned to_submit = uring.sq_local_tail - atomic_load_explicit(uring.sq_head, memory_order_acquire);
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = {0};
+    if (min_complete && timeout_ms >= 0) {
+        ts = (struct __kernel_timespec) {.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L};
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    if (to_submit == 0 && min_complete == 0) {
+        return 0;
+    }
+    int ret = (int) syscall(__NR_io_uring_enter, uring.fd, to_submit, min_complete, flags,
+                            flags & IORING_ENTER_EXT_ARG ? &arg : NULL, sizeof(arg));
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        perror("io_uring_enter()");
+    }
+    return ret;
+}
+
+static struct io_uring_sqe *get_sqe() {
+    if (uring.sq_local_tail - atomic_load_explicit(uring.sq_head, memory_order_acquire) >= uring.sq_entries) {
+        uring_enter(0, 0);
+        if (uring.sq_local_tail - atomic_load_explicit(uring.sq_head, memory_order_acquire) >= uring.sq_entries) {
+            fprintf(stderr, "io_uring submission queue full\n");
+            return NULL;
+        }
+    }
+    struct io_uring_sqe *sqe = &uring.sqes[uring.sq_local_tail++ & uring.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void recycle_buf(uint16_t bid) {
+    struct io_uring_buf *buf = &uring.buf_ring->bufs[uring.buf_ring_tail & (URING_RX_BUFS - 1)];
+    buf->addr = (uint64_t) (uintptr_t) (uring.rx_bufs + (size_t) bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    uring.buf_ring_tail++;
+    __atomic_store_n(&uring.buf_ring->tail, uring.buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+static void arm_recv(int if_idx) {
+    struct io_uring_sqe *sqe = get_sqe();
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = uring.sock[if_idx];
+    sqe->addr = (uint64_t) (uintptr_t) &uring.msgs[if_idx];
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = make_user_data(URING_RX, uring.gen[if_idx], if_idx);
+    uring.armed[if_idx] = true;
+}
+
+static void arm_wakeup() {
+    struct io_uring_sqe *sqe = get_sqe();
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = uring.wakeup_fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = make_user_data(URING_WAKEUP, 0, 0);
+    uring.wakeup_armed = true;
+}
+
+static void handle_cqe(const struct io_uring_cqe *cqe) {
+    uint64_t kind = cqe->user_data >> 56;
+    uint32_t gen = (cqe->user_data >> 32) & 0xffffff;
+    uint32_t idx = (uint32_t) cqe->user_data;
+    if (kind == URING_TX) {
+        uring.free_tx[uring.num_free_tx++] = (uint16_t) idx;
+    } else if (kind == URING_RX) {
+        bool current = gen == (uring.gen[idx] & 0xffffff);
+        if (current && !(cqe->flags & IORING_CQE_F_MORE)) {
+            // Multishot ended, e.g. out of buffers, armed again by the next uring_recv
+            uring.armed[idx] = false;
+        }
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            if (current && cqe->res > 0) {
+                uring.rx_frames[uring.rx_tail++ % URING_RX_BUFS] = (rx_frame_t) {.bid = bid, .if_idx = (int) idx};
+            } else {
+                recycle_buf(bid);
+            }
+        }
+    } else if (kind == URING_WAKEUP) {
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            uring.wakeup_armed = false;
+        }
+        uring.wakeup_pending = true;
+    }
+}
+
+static void reap() {
+    unsigned head = atomic_load_explicit(uring.cq_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(uring.cq_tail, memory_order_acquire);
+    while (head != tail) {
+        handle_cqe(&uring.cqes[head & uring.cq_mask]);
+        head++;
+    }
+    atomic_store_explicit(uring.cq_head, head, memory_order_release);
+}
+
+RC uring_init() {
+    struct io_uring_params params = {.flags = IORING_SETUP_CQSIZE, .cq_entries = URING_CQ_ENTRIES};
+    uring.fd = (int) syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &params);
+    if (uring.fd < 0) {
+        perror("io_uring_setup()");
+        return PHYSICAL_INIT_FAIL;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        fprintf(stderr, "io_uring of this kernel is too old, use the pcap backend\n");
+        return PHYSICAL_INIT_FAIL;
+    }
+    // SQ and CQ rings share one mapping
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+    uint8_t *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd,
+                         IORING_OFF_SQ_RING);
+    uring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+    if (ring == MAP_FAILED || uring.sqes == MAP_FAILED) {
+        perror("mmap()");
+        return PHYSICAL_INIT_FAIL;
+    }
+    uring.sq_head = (_Atomic unsigned *) (ring + params.sq_off.head);
+    uring.sq_tail = (_Atomic unsigned *) (ring + params.sq_off.tail);
+    uring.sq_mask = *(unsigned *) (ring + params.sq_off.ring_mask);
+    uring.sq_entries = params.sq_entries;
+    uring.sq_local_tail = atomic_load_explicit(uring.sq_tail, memory_order_relaxed);
+    // SQE i always sits in slot i of the SQ array
+    unsigned *sq_array = (unsigned *) (ring + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        sq_array[i] = i;
+    }
+    uring.cq_head = (_Atomic unsigned *) (ring + params.cq_off.head);
+    uring.cq_tail = (_Atomic unsigned *) (ring + params.cq_off.tail);
+    uring.cq_mask = *(unsigned *) (ring + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *) (ring + params.cq_off.cqes);
+
+    // Buffer ring and buffers, page aligned
+    size_t buf_ring_size = URING_RX_BUFS * sizeof(struct io_uring_buf);
+    size_t bufs_size = (size_t) (URING_RX_BUFS + URING_TX_SLOTS) * URING_BUF_SIZE;
+    uint8_t *mem = mmap(NULL, buf_ring_size + bufs_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap()");
+        return PHYSICAL_INIT_FAIL;
+    }
+    uring.buf_ring = (struct io_uring_buf_ring *) mem;
+    uring.rx_bufs = mem + buf_ring_size;
+    uring.tx_bufs = uring.rx_bufs + (size_t) URING_RX_BUFS * URING_BUF_SIZE;
+    struct io_uring_buf_reg reg = {
+            .ring_addr = (uint64_t) (uintptr_t) uring.buf_ring,
+            .ring_entries = URING_RX_BUFS,
+            .bgid = URING_BUF_GROUP,
+    };
+    if (syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register(IORING_REGISTER_PBUF_RING)");
+        return PHYSICAL_INIT_FAIL;
+    }
+    for (int i = 0; i < URING_RX_BUFS; i++) {
+        recycle_buf((uint16_t) i);
+    }
+    for (int i = 0; i < URING_TX_SLOTS; i++) {
+        uring.free_tx[i] = (uint16_t) (URING_TX_SLOTS - 1 - i);
+    }
+    uring.num_free_tx = URING_TX_SLOTS;
+    for (int i = 0; i < MAX_IF; i++) {
+        uring.sock[i] = -1;
+    }
+    return 0;
+}
+
+RC uring_open(int if_idx, const char *if_name) {
+    int ifindex = (int) if_nametoindex(if_name);
+    int sock = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, htons(ETH_P_ALL));
+    if (ifindex == 0 || sock < 0) {
+        fprintf(stderr, "Cannot open packet socket for interface %s: %s\n", if_name, strerror(errno));
+        if (sock >= 0) {
+            close(sock);
+        }
+        return PHYSICAL_INIT_FAIL;
+    }
+    struct sockaddr_ll addr = {.sll_family = AF_PACKET, .sll_protocol = htons(ETH_P_ALL), .sll_ifindex = ifindex};
+    struct packet_mreq mreq = {.mr_ifindex = ifindex, .mr_type = PACKET_MR_PROMISC};
+    int one = 1, rcvbuf = URING_RCVBUF;
+    // Frames sent by the router itself are not received back, unlike with pcap
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        setsockopt(sock, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+        setsockopt(sock, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one)) < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+        fprintf(stderr, "Cannot set up packet socket for interface %s: %s\n", if_name, strerror(errno));
+        close(sock);
+        return PHYSICAL_INIT_FAIL;
+    }
+    // Multishot recvmsg lays out each buffer as header, control (room for the timestamp) and frame
+    uring.msgs[if_idx] = (struct msghdr) {.msg_controllen = URING_CONTROL_LEN};
+    uring.sock[if_idx] = sock;
+    return 0;
+}
+
+RC uring_attach(int if_idx) {
+    uring.attached[if_idx] = true;
+    arm_recv(if_idx);
+    return uring.armed[if_idx] ? 0 : PHYSICAL_INIT_FAIL;
+}
+
+void uring_close(int if_idx) {
+    if (uring.sock[if_idx] < 0) {
+        return;
+    }
+    // Not attached if a config reload is rolled back, the ring is then left to the forwarding thread
+    if (uring.attached[if_idx]) {
+        if (uring.armed[if_idx]) {
+            struct io_uring_sqe *sqe = get_sqe();
+            if (sqe != NULL) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = make_user_data(URING_RX, uring.gen[if_idx], if_idx);
+                sqe->user_data = make_user_data(URING_CANCEL, 0, 0);
+            }
+        }
+        // Queued sends refer to the socket by fd, submit them before it is closed
+        uring_enter(0, 0);
+    }
+    uring.gen[if_idx]++;
+    uring.attached[if_idx] = uring.armed[if_idx] = false;
+    close(uring.sock[if_idx]);
+    uring.sock[if_idx] = -1;
+}
+
+RC uring_add_wakeup(int fd) {
+    uring.wakeup_fd = fd;
+    arm_wakeup();
+    return uring.wakeup_armed ? 0 : PHYSICAL_INIT_FAIL;
+}
+
+void uring_flush() {
+    uring_enter(0, 0);
+}
+
+void uring_send(const uint8_t *packet, size_t len, int if_idx) {
+    if (uring.sock[if_idx] < 0 || len > URING_BUF_SIZE) {
+        return;
+    }
+    if (uring.num_free_tx == 0) {
+        // All slots queued or in flight, submit them and take back the completed ones
+        uring_enter(0, 0);
+        reap();
+        if (uring.num_free_tx == 0) {
+            uring_enter(1, 1);
+            reap();
+            if (uring.num_free_tx == 0) {
+                return;
+            }
+        }
+    }
+    uint16_t slot = uring.free_tx[--uring.num_free_tx];
+    uint8_t *buf = uring.tx_bufs + (size_t) slot * URING_BUF_SIZE;
+    struct io_uring_sqe *sqe = get_sqe();
+    if (sqe == NULL) {
+        uring.free_tx[uring.num_free_tx++] = slot;
+        return;
+    }
+    memcpy(buf, packet, len);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = uring.sock[if_idx];
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = (uint32_t) len;
+    sqe->user_data = make_user_data(URING_TX, 0, slot);
+}
+
+size_t uring_recv(int timeout_ms, uint8_t *packet, int *out_if_idx, uint64_t *out_rx_ns) {
+    if (uring.rx_head == uring.rx_tail && !uring.wakeup_pending) {
+        // Multishots ended by running out of buffers resume once the frames taken are returned
+        for (int i = 0; i < MAX_IF; i++) {
+            if (uring.attached[i] && !uring.armed[i]) {
+                arm_recv(i);
+            }
+        }
+        if (uring.wakeup_fd >= 0 && !uring.wakeup_armed) {
+            arm_wakeup();
+        }
+        reap();
+        if (uring.rx_head == uring.rx_tail && !uring.wakeup_pending) {
+            // One enter submits the queued sends and waits for frames of all interfaces
+            uring_enter(timeout_ms != 0 ? 1 : 0, timeout_ms);
+            reap();
+        }
+    }
+    if (uring.wakeup_pending) {
+        uring.wakeup_pending = false;
+        uint64_t count;
+        if (read(uring.wakeup_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            perror("read()");
+        }
+        return 0;
+    }
+    if (uring.rx_head == uring.rx_tail) {
+        return 0;
+    }
+    rx_frame_t frame = uring.rx_frames[uring.rx_head++ % URING_RX_BUFS];
+    uint8_t *buf = uring.rx_bufs + (size_t) frame.bid * URING_BUF_SIZE;
+    const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out *) buf;
+    // Frames longer than a packet buffer are cut, as by the pcap snap length
+    size_t len = out->payloadlen;
+    if (len > URING_BUF_SIZE - URING_HDR_LEN) {
+        len = URING_BUF_SIZE - URING_HDR_LEN;
+    }
+    if (len > PKT_DATA_ROOM) {
+        len = PKT_DATA_ROOM;
+    }
+    memcpy(packet, buf + URING_HDR_LEN, len);
+    if (out_rx_ns != NULL) {
+        *out_rx_ns = 0;
+        struct msghdr msg = {.msg_control = buf + sizeof(*out), .msg_controllen = out->controllen};
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                *out_rx_ns = (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+            }
+        }
+    }
+    *out_if_idx = frame.if_idx;
+    recycle_buf(frame.bid);
+    return len;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "error.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+// ===== IO_URING BACKEND =====
+// AF_PACKET raw sockets of all interfaces behind one io_uring. Each socket has a multishot recvmsg, which fills
+// buffers of one provided buffer ring, and sends are queued as SQEs until the next flush. A single io_uring_enter
+// then submits the queued sends and waits for frames of every interface. Same contract as the functions of
+// physical_layer.h, which dispatch here when the io backend is io_uring.
+
+RC uring_init();
+
+// Create and bind the socket, safe from the config reload thread: the ring is only touched by uring_attach
+RC uring_open(int if_idx, const char *if_name);
+
+RC uring_attach(int if_idx);
+
+void uring_close(int if_idx);
+
+RC uring_add_wakeup(int fd);
+
+// Copy frame into a send slot and queue it, submitted by uring_flush or the next uring_recv that waits
+void uring_send(const uint8_t *packet, size_t len, int if_idx);
+
+void uring_flush();
+
+size_t uring_recv(int timeout_ms, uint8_t *packet, int *out_if_idx, uint64_t *out_rx_ns);
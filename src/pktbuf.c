@@ -0,0 +1,88 @@
+#include "pktbuf.h"
+#include "arena.h"
+#include <pthread.h>
+#include <stdio.h>
+
+// Buffers move between the shared free list and per-thread caches in batches, so the lock is taken once per batch
+#define PKT_CACHE_SIZE 64
+#define PKT_CACHE_BATCH 32
+
+static arena_t pool_arena;
+
+static struct {
+    pkt_buf_t *free_list;
+    uint32_t num_free;
+    uint32_t num_bufs;
+    uint64_t alloc_fail;
+    pthread_spinlock_t lock;
+} pool;
+
+static _Thread_local struct {
+    pkt_buf_t *bufs[PKT_CACHE_SIZE];
+    int count;
+} cache;
+
+RC pktpool_init(uint32_t num_bufs, bool hugepage) {
+    RC rc = arena_init(&pool_arena, (size_t) num_bufs * PKT_BUF_SIZE, hugepage);
+    if (rc) { return rc; }
+    pthread_spin_init(&pool.lock, PTHREAD_PROCESS_PRIVATE);
+    pool.free_list = NULL;
+    for (uint32_t i = 0; i < num_bufs; i++) {
+        pkt_buf_t *pkt = arena_alloc(&pool_arena, PKT_BUF_SIZE);
+        pkt->next = pool.free_list;
+        pool.free_list = pkt;
+    }
+    pool.num_bufs = pool.num_free = num_bufs;
+    printf("Packet pool: %u buffers of %d bytes, %s pages\n", num_bufs, PKT_BUF_SIZE,
+           pool_arena.hugepage ? "huge" : "normal");
+    return 0;
+}
+
+static void cache_refill() {
+    pthread_spin_lock(&pool.lock);
+    while (cache.count < PKT_CACHE_BATCH && pool.free_list != NULL) {
+        cache.bufs[cache.count++] = pool.free_list;
+        pool.free_list = pool.free_list->next;
+        pool.num_free--;
+    }
+    pthread_spin_unlock(&pool.lock);
+}
+
+static void cache_flush() {
+    pthread_spin_lock(&pool.lock);
+    while (cache.count > PKT_CACHE_SIZE - PKT_CACHE_BATCH) {
+        pkt_buf_t *pkt = cache.bufs[--cache.count];
+        pkt->next = pool.free_list;
+        pool.free_list = pkt;
+        pool.num_free++;
+    }
+    pthread_spin_unlock(&pool.lock);
+}
+
+pkt_buf_t *pkt_alloc() {
+    if (cache.count == 0) {
+        cache_refill();
+        if (cache.count == 0) {
+            pool.alloc_fail++;
+            return NULL;
+        }
+    }
+    pkt_buf_t *pkt = cache.bufs[--cache.count];
+    pkt->next = NULL;
+    pkt->if_idx = -1;
+    pkt_reset(pkt);
+    return pkt;
+}
+
+void pkt_free(pkt_buf_t *pkt) {
+    if (cache.count == PKT_CACHE_SIZE) {
+        cache_flush();
+    }
+    cache.bufs[cache.count++] = pkt;
+}
+
+void print_pool_stats() {
+    printf("================= POOL STATS ==================\n");
+    printf("buffers: %u, free in pool: %u, cached: %d, alloc failed: %" PRIu64 "\n",
+           pool.num_bufs, pool.num_free, cache.count, pool.alloc_fail);
+}
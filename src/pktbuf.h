@@ -0,0 +1,58 @@
+#pragma once
+
+#include "error.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+// ===== PACKET BUFFER =====
+// Fixed size packet buffers from a preallocated pool. Each buffer has headroom in front of the frame, so that
+// headers (ethernet, VLAN tag, tunnel) can be pushed in place instead of copying the packet.
+#define PKT_BUF_SIZE 2048
+#define PKT_HEADROOM 128
+
+typedef struct pkt_buf {
+    struct pkt_buf *next;   // Free list / queue link
+    uint8_t *data;          // Start of packet
+    uint32_t len;
+    int if_idx;             // Receive interface
+    uint64_t rx_ns;         // Kernel receive time
+    int tx_if_idx;          // Transmit interface, set by the graph node that routes the packet
+    uint64_t opaque[2];     // Scratch for graph nodes to pass per packet state to the next node
+    uint8_t buf[] __attribute__((aligned(64)));     // Headroom followed by packet data
+} pkt_buf_t;
+
+#define PKT_DATA_ROOM (PKT_BUF_SIZE - offsetof(pkt_buf_t, buf) - PKT_HEADROOM)
+
+// Allocate pool of num_bufs buffers, backed by hugepages if requested and available
+RC pktpool_init(uint32_t num_bufs, bool hugepage);
+
+// Return a buffer with data at the default headroom, or NULL if the pool is exhausted. Never calls malloc.
+pkt_buf_t *pkt_alloc();
+
+void pkt_free(pkt_buf_t *pkt);
+
+// Reset buffer for reuse, return start of packet data
+static inline uint8_t *pkt_reset(pkt_buf_t *pkt) {
+    pkt->data = pkt->buf + PKT_HEADROOM;
+    pkt->len = 0;
+    return pkt->data;
+}
+
+// Extend packet at front by len bytes of headroom, or strip len bytes from front. Return new start.
+static inline uint8_t *pkt_push(pkt_buf_t *pkt, size_t len) {
+    pkt->data -= len;
+    pkt->len += len;
+    return pkt->data;
+}
+
+static inline uint8_t *pkt_pull(pkt_buf_t *pkt, size_t len) {
+    pkt->data += len;
+    pkt->len -= len;
+    return pkt->data;
+}
+
+static inline size_t pkt_headroom(const pkt_buf_t *pkt) {
+    return pkt->data - pkt->buf;
+}
+
+void print_pool_stats();
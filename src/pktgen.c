@@ -0,0 +1,407 @@
+#include "physical_layer.h"
+#include "config.h"
+#include "checksum.h"
+#include "histogram.h"
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <netinet/ether.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+// Packet generator and sink. Generator sends templated UDP frames into one interface, sink counts them on another
+// interface and reports loss, reordering and one-way latency. Both sides must run on the same host.
+
+#define PKTGEN_MAGIC 0x50474e31     // "PGN1"
+#define PKTGEN_UDP_PORT 9           // Discard
+#define PKTGEN_MIN_FRAME 64
+#define PKTGEN_MAX_FRAME 1518
+#define MAX_SIZES 16
+#define PKTGEN_FLOW_PORTS (65535 - PKTGEN_UDP_PORT)     // Source ports per source address
+#define PKTGEN_MAX_FLOWS (1 << 24)
+#define PKTGEN_TX_BURST 32          // Frames queued per flush of the io backend
+
+// Payload header embedded in every generated frame
+typedef struct __attribute__((__packed__)) pktgen_hdr {
+    uint32_t magic;
+    uint32_t flow;
+    uint64_t seq;
+    uint64_t tx_ns;     // CLOCK_REALTIME at send time, the clock of kernel receive timestamps
+} pktgen_hdr_t;
+
+#define PKTGEN_HDR_OFFSET (sizeof(struct ether_header) + sizeof(struct iphdr) + sizeof(struct udphdr))
+// Ethernet FCS is not passed to pcap
+#define PKTGEN_FCS_LEN 4
+
+static struct {
+    struct ether_addr dst_mac;
+    in_addr_t src_ip;
+    in_addr_t dst_ip;
+    uint32_t dst_spread;            // Number of destination addresses starting from dst_ip
+    uint32_t dst_stride;            // Distance between two of these addresses
+    uint32_t flows;                 // Number of UDP source ports, then of source addresses following src_ip
+    uint64_t rate;                  // Frames per second, 0 for as fast as possible
+    uint64_t count;                 // Frames to send, 0 for unlimited
+    int duration;                   // Seconds, 0 for unlimited
+    int sizes[MAX_SIZES];           // Frame sizes without FCS
+    int weights[MAX_SIZES];
+    int num_sizes;
+} opts = {
+        .dst_spread = 1,
+        .dst_stride = 1,
+        .flows = 1,
+        .duration = 10,
+};
+
+static volatile bool stopped;
+
+static void on_signal(int sig) {
+    stopped = true;
+}
+
+static inline uint64_t get_clock_ns() {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (uint64_t) tp.tv_sec * 1000000000 + (uint64_t) tp.tv_nsec;
+}
+
+static inline uint64_t get_realtime_ns() {
+    struct timespec tp;
+    clock_gettime(CLOCK_REALTIME, &tp);
+    return (uint64_t) tp.tv_sec * 1000000000 + (uint64_t) tp.tv_nsec;
+}
+
+// ===== OPTIONS =====
+static void usage() {
+    printf("Usage: ./pktgen tx <if_name> --dst-mac MAC --src-ip IP --dst-ip IP [options]\n"
+           "       ./pktgen rx <if_name> [--duration SEC] [--backend NAME]\n"
+           "Options:\n"
+           "  --dst-mac MAC        Destination MAC, e.g. the router's interface\n"
+           "  --src-ip IP          Source IP of generated frames\n"
+           "  --dst-ip IP          First destination IP\n"
+           "  --dst-spread N       Spread destination IP over N consecutive addresses (default 1)\n"
+           "  --dst-stride N       Step between spread addresses, e.g. 256 for one address per /24 (default 1)\n"
+           "  --flows N            Number of flows, as UDP source ports, then source addresses following --src-ip (default 1)\n"
+           "  --size SIZE[:W],...  Frame sizes in bytes including FCS with optional weights, e.g. 64:7,576:4,1518:1\n"
+           "  --rate PPS           Frames per second, 0 for line rate (default 0)\n"
+           "  --count N            Stop after N frames (default unlimited)\n"
+           "  --duration SEC       Stop after SEC seconds, 0 for unlimited (default 10)\n"
+           "  --backend NAME       Io backend, pcap or io_uring (default pcap)\n");
+}
+
+static RC parse_sizes(const char *str) {
+    char *dup = strdup(str);
+    char *save = NULL;
+    opts.num_sizes = 0;
+    for (char *tok = strtok_r(dup, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        if (opts.num_sizes == MAX_SIZES) {
+            fprintf(stderr, "At most %d frame sizes\n", MAX_SIZES);
+            free(dup);
+            return CONFIG_PARSE_FAIL;
+        }
+        int size, weight = 1;
+        if (sscanf(tok, "%d:%d", &size, &weight) < 1 || size < PKTGEN_MIN_FRAME || size > PKTGEN_MAX_FRAME ||
+            weight <= 0) {
+            fprintf(stderr, "Invalid frame size %s, must be within [%d, %d]\n", tok, PKTGEN_MIN_FRAME,
+                    PKTGEN_MAX_FRAME);
+            free(dup);
+            return CONFIG_PARSE_FAIL;
+        }
+        opts.sizes[opts.num_sizes] = size - PKTGEN_FCS_LEN;
+        opts.weights[opts.num_sizes] = weight;
+        opts.num_sizes++;
+    }
+    free(dup);
+    return 0;
+}
+
+static RC parse_opts(int argc, char **argv, bool tx) {
+    static const struct option long_opts[] = {
+            {"dst-mac",    required_argument, NULL, 'm'},
+            {"src-ip",     required_argument, NULL, 's'},
+            {"dst-ip",     required_argument, NULL, 'd'},
+            {"dst-spread", required_argument, NULL, 'p'},
+            {"dst-stride", required_argument, NULL, 'S'},
+            {"flows",      required_argument, NULL, 'f'},
+            {"size",       required_argument, NULL, 'l'},
+            {"rate",       required_argument, NULL, 'r'},
+            {"count",      required_argument, NULL, 'c'},
+            {"duration",   required_argument, NULL, 't'},
+            {"backend",    required_argument, NULL, 'b'},
+            {NULL, 0,                         NULL, 0},
+    };
+    bool has_dst_mac = false, has_src_ip = false, has_dst_ip = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'm':
+                if (ether_aton_r(optarg, &opts.dst_mac) == NULL) {
+                    fprintf(stderr, "Invalid MAC address %s\n", optarg);
+                    return CONFIG_PARSE_FAIL;
+                }
+                has_dst_mac = true;
+                break;
+            case 's':
+                has_src_ip = inet_aton(optarg, (struct in_addr *) &opts.src_ip);
+                break;
+            case 'd':
+                has_dst_ip = inet_aton(optarg, (struct in_addr *) &opts.dst_ip);
+                break;
+            case 'p':
+                opts.dst_spread = strtoul(optarg, NULL, 10);
+                break;
+            case 'S':
+                opts.dst_stride = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                opts.flows = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                if (parse_sizes(optarg)) { return CONFIG_PARSE_FAIL; }
+                break;
+            case 'r':
+                opts.rate = strtoull(optarg, NULL, 10);
+                break;
+            case 'c':
+                opts.count = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                opts.duration = atoi(optarg);
+                break;
+            case 'b':
+                if (parse_io_backend(optarg, &io_config.backend)) { return CONFIG_PARSE_FAIL; }
+                break;
+            default:
+                return CONFIG_PARSE_FAIL;
+        }
+    }
+    if (tx && (!has_dst_mac || !has_src_ip || !has_dst_ip)) {
+        fprintf(stderr, "--dst-mac, --src-ip and --dst-ip are required\n");
+        return CONFIG_PARSE_FAIL;
+    }
+    if (opts.dst_spread == 0 || opts.dst_stride == 0 || opts.flows == 0 || opts.flows > PKTGEN_MAX_FLOWS) {
+        fprintf(stderr, "Destination spread and stride must be positive and flows within [1, %d]\n", PKTGEN_MAX_FLOWS);
+        return CONFIG_PARSE_FAIL;
+    }
+    if (opts.num_sizes == 0) {
+        parse_sizes("64");
+    }
+    return 0;
+}
+
+// Use the interface as the only port of physical layer
+static RC pktgen_config_init(const char *if_name) {
+    config = calloc(1, sizeof(config_t));
+    if (config == NULL) {
+        fprintf(stderr, "Cannot allocate config\n");
+        return CONFIG_INIT_FAIL;
+    }
+    config->num_if = 1;
+    config->if_names[0] = strdup(if_name);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, if_name, IFNAMSIZ - 1);
+    if (fd < 0 || ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+        fprintf(stderr, "Cannot get MAC address of interface %s\n", if_name);
+        if (fd >= 0) { close(fd); }
+        return CONFIG_INIT_FAIL;
+    }
+    close(fd);
+    memcpy(&config->if_macs[0], ifr.ifr_hwaddr.sa_data, sizeof(struct ether_addr));
+    return 0;
+}
+
+// ===== GENERATOR =====
+// Frame sizes in send order, each size appears as many times as its weight
+static int size_seq[MAX_SIZES * 64];
+static int size_seq_len;
+
+static void build_size_seq() {
+    // Interleave sizes so that a short run already follows the distribution
+    int remaining[MAX_SIZES];
+    memcpy(remaining, opts.weights, sizeof(remaining));
+    bool left = true;
+    while (left && size_seq_len < (int) (sizeof(size_seq) / sizeof(size_seq[0]))) {
+        left = false;
+        for (int i = 0; i < opts.num_sizes; i++) {
+            if (remaining[i] > 0 && size_seq_len < (int) (sizeof(size_seq) / sizeof(size_seq[0]))) {
+                size_seq[size_seq_len++] = opts.sizes[i];
+                left |= --remaining[i] > 0;
+            }
+        }
+    }
+}
+
+static size_t build_frame(uint8_t *frame, uint64_t seq) {
+    int len = size_seq[seq % size_seq_len];
+    uint32_t flow = seq % opts.flows;
+    struct ether_header *eth_hdr = (struct ether_header *) frame;
+    struct iphdr *ip_hdr = (struct iphdr *) (eth_hdr + 1);
+    struct udphdr *udp_hdr = (struct udphdr *) (ip_hdr + 1);
+    pktgen_hdr_t *pg_hdr = (pktgen_hdr_t *) (udp_hdr + 1);
+    size_t ip_len = len - sizeof(struct ether_header);
+    size_t udp_len = ip_len - sizeof(struct iphdr);
+    memcpy(eth_hdr->ether_dhost, &opts.dst_mac, sizeof(struct ether_addr));
+    memcpy(eth_hdr->ether_shost, &config->if_macs[0], sizeof(struct ether_addr));
+    eth_hdr->ether_type = htons(ETHERTYPE_IP);
+    *ip_hdr = (struct iphdr) {
+            .version = 4,
+            .ihl = sizeof(struct iphdr) / 4,
+            .tot_len = htons(ip_len),
+            .id = htons((uint16_t) seq),
+            .ttl = IPDEFTTL,
+            .protocol = IPPROTO_UDP,
+            .saddr = htonl(ntohl(opts.src_ip) + flow / PKTGEN_FLOW_PORTS),
+            .daddr = htonl(ntohl(opts.dst_ip) + (uint32_t) (seq % opts.dst_spread) * opts.dst_stride),
+    };
+    ip_hdr->check = get_cksum16((uint8_t *) ip_hdr, sizeof(struct iphdr));
+    *udp_hdr = (struct udphdr) {
+            .source = htons(PKTGEN_UDP_PORT + 1 + flow % PKTGEN_FLOW_PORTS),
+            .dest = htons(PKTGEN_UDP_PORT),
+            .len = htons(udp_len),
+            .check = 0,
+    };
+    *pg_hdr = (pktgen_hdr_t) {
+            .magic = htonl(PKTGEN_MAGIC),
+            .flow = flow,
+            .seq = seq,
+            .tx_ns = get_realtime_ns(),
+    };
+    return len;
+}
+
+static void run_tx() {
+    build_size_seq();
+    uint8_t frame[PKTGEN_MAX_FRAME];
+    memset(frame, 0, sizeof(frame));
+    uint64_t start = get_clock_ns();
+    uint64_t deadline = opts.duration ? start + (uint64_t) opts.duration * 1000000000 : UINT64_MAX;
+    uint64_t interval = opts.rate ? 1000000000 / opts.rate : 0;
+    uint64_t next_tx = start;
+    uint64_t seq = 0, bytes = 0;
+    while (!stopped && (opts.count == 0 || seq < opts.count)) {
+        uint64_t now = get_clock_ns();
+        if (now >= deadline) {
+            break;
+        }
+        if (interval) {
+            // Absolute schedule, so that a late frame does not slow down the following ones
+            if (now < next_tx) {
+                physical_flush();
+                continue;
+            }
+            next_tx += interval;
+        }
+        size_t len = build_frame(frame, seq);
+        send_packet(frame, len, 0);
+        bytes += len + PKTGEN_FCS_LEN;
+        seq++;
+        if (seq % PKTGEN_TX_BURST == 0) {
+            physical_flush();
+        }
+    }
+    physical_flush();
+    double secs = (double) (get_clock_ns() - start) / 1e9;
+    printf("tx: frames %" PRIu64 ", bytes %" PRIu64 ", seconds %.3f, pps %.0f, mbps %.1f\n",
+           seq, bytes, secs, seq / secs, bytes * 8 / secs / 1e6);
+}
+
+// ===== SINK =====
+static hist_t latency_hist;
+
+static void run_rx() {
+    uint8_t frame[BUFSIZ];
+    uint64_t frames = 0, bytes = 0, reordered = 0, duplicates = 0, ignored = 0;
+    uint64_t max_seq = 0, min_seq = UINT64_MAX;
+    uint64_t first_rx = 0, last_rx = 0;
+    uint64_t deadline = opts.duration ? get_clock_ns() + (uint64_t) opts.duration * 1000000000 : UINT64_MAX;
+    while (!stopped && get_clock_ns() < deadline) {
+        int if_idx;
+        uint64_t rx_ns;
+        size_t len = recv_packet(100, frame, &if_idx, &rx_ns);
+        if (len == 0) {
+            // Generator has stopped
+            if (frames > 0 && get_clock_ns() - last_rx > 1000000000) {
+                break;
+            }
+            continue;
+        }
+        uint64_t now = get_clock_ns();
+        struct ether_header *eth_hdr = (struct ether_header *) frame;
+        struct iphdr *ip_hdr = (struct iphdr *) (eth_hdr + 1);
+        pktgen_hdr_t *pg_hdr = (pktgen_hdr_t *) (frame + PKTGEN_HDR_OFFSET);
+        if (len < PKTGEN_HDR_OFFSET + sizeof(pktgen_hdr_t) || eth_hdr->ether_type != htons(ETHERTYPE_IP) ||
+            ip_hdr->protocol != IPPROTO_UDP || pg_hdr->magic != htonl(PKTGEN_MAGIC)) {
+            ignored++;
+            continue;
+        }
+        if (frames == 0) {
+            first_rx = now;
+        }
+        last_rx = now;
+        frames++;
+        bytes += len + PKTGEN_FCS_LEN;
+        // Sequence numbers are global over all flows, a frame older than the newest one is out of order
+        if (frames > 1 && pg_hdr->seq < max_seq) {
+            reordered++;
+        } else if (frames > 1 && pg_hdr->seq == max_seq) {
+            duplicates++;
+        }
+        if (pg_hdr->seq > max_seq || frames == 1) {
+            max_seq = pg_hdr->seq;
+        }
+        if (pg_hdr->seq < min_seq) {
+            min_seq = pg_hdr->seq;
+        }
+        // Kernel receive timestamp leaves out the sink's own pcap buffering
+        hist_record(&latency_hist, rx_ns > pg_hdr->tx_ns ? rx_ns - pg_hdr->tx_ns : 0);
+    }
+    if (frames == 0) {
+        printf("rx: frames 0, ignored %" PRIu64 "\n", ignored);
+        return;
+    }
+    // Frames before the first received one are not counted as lost, the sink may start late
+    uint64_t expected = max_seq - min_seq + 1;
+    uint64_t lost = expected > frames - duplicates ? expected - (frames - duplicates) : 0;
+    double secs = first_rx == last_rx ? 1 : (double) (last_rx - first_rx) / 1e9;
+    printf("rx: frames %" PRIu64 ", lost %" PRIu64 " (%.3f%%), reordered %" PRIu64 ", duplicates %" PRIu64
+           ", ignored %" PRIu64 "\n", frames, lost, 100.0 * lost / expected, reordered, duplicates, ignored);
+    printf("rx: seconds %.3f, pps %.0f, mbps %.1f\n", secs, frames / secs, bytes * 8 / secs / 1e6);
+    printf("rx: latency us min %.1f, avg %.1f, p50 %.1f, p99 %.1f, p999 %.1f, max %.1f\n",
+           latency_hist.min / 1e3, (double) latency_hist.sum / frames / 1e3, hist_percentile(&latency_hist, 50) / 1e3,
+           hist_percentile(&latency_hist, 99) / 1e3, hist_percentile(&latency_hist, 99.9) / 1e3,
+           latency_hist.max / 1e3);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3 || (strcmp(argv[1], "tx") != 0 && strcmp(argv[1], "rx") != 0)) {
+        usage();
+        return 1;
+    }
+    bool tx = strcmp(argv[1], "tx") == 0;
+    RC rc;
+    rc = pktgen_config_init(argv[2]);
+    if (rc) { return rc; }
+    optind = 3;
+    rc = parse_opts(argc, argv, tx);
+    if (rc) {
+        usage();
+        return rc;
+    }
+    rc = physical_init();
+    if (rc) { return rc; }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    if (tx) {
+        run_tx();
+    } else {
+        run_rx();
+    }
+    return 0;
+}
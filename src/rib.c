@@ -0,0 +1,206 @@
+#include "rib.h"
+#include <stdio.h>
+
+#define RIB_MIN_CAPACITY 256
+
+const char *route_source_names[] = {"C", "S", "R"};
+
+static inline uint32_t prefix_hash(const rib_t *rib, in_addr_t dst_ip, in_addr_t mask) {
+    uint32_t hash = (dst_ip ^ (mask * 0x85ebca6bu)) * 0x9e3779b1u;
+    return (hash ^ (hash >> 16)) & rib->bucket_mask;
+}
+
+RC rib_init(rib_t *rib, int max_prefixes, bool hugepage) {
+    // At least one bucket per prefix, so that chains stay short
+    uint32_t num_buckets = 1;
+    while (num_buckets < (uint32_t) max_prefixes) {
+        num_buckets <<= 1;
+    }
+    size_t buckets_size = num_buckets * sizeof(uint32_t);
+    RC rc = arena_init(&rib->arena, buckets_size + (size_t) max_prefixes * sizeof(rib_prefix_t) + 2 * 64, hugepage);
+    if (rc) { return rc; }
+    // Fresh pages are zero, which is an empty bucket
+    rib->buckets = arena_alloc(&rib->arena, buckets_size);
+    rib->bucket_mask = num_buckets - 1;
+    rib->prefixes = arena_alloc(&rib->arena, 0);
+    rib->size = rib->capacity = rib->num_prefixes = 0;
+    rib->free_head = rib->dirty_head = RIB_NONE;
+    return 0;
+}
+
+int rib_find(const rib_t *rib, in_addr_t dst_ip, in_addr_t mask) {
+    for (int i = (int) rib->buckets[prefix_hash(rib, dst_ip, mask)] - 1; i != RIB_NONE; i = rib->prefixes[i].next) {
+        if (rib->prefixes[i].dst_ip == dst_ip && rib->prefixes[i].mask == mask) {
+            return i;
+        }
+    }
+    return RIB_NONE;
+}
+
+static inline void mark_dirty(rib_t *rib, int idx) {
+    rib_prefix_t *prefix = &rib->prefixes[idx];
+    if (!prefix->dirty) {
+        prefix->dirty = true;
+        prefix->next_dirty = rib->dirty_head;
+        rib->dirty_head = idx;
+    }
+}
+
+static int alloc_prefix(rib_t *rib, in_addr_t dst_ip, in_addr_t mask) {
+    int idx = rib->free_head;
+    if (idx != RIB_NONE) {
+        rib->free_head = rib->prefixes[idx].next;
+    } else {
+        if (rib->size >= rib->capacity && arena_grow(&rib->arena, rib->prefixes, sizeof(rib_prefix_t),
+                                                     &rib->capacity, RIB_MIN_CAPACITY)) {
+            return RIB_NONE;
+        }
+        idx = rib->size++;
+    }
+    uint32_t bucket = prefix_hash(rib, dst_ip, mask);
+    rib->prefixes[idx] = (rib_prefix_t) {
+            .dst_ip = dst_ip,
+            .mask = mask,
+            .next = (int) rib->buckets[bucket] - 1,
+            .in_use = true,
+    };
+    rib->buckets[bucket] = idx + 1;
+    rib->num_prefixes++;
+    return idx;
+}
+
+static void free_prefix(rib_t *rib, int idx) {
+    rib_prefix_t *prefix = &rib->prefixes[idx];
+    uint32_t bucket = prefix_hash(rib, prefix->dst_ip, prefix->mask);
+    if ((int) rib->buckets[bucket] - 1 == idx) {
+        rib->buckets[bucket] = prefix->next + 1;
+    } else {
+        int i = (int) rib->buckets[bucket] - 1;
+        while (rib->prefixes[i].next != idx) {
+            i = rib->prefixes[i].next;
+        }
+        rib->prefixes[i].next = prefix->next;
+    }
+    prefix->in_use = false;
+    prefix->next = rib->free_head;
+    rib->free_head = idx;
+    rib->num_prefixes--;
+}
+
+static inline bool path_better(const rib_path_t *a, const rib_path_t *b) {
+    return a->distance < b->distance || (a->distance == b->distance && a->metric < b->metric);
+}
+
+static inline bool same_path(const rib_path_t *path, route_source_t source, in_addr_t next_hop, int if_idx) {
+    return path->source == source && path->next_hop == next_hop && path->if_idx == if_idx;
+}
+
+const rib_path_t *rib_best(const rib_prefix_t *prefix) {
+    const rib_path_t *best = NULL;
+    for (int i = 0; i < prefix->num_paths; i++) {
+        if (best == NULL || path_better(&prefix->paths[i], best)) {
+            best = &prefix->paths[i];
+        }
+    }
+    return best;
+}
+
+RC rib_add(rib_t *rib, in_addr_t dst_ip, in_addr_t mask, const rib_path_t *path) {
+    dst_ip &= mask;
+    int idx = rib_find(rib, dst_ip, mask);
+    if (idx == RIB_NONE) {
+        idx = alloc_prefix(rib, dst_ip, mask);
+        if (idx == RIB_NONE) {
+            fprintf(stderr, "Route table overflow\n");
+            return OVERFLOW_ERROR;
+        }
+    }
+    rib_prefix_t *prefix = &rib->prefixes[idx];
+    int i;
+    for (i = 0; i < prefix->num_paths; i++) {
+        if (same_path(&prefix->paths[i], path->source, path->next_hop, path->if_idx)) {
+            break;
+        }
+    }
+    if (i == prefix->num_paths) {
+        if (prefix->num_paths < RIB_MAX_PATHS) {
+            prefix->num_paths++;
+        } else {
+            // Replace the worst path, if the new one is better
+            i = 0;
+            for (int j = 1; j < prefix->num_paths; j++) {
+                if (path_better(&prefix->paths[i], &prefix->paths[j])) {
+                    i = j;
+                }
+            }
+            if (!path_better(path, &prefix->paths[i])) {
+                return 0;
+            }
+        }
+    } else if (prefix->paths[i].metric == path->metric && prefix->paths[i].distance == path->distance) {
+        // Periodic updates repeat unchanged paths, they must not cost a commit
+        return 0;
+    }
+    prefix->paths[i] = *path;
+    mark_dirty(rib, idx);
+    return 0;
+}
+
+static void del_path(rib_t *rib, int idx, int path_idx) {
+    rib_prefix_t *prefix = &rib->prefixes[idx];
+    prefix->paths[path_idx] = prefix->paths[--prefix->num_paths];
+    mark_dirty(rib, idx);
+}
+
+bool rib_del(rib_t *rib, in_addr_t dst_ip, in_addr_t mask, route_source_t source, in_addr_t next_hop, int if_idx) {
+    int idx = rib_find(rib, dst_ip & mask, mask);
+    if (idx == RIB_NONE) {
+        return false;
+    }
+    rib_prefix_t *prefix = &rib->prefixes[idx];
+    for (int i = 0; i < prefix->num_paths; i++) {
+        if (same_path(&prefix->paths[i], source, next_hop, if_idx)) {
+            del_path(rib, idx, i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void rib_del_via(rib_t *rib, int if_idx) {
+    for (int idx = 0; idx < rib->size; idx++) {
+        rib_prefix_t *prefix = &rib->prefixes[idx];
+        for (int i = prefix->in_use ? prefix->num_paths - 1 : -1; i >= 0; i--) {
+            if (prefix->paths[i].if_idx == if_idx) {
+                del_path(rib, idx, i);
+            }
+        }
+    }
+}
+
+void rib_del_from(rib_t *rib, route_source_t source) {
+    for (int idx = 0; idx < rib->size; idx++) {
+        rib_prefix_t *prefix = &rib->prefixes[idx];
+        for (int i = prefix->in_use ? prefix->num_paths - 1 : -1; i >= 0; i--) {
+            if (prefix->paths[i].source == source) {
+                del_path(rib, idx, i);
+            }
+        }
+    }
+}
+
+int rib_commit(rib_t *rib, rib_install_fn install) {
+    int num_committed = 0;
+    while (rib->dirty_head != RIB_NONE) {
+        int idx = rib->dirty_head;
+        rib_prefix_t *prefix = &rib->prefixes[idx];
+        rib->dirty_head = prefix->next_dirty;
+        prefix->dirty = false;
+        install(idx, prefix, rib_best(prefix));
+        if (prefix->num_paths == 0) {
+            free_prefix(rib, idx);
+        }
+        num_committed++;
+    }
+    return num_committed;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "error.h"
+#include "arena.h"
+#include <arpa/inet.h>
+#include <inttypes.h>
+
+// ===== IPv4 RIB =====
+// Routing information base: every candidate path of a prefix, from connected interfaces, static routes and RIP
+// neighbors. Adding or deleting a path only marks its prefix dirty. rib_commit then selects the best path of each
+// dirty prefix, lowest administrative distance first and lowest metric second, and hands it to the FIB. A withdrawn
+// best path is thus replaced by its backup at the next commit, and the FIB is only touched for prefixes that changed.
+typedef enum {
+    ROUTE_CONNECTED = 0,
+    ROUTE_STATIC,
+    ROUTE_RIP,
+} route_source_t;
+
+extern const char *route_source_names[];
+
+// Default administrative distances of the sources
+#define DISTANCE_CONNECTED 0
+#define DISTANCE_STATIC 1
+#define DISTANCE_RIP 120
+
+#define RIB_MAX_PATHS 4     // Candidate paths kept per prefix, a worse path is dropped once they are taken
+#define RIB_NONE (-1)
+
+typedef struct rib_path {
+    in_addr_t next_hop;     // Next hop IP address (0 if direct)
+    int if_idx;
+    uint32_t metric;
+    route_source_t source;
+    uint8_t distance;       // Administrative distance, lower is preferred over any metric
+} rib_path_t;
+
+typedef struct rib_prefix {
+    in_addr_t dst_ip;
+    in_addr_t mask;
+    rib_path_t paths[RIB_MAX_PATHS];
+    int num_paths;          // A prefix without paths is freed at the next commit
+    int next;               // Next prefix of hash bucket, or of free list
+    int next_dirty;
+    bool dirty;
+    bool in_use;
+} rib_prefix_t;
+
+// Prefixes grow in place within their arena and keep their index, which the FIB may use to refer to them
+typedef struct rib {
+    rib_prefix_t *prefixes;
+    int size;               // Prefixes ever used, in use or on the free list
+    int capacity;
+    int free_head;
+    int dirty_head;
+    int num_prefixes;
+    uint32_t *buckets;      // Index + 1 of the first prefix of each bucket, 0 if empty
+    uint32_t bucket_mask;
+    arena_t arena;          // Buckets, then prefixes, which are the last allocation so that they can grow
+} rib_t;
+
+// Called by rib_commit for each changed prefix with its best path, or NULL if the prefix has no path left
+typedef void (*rib_install_fn)(int idx, const rib_prefix_t *prefix, const rib_path_t *best);
+
+RC rib_init(rib_t *rib, int max_prefixes, bool hugepage);
+
+// Add a path to prefix dst_ip / mask, or update its path of the same source, next hop and interface
+RC rib_add(rib_t *rib, in_addr_t dst_ip, in_addr_t mask, const rib_path_t *path);
+
+// Delete the path of source, next hop and interface from prefix dst_ip / mask, return whether there was one
+bool rib_del(rib_t *rib, in_addr_t dst_ip, in_addr_t mask, route_source_t source, in_addr_t next_hop, int if_idx);
+
+// Delete all paths via interface if_idx
+void rib_del_via(rib_t *rib, int if_idx);
+
+// Delete all paths of source
+void rib_del_from(rib_t *rib, route_source_t source);
+
+// Index of prefix dst_ip / mask, RIB_NONE if it is not in the RIB
+int rib_find(const rib_t *rib, in_addr_t dst_ip, in_addr_t mask);
+
+// Best path of prefix, NULL if it has none
+const rib_path_t *rib_best(const rib_prefix_t *prefix);
+
+// Pass the best path of every prefix changed since the last commit to install, return the number of prefixes
+int rib_commit(rib_t *rib, rib_install_fn install);
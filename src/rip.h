@@ -6,6 +6,9 @@
 // UDP port
 #define RIP_UDP_PORT 0x0208
 
+// All RIP routers group 224.0.0.9, in host byte order
+#define RIP_MULTICAST_ADDR 0xe0000009
+
 // Version
 #define RIP_V2 0x02
 
@@ -1,10 +1,23 @@
 #include "ether_layer.h"
+#include "ipv6.h"
 #include "physical_layer.h"
 #include "config.h"
 #include "rip.h"
+#include "checksum.h"
+#include "capture.h"
+#include "arena.h"
+#include "pktbuf.h"
+#include "trace.h"
+#include "graph.h"
+#include "fib.h"
+#include "rib.h"
+#include "ctl.h"
+#include "tunnel.h"
 #include <linux/ip.h>
 #include <linux/icmp.h>
 #include <linux/udp.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -12,19 +25,29 @@
 
 // ===== ROUTE TABLE =====
 typedef struct route_entry {
-    in_addr_t dst_ip;   // Destination IP address
-    in_addr_t mask;     // Prefix mask
-    in_addr_t next_hop; // Next hop IP address (0 if direct)
-    int if_idx;         // Forward port
-    uint32_t metric;    // RIP metric
+    in_addr_t dst_ip;       // Destination IP address
+    in_addr_t mask;         // Prefix mask
+    in_addr_t next_hop;     // Next hop IP address (0 if direct)
+    int if_idx;             // Forward port
+    uint32_t metric;        // RIP metric
+    route_source_t source;  // Source of the best path of the prefix
 } route_entry_t;
 
-#define ROUTE_TABLE_CAPACITY 65536
+#define ROUTE_TABLE_MIN_CAPACITY 256
+
+// Forwarding side of the RIB: entry i is the best path of RIB prefix i, and i its next hop index in the FIB. Grows in
+// place within its arena along with the RIB. Prefixes without a path are tombstones (if_idx -1).
 struct {
-    route_entry_t entries[ROUTE_TABLE_CAPACITY];
+    route_entry_t *entries;
     int size;
+    int capacity;
+    arena_t arena;
+    fib_t fib;
 } route_table;
 
+// All candidate paths of each prefix, only changed through rib_add / rib_del and pushed to the FIB by commit_routes
+static rib_t rib;
+
 static int count_ones(in_addr_t mask) {
     int cnt = 0;
     while (mask) {
@@ -34,81 +57,218 @@ static int count_ones(in_addr_t mask) {
     return cnt;
 }
 
-static route_entry_t *get_route(in_addr_t dst_ip) {
-    route_entry_t *dst_route = NULL;
-    int max_prefix_len = -1;
-    for (int route_idx = 0; route_idx < route_table.size; route_idx++) {
-        route_entry_t *route = &route_table.entries[route_idx];
-        if (route->dst_ip == (dst_ip & route->mask)) {
-            if (max_prefix_len < count_ones(route->mask)) {
-                max_prefix_len = count_ones(route->mask);
-                dst_route = route;
-            }
+static inline bool route_in_use(const route_entry_t *route) {
+    return route->if_idx >= 0;
+}
+
+// Longest route in the FIB covering prefix / len, FIB_NO_ROUTE if there is none. Looks up each shorter prefix in the
+// RIB, so that removing a route does not scan the table.
+static uint32_t covering_route(in_addr_t prefix, int len, int *out_len) {
+    for (int sub_len = len - 1; sub_len >= 0; sub_len--) {
+        in_addr_t mask = sub_len == 0 ? 0 : htonl(~0u << (32 - sub_len));
+        int idx = rib_find(&rib, prefix & mask, mask);
+        if (idx != RIB_NONE && idx < route_table.size && route_in_use(&route_table.entries[idx])) {
+            *out_len = sub_len;
+            return idx;
         }
     }
-    return dst_route;
+    *out_len = 0;
+    return FIB_NO_ROUTE;
 }
 
-static RC insert_route(in_addr_t dst_ip, in_addr_t mask, in_addr_t next_hop, int if_idx, uint32_t metric) {
-    if (route_table.size >= ROUTE_TABLE_CAPACITY) {
-        fprintf(stderr, "Route table overflow\n");
-        return OVERFLOW_ERROR;
+// Install the best path of RIB prefix idx, or remove its route if it has none. Failing over to another path of an
+// installed prefix only rewrites its entry, the FIB keeps pointing to it.
+static void install_route(int idx, const rib_prefix_t *prefix, const rib_path_t *best) {
+    int len = count_ones(prefix->mask);
+    bool installed = idx < route_table.size && route_in_use(&route_table.entries[idx]);
+    if (best == NULL) {
+        if (installed) {
+            int sub_len;
+            uint32_t sub = covering_route(prefix->dst_ip, len, &sub_len);
+            fib_del(&route_table.fib, prefix->dst_ip, len, sub, sub_len);
+            route_table.entries[idx].if_idx = -1;
+            while (route_table.size > 0 && !route_in_use(&route_table.entries[route_table.size - 1])) {
+                route_table.size--;
+            }
+        }
+        return;
     }
-    route_entry_t *entry = &route_table.entries[route_table.size++];
-    *entry = (route_entry_t) {
-            .dst_ip = dst_ip & mask,
-            .mask = mask,
-            .next_hop = next_hop,
-            .if_idx = if_idx,
-            .metric = metric,
+    while (idx >= route_table.size) {
+        if (route_table.size >= route_table.capacity && arena_grow(&route_table.arena, route_table.entries,
+                                                                   sizeof(route_entry_t), &route_table.capacity,
+                                                                   ROUTE_TABLE_MIN_CAPACITY)) {
+            fprintf(stderr, "Route table overflow\n");
+            return;
+        }
+        route_table.entries[route_table.size++].if_idx = -1;
+    }
+    route_entry_t *route = &route_table.entries[idx];
+    *route = (route_entry_t) {
+            .dst_ip = prefix->dst_ip,
+            .mask = prefix->mask,
+            .next_hop = best->next_hop,
+            .if_idx = best->if_idx,
+            .metric = best->metric,
+            .source = best->source,
     };
-    return 0;
+    if (!installed && fib_add(&route_table.fib, prefix->dst_ip, len, idx)) {
+        route->if_idx = -1;
+    }
 }
 
-static inline RC erase_route(int pos) {
-    if (pos >= route_table.size) {
-        fprintf(stderr, "Route table out of range\n");
-        return OUT_OF_RANGE_ERROR;
-    }
-    memmove(&route_table.entries[pos], &route_table.entries[pos + 1],
-            (route_table.size - 1 - pos) * sizeof(route_entry_t));
-    route_table.size--;
-    return 0;
+// Push RIB changes to the FIB in one batch, between packet vectors
+static inline void commit_routes() {
+    rib_commit(&rib, install_route);
+    ip6_commit_routes();
+}
+
+static inline RC add_connected_route(int if_idx) {
+    rib_path_t path = {.if_idx = if_idx, .metric = 1, .source = ROUTE_CONNECTED, .distance = DISTANCE_CONNECTED};
+    return rib_add(&rib, config->if_ips[if_idx], config->if_masks[if_idx], &path);
 }
 
 static void print_route_table() {
-    printf("====================== ROUTE TABLE ======================\n");
-    char separator[] = "+--------------------+-----------------+-------+--------+";
+    printf("=========================== ROUTE TABLE ===========================\n");
+    char separator[] = "+--------------------+-----------------+-------+--------+--------+";
     printf("%s\n", separator);
-    printf("| %18s | %15s | %5s | %6s |\n", "IP / MASK", "NEXT_HOP", "IF", "METRIC");
+    printf("| %18s | %15s | %5s | %6s | %6s |\n", "IP / MASK", "NEXT_HOP", "IF", "METRIC", "SOURCE");
     printf("%s\n", separator);
     for (int i = 0; i < route_table.size; i++) {
         route_entry_t *route = &route_table.entries[i];
+        if (!route_in_use(route)) { continue; }
         char dst_ip[16], next_hop[16];
         strcpy(dst_ip, ip2str(route->dst_ip));
         strcpy(next_hop, ip2str(route->next_hop));
-        printf("| %15s/%2d | %15s | %5s | %6u |\n",
-               dst_ip, count_ones(route->mask), next_hop, if_names[route->if_idx], route->metric);
+        printf("| %15s/%2d | %15s | %5s | %6u | %6s |\n", dst_ip, count_ones(route->mask), next_hop,
+               config->if_names[route->if_idx], route->metric, route_source_names[route->source]);
     }
     printf("%s\n", separator);
 }
 
-// ===== CHECKSUM =====
-static uint16_t get_cksum16(const uint8_t *packet, size_t len) {
-    uint32_t cksum = 0;
-    size_t i;
-    for (i = 0; i < len; i += 2) {
-        cksum += *(uint16_t *) &packet[i];
+static int route_snapshot(void *buf, int offset, int max, int *total) {
+    route_entry_t *entries = buf;
+    int num_entries = 0, in_use = 0;
+    for (int i = 0; i < route_table.size; i++) {
+        if (route_in_use(&route_table.entries[i]) && in_use++ >= offset && num_entries < max) {
+            entries[num_entries++] = route_table.entries[i];
+        }
     }
-    if (i < len) {
-        cksum += packet[i];
+    *total = in_use;
+    return num_entries;
+}
+
+static void route_format(const ctl_snapshot_t *snap, const void *entry, char *line, size_t size) {
+    const route_entry_t *route = entry;
+    char dst_ip[INET_ADDRSTRLEN], next_hop[INET_ADDRSTRLEN], prefix[INET_ADDRSTRLEN + 3];
+    inet_ntop(AF_INET, &route->dst_ip, dst_ip, sizeof(dst_ip));
+    inet_ntop(AF_INET, &route->next_hop, next_hop, sizeof(next_hop));
+    snprintf(prefix, sizeof(prefix), "%s/%d", dst_ip, count_ones(route->mask));
+    snprintf(line, size, "%-18s %-15s %-9s %6u %s", prefix, next_hop, snap->if_names[route->if_idx], route->metric,
+             route_source_names[route->source]);
+}
+
+// Route an address resolves to in the FIB, as forwarding sees it
+static int route_lookup(const char *key, void *buf) {
+    in_addr_t ip;
+    if (inet_pton(AF_INET, key, &ip) != 1) {
+        return CTL_LOOKUP_INVALID;
+    }
+    uint32_t route_idx = fib_lookup(&route_table.fib, ip);
+    if (route_idx == FIB_NO_ROUTE) {
+        return CTL_LOOKUP_NONE;
     }
-    cksum = (cksum >> 16) + (cksum & 0xffff);
-    cksum += (cksum >> 16);
-    return (uint16_t) ~cksum;
+    memcpy(buf, &route_table.entries[route_idx], sizeof(route_entry_t));
+    return 0;
+}
+
+static ctl_table_t route_ctl_table = {
+        .name = "route",
+        .header = "IP / MASK          NEXT_HOP        IF        METRIC SOURCE",
+        .entry_size = sizeof(route_entry_t),
+        .snapshot = route_snapshot,
+        .format = route_format,
+        .lookup = route_lookup,
+};
+
+// Candidate path of a prefix in the RIB, as copied for the control socket
+typedef struct rib_ctl_entry {
+    in_addr_t dst_ip;
+    in_addr_t mask;
+    rib_path_t path;
+    bool best;
+} rib_ctl_entry_t;
+
+static int rib_snapshot(void *buf, int offset, int max, int *total) {
+    rib_ctl_entry_t *entries = buf;
+    int num_entries = 0, in_use = 0;
+    for (int i = 0; i < rib.size; i++) {
+        const rib_prefix_t *prefix = &rib.prefixes[i];
+        if (!prefix->in_use) { continue; }
+        const rib_path_t *best = rib_best(prefix);
+        for (int j = 0; j < prefix->num_paths; j++) {
+            if (in_use++ < offset || num_entries >= max) { continue; }
+            entries[num_entries++] = (rib_ctl_entry_t) {
+                    .dst_ip = prefix->dst_ip,
+                    .mask = prefix->mask,
+                    .path = prefix->paths[j],
+                    .best = &prefix->paths[j] == best,
+            };
+        }
+    }
+    *total = in_use;
+    return num_entries;
+}
+
+static void rib_format(const ctl_snapshot_t *snap, const void *entry, char *line, size_t size) {
+    const rib_ctl_entry_t *rib_entry = entry;
+    char dst_ip[INET_ADDRSTRLEN], next_hop[INET_ADDRSTRLEN], prefix[INET_ADDRSTRLEN + 3];
+    inet_ntop(AF_INET, &rib_entry->dst_ip, dst_ip, sizeof(dst_ip));
+    inet_ntop(AF_INET, &rib_entry->path.next_hop, next_hop, sizeof(next_hop));
+    snprintf(prefix, sizeof(prefix), "%s/%d", dst_ip, count_ones(rib_entry->mask));
+    snprintf(line, size, "%-18s %-15s %-9s %6u %8u %-6s %s", prefix, next_hop, snap->if_names[rib_entry->path.if_idx],
+             rib_entry->path.metric, rib_entry->path.distance, route_source_names[rib_entry->path.source],
+             rib_entry->best ? "*" : "");
 }
 
+static ctl_table_t rib_ctl_table = {
+        .name = "rib",
+        .header = "IP / MASK          NEXT_HOP        IF        METRIC DISTANCE SOURCE BEST",
+        .entry_size = sizeof(rib_ctl_entry_t),
+        .snapshot = rib_snapshot,
+        .format = rib_format,
+};
+
 // ===== IP =====
+// Per packet state passed between IPv4 graph nodes, zeroed by ether-input
+typedef struct ip4_meta {
+    const route_entry_t *route;     // Route of a forwarded packet, valid within one dispatch
+    in_addr_t next_hop;
+    uint8_t icmp_type;              // ICMP error to send back to the source
+    uint8_t icmp_code;
+} ip4_meta_t;
+
+_Static_assert(sizeof(ip4_meta_t) <= sizeof(((pkt_buf_t *) 0)->opaque), "IPv4 metadata does not fit packet buffer");
+
+static inline ip4_meta_t *ip4_meta(pkt_buf_t *pkt) {
+    return (ip4_meta_t *) pkt->opaque;
+}
+
+// Per packet state passed between IPv6 graph nodes
+typedef struct ip6_meta {
+    const route6_entry_t *route;    // Route of a forwarded packet, valid within one dispatch
+} ip6_meta_t;
+
+_Static_assert(sizeof(ip6_meta_t) <= sizeof(((pkt_buf_t *) 0)->opaque), "IPv6 metadata does not fit packet buffer");
+
+static inline ip6_meta_t *ip6_meta(pkt_buf_t *pkt) {
+    return (ip6_meta_t *) pkt->opaque;
+}
+
+static inline void drop_ip_packet(pkt_buf_t *pkt, int if_idx, drop_reason_t reason) {
+    CAPTURE(CAPTURE_DROP, if_idx, rx_eth_header(pkt), pkt->data, pkt->len, reason);
+    pkt_free(pkt);
+}
+
 static inline void set_ip_checksum(uint8_t *ip_packet) {
     struct iphdr *ip_hdr = (struct iphdr *) ip_packet;
     size_t hdr_len = ip_hdr->ihl * 4;
@@ -116,23 +276,13 @@ static inline void set_ip_checksum(uint8_t *ip_packet) {
     ip_hdr->check = get_cksum16(ip_packet, hdr_len);
 }
 
-static void ip_forward(uint8_t *ip_packet, size_t ip_len, const route_entry_t *route) {
-    struct iphdr *ip_hdr = (struct iphdr *) ip_packet;
-    int if_next = route->if_idx;
-    in_addr_t next_hop = route->next_hop;
-    if (next_hop == 0) {
-        // Directly connected
-        next_hop = ip_hdr->daddr;
-    }
-    struct ether_addr next_hop_mac;
-    if (arp_get_mac(next_hop, if_next, &next_hop_mac) == 0) {
-        // Forward this packet to the next hop
-        ip_hdr->ttl--;
-        set_ip_checksum(ip_packet);
-        send_ip_packet(ip_packet, ip_len, if_next, &next_hop_mac);
-    } else {
-        fprintf(stderr, "MAC not found for IP %s\n", ip2str(next_hop));
+static inline bool is_my_ip(in_addr_t ip) {
+    for (int i = 0; i < config->num_if; i++) {
+        if (if_active(i) && config->if_ips[i] == ip) {
+            return true;
+        }
     }
+    return false;
 }
 
 // ===== ICMP =====
@@ -142,33 +292,36 @@ static inline void set_icmp_checksum(const uint8_t *icmp_packet, size_t icmp_len
     icmp_hdr->checksum = get_cksum16(icmp_packet, icmp_len);
 }
 
-static void send_icmp_msg(uint8_t *ip_packet, size_t ip_len, int if_idx, uint8_t icmp_type, uint8_t icmp_code,
-                          const struct ether_addr *dst_mac) {
+// Turn the received IP packet into an ICMP error to its source in place. Return false if it is too short.
+// Turn the IP packet at pkt->data into an ICMP error to its source. mtu is the next hop MTU of Fragmentation Needed.
+static bool make_icmp_msg(pkt_buf_t *pkt, uint8_t icmp_type, uint8_t icmp_code, uint16_t mtu) {
+    uint8_t *ip_packet = pkt->data;
     struct iphdr *ip_hdr = (struct iphdr *) ip_packet;
     size_t ip_hdr_len = ip_hdr->ihl * 4;
     // ICMP payload should be source packet's IP header + first 64 bits of IP payload.
     size_t icmp_body_len = ip_hdr_len + 8;
-    if (ip_len >= icmp_body_len) {
-        // ICMP packet
-        uint8_t *icmp_packet = ip_packet + ip_hdr_len;
-        uint8_t *icmp_body = icmp_packet + sizeof(struct icmphdr);
-        memcpy(icmp_body, ip_packet, icmp_body_len);
-        struct icmphdr *icmp_hdr = (struct icmphdr *) icmp_packet;
-        icmp_hdr->type = icmp_type;
-        icmp_hdr->code = icmp_code;
-        memset(&icmp_hdr->un, 0, sizeof(icmp_hdr->un));
-        size_t icmp_len = icmp_body_len + sizeof(struct icmphdr);
-        set_icmp_checksum(icmp_packet, icmp_len);
-        // IP packet
-        ip_len = ip_hdr_len + icmp_len;
-        ip_hdr->tot_len = htons(ip_len);
-        ip_hdr->daddr = ip_hdr->saddr;
-        ip_hdr->saddr = if_ips[if_idx];
-        ip_hdr->ttl = IPDEFTTL;
-        set_ip_checksum(ip_packet);
-        // Send packet
-        send_ip_packet(ip_packet, ip_len, if_idx, dst_mac);
+    if (pkt->len < icmp_body_len) {
+        return false;
     }
+    // ICMP packet
+    uint8_t *icmp_packet = ip_packet + ip_hdr_len;
+    uint8_t *icmp_body = icmp_packet + sizeof(struct icmphdr);
+    memcpy(icmp_body, ip_packet, icmp_body_len);
+    struct icmphdr *icmp_hdr = (struct icmphdr *) icmp_packet;
+    icmp_hdr->type = icmp_type;
+    icmp_hdr->code = icmp_code;
+    memset(&icmp_hdr->un, 0, sizeof(icmp_hdr->un));
+    icmp_hdr->un.frag.mtu = htons(mtu);
+    size_t icmp_len = icmp_body_len + sizeof(struct icmphdr);
+    set_icmp_checksum(icmp_packet, icmp_len);
+    // IP packet
+    pkt->len = ip_hdr_len + icmp_len;
+    ip_hdr->tot_len = htons(pkt->len);
+    ip_hdr->daddr = ip_hdr->saddr;
+    ip_hdr->saddr = config->if_ips[pkt->if_idx];
+    ip_hdr->ttl = IPDEFTTL;
+    set_ip_checksum(ip_packet);
+    return true;
 }
 
 // ===== RIP =====
@@ -177,8 +330,46 @@ static in_addr_t RIP_MULTICAST_IP;
 static struct ether_addr RIP_MULTICAST_MAC;
 static const int RIP_UPDATE_TIME = 5000;   // send RIP response every 5 seconds
 
+// Send the first num_entries RIP entries of the response being built in ip_packet
+static void send_rip_fragment(uint8_t *ip_packet, size_t num_entries, int if_idx) {
+    struct iphdr *ip_hdr = (struct iphdr *) ip_packet;
+    struct udphdr *udp_hdr = (struct udphdr *) (ip_hdr + 1);
+    size_t rip_len = sizeof(rip_hdr_t) + num_entries * sizeof(rip_entry_t);
+
+    // UDP packet
+    size_t udp_len = sizeof(struct udphdr) + rip_len;
+    *udp_hdr = (struct udphdr) {
+            .source = htons(RIP_UDP_PORT),
+            .dest = htons(RIP_UDP_PORT),
+            .len = htons(udp_len),
+            .check = 0, // TODO: UDP checksum
+    };
+    // IP packet
+    size_t ip_len = sizeof(struct iphdr) + udp_len;
+    *ip_hdr = (struct iphdr) {
+            .version = 4,
+            .ihl = sizeof(struct iphdr) / 4,
+            .tos = IPTOS_PREC_INTERNETCONTROL,
+            .tot_len = htons(ip_len),
+            .id = (uint16_t) rand(),
+            .frag_off = 0,
+            .ttl = 1,
+            .protocol = IPPROTO_UDP,
+            .check = 0,
+            .saddr = config->if_ips[if_idx],
+            .daddr = RIP_MULTICAST_IP,
+    };
+    set_ip_checksum((uint8_t *) ip_hdr);
+    send_ip_packet(ip_packet, ip_len, if_idx, &RIP_MULTICAST_MAC);
+}
+
 static void send_rip_response(int if_idx) {
-    uint8_t ip_packet[BUFSIZ];
+    pkt_buf_t *pkt = pkt_alloc();
+    if (pkt == NULL) {
+        fprintf(stderr, "Cannot allocate packet buffer for RIP response\n");
+        return;
+    }
+    uint8_t *ip_packet = pkt->data;
     struct iphdr *ip_hdr = (struct iphdr *) ip_packet;
     struct udphdr *udp_hdr = (struct udphdr *) (ip_hdr + 1);
     rip_hdr_t *rip_hdr = (rip_hdr_t *) (udp_hdr + 1);
@@ -194,6 +385,7 @@ static void send_rip_response(int if_idx) {
     size_t rip_resp_num = 0;
     for (int i = 0; i < route_table.size; i++) {
         route_entry_t *route = &route_table.entries[i];
+        if (!route_in_use(route)) { continue; }
         uint32_t metric;
         if (route->if_idx == if_idx) {
             // RFC 2453 3.4.3 Split horizon with poisoned reverse
@@ -210,40 +402,16 @@ static void send_rip_response(int if_idx) {
                 .metric = metric
         };
         rip_resp_num++;
-        if (rip_resp_num == RIP_MAX_ENTRIES || i == route_table.size - 1) {
-            // Need to send this route table fragment
-            size_t rip_len = sizeof(rip_hdr_t) + rip_resp_num * sizeof(rip_entry_t);
-
-            // UDP packet
-            size_t udp_len = sizeof(struct udphdr) + rip_len;
-            *udp_hdr = (struct udphdr) {
-                    .source = htons(RIP_UDP_PORT),
-                    .dest = htons(RIP_UDP_PORT),
-                    .len = htons(udp_len),
-                    .check = 0, // TODO: UDP checksum
-            };
-            // IP packet
-            size_t ip_len = sizeof(struct iphdr) + udp_len;
-            *ip_hdr = (struct iphdr) {
-                    .version = 4,
-                    .ihl = sizeof(struct iphdr) / 4,
-                    .tos = IPTOS_PREC_INTERNETCONTROL,
-                    .tot_len = htons(ip_len),
-                    .id = (uint16_t) rand(),
-                    .frag_off = 0,
-                    .ttl = 1,
-                    .protocol = IPPROTO_UDP,
-                    .check = 0,
-                    .saddr = if_ips[if_idx],
-                    .daddr = RIP_MULTICAST_IP,
-            };
-            set_ip_checksum((uint8_t *) ip_hdr);
-            // Send RIP response
-            send_ip_packet(ip_packet, ip_len, if_idx, &RIP_MULTICAST_MAC);
-            // clear RIP entries
+        if (rip_resp_num == RIP_MAX_ENTRIES) {
+            send_rip_fragment(ip_packet, rip_resp_num, if_idx);
             rip_resp_num = 0;
         }
     }
+    // Remaining entries, whatever entry of the table was the last one in use
+    if (rip_resp_num > 0) {
+        send_rip_fragment(ip_packet, rip_resp_num, if_idx);
+    }
+    pkt_free(pkt);
 }
 
 static void handle_udp_packet(uint8_t *ip_packet, size_t ip_len, int if_idx) {
@@ -268,52 +436,33 @@ static void handle_udp_packet(uint8_t *ip_packet, size_t ip_len, int if_idx) {
         int rip_num_entries = (int) (rip_entry_len / sizeof(rip_entry_t));
         if (rip_hdr->command == RIP_CMD_REQUEST) {
             // Handle RIP request
-            printf("Received RIP request from %s via %s\n", ip2str(if_ips[if_idx]), if_names[if_idx]);
+            printf("Received RIP request from %s via %s\n", ip2str(config->if_ips[if_idx]), config->if_names[if_idx]);
             if (rip_num_entries == 1 && rip_entries[0].tag == htons(RIP_AF_UNSPECIFIED) &&
                 rip_entries[0].metric == htonl(RIP_METRIC_INF)) {
                 // RFC 2453 3.9.1: special case: send the entire route table
-                printf("Sending RIP response on request via %s\n", if_names[if_idx]);
+                printf("Sending RIP response on request via %s\n", config->if_names[if_idx]);
                 send_rip_response(if_idx);
             } else {
                 fprintf(stderr, "RIP request of specific entries is not yet implemented\n");
             }
         } else if (rip_hdr->command == RIP_CMD_RESPONSE) {
             // Handle RIP response
-            printf("Received RIP response from %s via %s\n", ip2str(if_ips[if_idx]), if_names[if_idx]);
+            printf("Received RIP response from %s via %s\n", ip2str(config->if_ips[if_idx]), config->if_names[if_idx]);
             for (int rip_i = 0; rip_i < rip_num_entries; rip_i++) {
                 rip_entry_t *rip_entry = &rip_entries[rip_i];
                 if (rip_entry->next_hop != 0) {
                     printf("Next hop %s is not yet supported\n", ip2str(rip_entry->next_hop));
                     continue;
                 }
-                // Find route in route table according to this RIP entry. Exact matching.
-                int route_i;
-                route_entry_t *route = NULL;
-                for (route_i = 0; route_i < route_table.size; route_i++) {
-                    route = &route_table.entries[route_i];
-                    if (route->dst_ip == rip_entry->ip && route->mask == rip_entry->mask) {
-                        break;
-                    }
-                }
-                if (route_i != route_table.size) {
-                    // Route found, update route according to RIP entry
-                    if (rip_entry->metric == htonl(RIP_METRIC_INF)) {
-                        // Network is unreachable from source IP
-                        if (route->next_hop == ip_hdr->saddr) {
-                            erase_route(route_i);
-                        }
-                    } else if (ntohl(rip_entry->metric) + 1 < route->metric) {
-                        // Metric is smaller from this next hop. Update this route.
-                        route->next_hop = ip_hdr->saddr;
-                        route->if_idx = if_idx;
-                        route->metric = ntohl(rip_entry->metric) + 1;
-                    }
+                uint32_t metric = ntohl(rip_entry->metric);
+                if (metric >= RIP_METRIC_INF - 1) {
+                    // Network is unreachable from source IP, another path of the prefix takes over on commit
+                    rib_del(&rib, rip_entry->ip, rip_entry->mask, ROUTE_RIP, ip_hdr->saddr, if_idx);
                 } else {
-                    // Route not found, insert a new route
-                    if (ntohl(rip_entry->metric) < RIP_METRIC_INF) {
-                        insert_route(rip_entry->ip, rip_entry->mask, ip_hdr->saddr, if_idx,
-                                     ntohl(rip_entry->metric) + 1);
-                    }
+                    // Every neighbor's path is kept as a backup, the best one is selected on commit
+                    rib_path_t path = {.next_hop = ip_hdr->saddr, .if_idx = if_idx, .metric = metric + 1,
+                                       .source = ROUTE_RIP, .distance = DISTANCE_RIP};
+                    rib_add(&rib, rip_entry->ip, rip_entry->mask, &path);
                 }
             }
         } else {
@@ -324,12 +473,511 @@ static void handle_udp_packet(uint8_t *ip_packet, size_t ip_len, int if_idx) {
     }
 }
 
+static RC insert_static_routes() {
+    for (int i = 0; i < config->num_static_routes; i++) {
+        static_route_t *route = &config->static_routes[i];
+        rib_path_t path = {.next_hop = route->next_hop, .if_idx = route->if_idx, .metric = 1,
+                           .source = ROUTE_STATIC, .distance = route->distance};
+        RC rc = rib_add(&rib, route->dst_ip, route->mask, &path);
+        if (rc) { return rc; }
+    }
+    return 0;
+}
+
+// ===== TUNNEL =====
+// Tunnel state by interface index, type TUNNEL_NONE for device interfaces
+static tunnel_t tunnels[MAX_IF];
+
+static inline bool is_tunnel_packet(const pkt_buf_t *pkt) {
+    const struct iphdr *ip_hdr = (const struct iphdr *) pkt->data;
+    size_t ip_hdr_len = ip_hdr->ihl * 4;
+    if (ip_hdr->protocol == GRE_PROTO) {
+        return true;
+    }
+    return ip_hdr->protocol == IPPROTO_UDP && pkt->len >= ip_hdr_len + sizeof(struct udphdr) &&
+           ((const struct udphdr *) (pkt->data + ip_hdr_len))->dest == htons(VXLAN_PORT);
+}
+
+// Underlay interface and next hop MAC address of the far end of a tunnel, DROP_NONE if resolved
+static drop_reason_t resolve_underlay(const tunnel_t *tunnel, int *out_if_idx, struct ether_addr *out_mac) {
+    uint32_t route_idx = fib_lookup(&route_table.fib, tunnel->remote);
+    if (route_idx == FIB_NO_ROUTE || if_is_tunnel(route_table.entries[route_idx].if_idx)) {
+        // Tunnels are not nested
+        return DROP_NO_ROUTE;
+    }
+    const route_entry_t *route = &route_table.entries[route_idx];
+    in_addr_t next_hop = route->next_hop ? route->next_hop : tunnel->remote;
+    if (arp_get_mac(next_hop, route->if_idx, out_mac)) {
+        return DROP_NO_NEIGHBOR;
+    }
+    *out_if_idx = route->if_idx;
+    return DROP_NONE;
+}
+
+// Encapsulate a frame the router sent on a tunnel interface outside of the graph, e.g. an ARP reply or RIP response
+static void tunnel_output(pkt_buf_t *pkt) {
+    int if_idx = pkt->tx_if_idx, underlay_if;
+    struct ether_addr underlay_mac;
+    drop_reason_t reason = resolve_underlay(&tunnels[if_idx], &underlay_if, &underlay_mac);
+    if (reason != DROP_NONE) {
+        fprintf(stderr, "Cannot send via tunnel %s: %s\n", config->if_names[if_idx], drop_reason_names[reason]);
+        return;
+    }
+    tunnel_encap(&tunnels[if_idx], pkt);
+    ether_push_header(pkt, underlay_if, &underlay_mac, ETHERTYPE_IP);
+    send_packet(pkt->data, pkt->len, pkt->tx_if_idx);
+}
+
+static void print_tunnel_stats() {
+    bool configured = false;
+    for (int i = 0; i < config->num_if; i++) {
+        configured |= if_active(i) && if_is_tunnel(i);
+    }
+    if (!configured) {
+        return;
+    }
+    printf("============================= TUNNELS =============================\n");
+    char separator[] = "+-----------+-------+-----------------+------------+------------+";
+    printf("%s\n", separator);
+    printf("| %9s | %5s | %15s | %10s | %10s |\n", "IF", "TYPE", "REMOTE", "ENCAP", "DECAP");
+    printf("%s\n", separator);
+    for (int i = 0; i < config->num_if; i++) {
+        if (!if_active(i) || !if_is_tunnel(i)) { continue; }
+        tunnel_t *tunnel = &tunnels[i];
+        printf("| %9s | %5s | %15s | %10" PRIu64 " | %10" PRIu64 " |\n", config->if_names[i],
+               tunnel_type_names[tunnel->type], ip2str(tunnel->remote), tunnel->encap_packets, tunnel->decap_packets);
+    }
+    printf("%s\n", separator);
+}
+
+// ===== GRAPH NODES =====
+// Nodes in dispatch order: a node comes after all nodes that feed it. Features (ACL, NAT, tunnels) are added as new
+// nodes between existing ones, the forwarding loop only feeds ether-input.
+typedef enum {
+    NODE_ETHER_INPUT = 0,
+    NODE_ARP,
+    NODE_IP6_INPUT,
+    NODE_IP6_LOCAL,
+    NODE_IP4_INPUT,
+    NODE_IP4_LOCAL,
+    NODE_TUNNEL_DECAP,
+    NODE_RIP,
+    NODE_IP4_LOOKUP,
+    NODE_ICMP_ERROR,
+    NODE_IP4_REWRITE,
+    NODE_IP6_LOOKUP,
+    NODE_IP6_REWRITE,
+    NODE_INTERFACE_OUTPUT,
+    NODE_TUNNEL_ENCAP,
+    NUM_NODES,
+} node_id_t;
+
+// Dispatch by ether type, the ethernet header stays in the headroom
+static void ether_input_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        memset(pkt->opaque, 0, sizeof(pkt->opaque));
+        // Frame length and dst mac address are already checked by classifier
+        uint16_t ether_type = ntohs(((struct ether_header *) pkt->data)->ether_type);
+        pkt_pull(pkt, sizeof(struct ether_header));
+        if (ether_type == ETHERTYPE_IP) {
+            graph_enqueue(NODE_IP4_INPUT, pkt);
+        } else if (ether_type == ETHERTYPE_IPV6) {
+            graph_enqueue(NODE_IP6_INPUT, pkt);
+        } else if (ether_type == ETHERTYPE_ARP) {
+            graph_enqueue(NODE_ARP, pkt);
+        } else {
+            fprintf(stderr, "Unsupported ethernet type: %04x\n", ether_type);
+            pkt_free(pkt);
+        }
+    }
+}
+
+static void arp_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        arp_input(pkts[i]);
+        pkt_free(pkts[i]);
+    }
+}
+
+// Validate header, then split packets to the router from packets to forward. Link-local packets are never forwarded.
+static void ip6_input_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        if (!ip6_validate(pkt)) {
+            drop_ip_packet(pkt, pkt->if_idx, DROP_INVALID);
+            continue;
+        }
+        const struct ip6_hdr *ip6_hdr = (const struct ip6_hdr *) pkt->data;
+        if (ip6_is_local(&ip6_hdr->ip6_dst)) {
+            graph_enqueue(NODE_IP6_LOCAL, pkt);
+        } else if (IN6_IS_ADDR_LINKLOCAL(&ip6_hdr->ip6_src) || IN6_IS_ADDR_LINKLOCAL(&ip6_hdr->ip6_dst)) {
+            drop_ip_packet(pkt, pkt->if_idx, DROP_INVALID);
+        } else {
+            graph_enqueue(NODE_IP6_LOOKUP, pkt);
+        }
+    }
+}
+
+// Packets to the router or to a multicast group: NDP and ICMPv6 echo
+static void ip6_local_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        ip6_local_input(pkts[i]);
+        pkt_free(pkts[i]);
+    }
+}
+
+// Validate header and checksum, then split packets to the router from packets to forward
+static void ip4_input_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        uint8_t *ip_packet = pkt->data;
+        size_t ip_len = pkt->len;
+        struct iphdr *ip_hdr = (struct iphdr *) ip_packet;
+        size_t ip_hdr_len = ip_hdr->ihl * 4;
+        if (ip_len < sizeof(struct iphdr) || htons(ip_len) != ip_hdr->tot_len || ip_hdr->ihl < 5 ||
+            ip_len < ip_hdr_len) {
+            drop_ip_packet(pkt, pkt->if_idx, DROP_INVALID);
+            continue;
+        }
+        // validate checksum
+        uint16_t org_cksum = ip_hdr->check;
+        set_ip_checksum(ip_packet);
+        if (org_cksum != ip_hdr->check) {
+            fprintf(stderr, "Incorrect IP checksum, expected %04x, got %04x\n", ip_hdr->check, org_cksum);
+            ip_hdr->check = org_cksum;
+            drop_ip_packet(pkt, pkt->if_idx, DROP_BAD_CHECKSUM);
+            continue;
+        }
+        if (IN_MULTICAST(ntohl(ip_hdr->daddr)) || is_my_ip(ip_hdr->daddr)) {
+            graph_enqueue(NODE_IP4_LOCAL, pkt);
+        } else {
+            graph_enqueue(NODE_IP4_LOOKUP, pkt);
+        }
+    }
+}
+
+// Packets to the router or to a multicast group: RIP and ICMP echo
+static void ip4_local_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        uint8_t *ip_packet = pkt->data;
+        struct iphdr *ip_hdr = (struct iphdr *) ip_packet;
+        size_t ip_hdr_len = ip_hdr->ihl * 4;
+        if (IN_MULTICAST(ntohl(ip_hdr->daddr)) && ip_hdr->daddr != RIP_MULTICAST_IP) {
+            // Not a group we joined
+            pkt_free(pkt);
+        } else if (!IN_MULTICAST(ntohl(ip_hdr->daddr)) && is_tunnel_packet(pkt)) {
+            graph_enqueue(NODE_TUNNEL_DECAP, pkt);
+        } else if (ip_hdr->protocol == IPPROTO_UDP) {
+            graph_enqueue(NODE_RIP, pkt);
+        } else if (ip_hdr->protocol == IPPROTO_ICMP && !IN_MULTICAST(ntohl(ip_hdr->daddr))) {
+            // Get ICMP echo (request)
+            uint8_t *icmp_packet = ip_packet + ip_hdr_len;
+            size_t icmp_len = pkt->len - ip_hdr_len;
+            struct icmphdr *icmp_hdr = (struct icmphdr *) icmp_packet;
+            if (icmp_hdr->type == ICMP_ECHO) {
+                printf("Sending ICMP reply to %s via %s\n", ip2str(ip_hdr->saddr), config->if_names[pkt->if_idx]);
+                // Init ICMP packet
+                icmp_hdr->type = ICMP_ECHOREPLY;
+                set_icmp_checksum(icmp_packet, icmp_len);
+                // Init IP packet
+                SWAP(ip_hdr->saddr, ip_hdr->daddr);
+                ip_hdr->ttl = IPDEFTTL;
+                set_ip_checksum(ip_packet);
+                ether_push_header(pkt, pkt->if_idx, (struct ether_addr *) rx_eth_header(pkt)->ether_shost,
+                                  ETHERTYPE_IP);
+                graph_enqueue(NODE_INTERFACE_OUTPUT, pkt);
+            } else {
+                fprintf(stderr, "Unsupported ICMP type %02x\n", icmp_hdr->type);
+                drop_ip_packet(pkt, pkt->if_idx, DROP_UNSUPPORTED);
+            }
+        } else {
+            fprintf(stderr, "Unsupported IP protocol %02x\n", ip_hdr->protocol);
+            drop_ip_packet(pkt, pkt->if_idx, DROP_UNSUPPORTED);
+        }
+    }
+}
+
+// Strip outer headers and feed the inner frame back to ether-input, as received on the tunnel interface
+static void tunnel_decap_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        int if_idx = tunnel_decap(tunnels, config->num_if, pkt);
+        if (if_idx < 0) {
+            drop_ip_packet(pkt, pkt->if_idx, DROP_INVALID);
+            continue;
+        }
+        pkt->if_idx = if_idx;
+        graph_enqueue(NODE_ETHER_INPUT, pkt);
+    }
+}
+
+static void rip_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        handle_udp_packet(pkts[i]->data, pkts[i]->len, pkts[i]->if_idx);
+        pkt_free(pkts[i]);
+    }
+}
+
+static inline void send_icmp_error(pkt_buf_t *pkt, uint8_t icmp_type, uint8_t icmp_code, drop_reason_t reason) {
+    CAPTURE(CAPTURE_DROP, pkt->if_idx, rx_eth_header(pkt), pkt->data, pkt->len, reason);
+    ip4_meta(pkt)->icmp_type = icmp_type;
+    ip4_meta(pkt)->icmp_code = icmp_code;
+    graph_enqueue(NODE_ICMP_ERROR, pkt);
+}
+
+// Look up the whole vector at once, so that the FIB cache misses of its packets overlap
+static void ip4_lookup_node(pkt_buf_t **pkts, int num_pkts) {
+    if (num_pkts <= 0) {
+        return;
+    }
+    in_addr_t daddrs[GRAPH_VECTOR_SIZE];
+    uint32_t route_idxs[GRAPH_VECTOR_SIZE];
+    // Vectors are never larger than GRAPH_VECTOR_SIZE, the bound lets the compiler see daddrs is filled
+    if (num_pkts > GRAPH_VECTOR_SIZE) {
+        num_pkts = GRAPH_VECTOR_SIZE;
+    }
+    for (int i = 0; i < num_pkts; i++) {
+        daddrs[i] = ((struct iphdr *) pkts[i]->data)->daddr;
+    }
+    fib_lookup_burst(&route_table.fib, daddrs, num_pkts, route_idxs);
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        struct iphdr *ip_hdr = (struct iphdr *) pkt->data;
+        route_entry_t *route = route_idxs[i] == FIB_NO_ROUTE ? NULL : &route_table.entries[route_idxs[i]];
+        if (route == NULL) {
+            fprintf(stderr, "No route to host %s. Sending ICMP Destination Unreachable Message\n",
+                    ip2str(ip_hdr->daddr));
+            send_icmp_error(pkt, ICMP_DEST_UNREACH, ICMP_NET_UNREACH, DROP_NO_ROUTE);
+        } else if (ip_hdr->ttl <= 1) {
+            fprintf(stderr, "Zero TTL. Sending ICMP Time Exceeded Message\n");
+            send_icmp_error(pkt, ICMP_TIME_EXCEEDED, ICMP_EXC_TTL, DROP_TTL_EXCEEDED);
+        } else {
+            ip4_meta(pkt)->route = route;
+            graph_enqueue(NODE_IP4_REWRITE, pkt);
+        }
+    }
+}
+
+static void icmp_error_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        if (!make_icmp_msg(pkt, ip4_meta(pkt)->icmp_type, ip4_meta(pkt)->icmp_code, 0)) {
+            pkt_free(pkt);
+            continue;
+        }
+        ether_push_header(pkt, pkt->if_idx, (struct ether_addr *) rx_eth_header(pkt)->ether_shost, ETHERTYPE_IP);
+        graph_enqueue(NODE_INTERFACE_OUTPUT, pkt);
+    }
+}
+
+// Resolve next hop MAC address, decrement TTL and push ethernet header
+static void ip4_rewrite_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        ip4_meta_t *meta = ip4_meta(pkt);
+        struct iphdr *ip_hdr = (struct iphdr *) pkt->data;
+        int if_next = meta->route->if_idx;
+        in_addr_t next_hop = meta->route->next_hop;
+        if (next_hop == 0) {
+            // Directly connected
+            next_hop = ip_hdr->daddr;
+        }
+        struct ether_addr next_hop_mac;
+        if (if_is_tunnel(if_next)) {
+            // Point to point, the inner frame goes to the far end of the tunnel
+            next_hop_mac = tunnels[if_next].remote_mac;
+        } else if (arp_get_mac(next_hop, if_next, &next_hop_mac)) {
+            fprintf(stderr, "MAC not found for IP %s\n", ip2str(next_hop));
+            drop_ip_packet(pkt, if_next, DROP_NO_NEIGHBOR);
+            continue;
+        }
+        ip_hdr->ttl--;
+        set_ip_checksum(pkt->data);
+        meta->next_hop = next_hop;
+        ether_push_header(pkt, if_next, &next_hop_mac, ETHERTYPE_IP);
+        graph_enqueue(NODE_INTERFACE_OUTPUT, pkt);
+    }
+}
+
+static inline void send_icmp6_error_and_drop(pkt_buf_t *pkt, uint8_t icmp6_type, uint8_t icmp6_code,
+                                             drop_reason_t reason) {
+    send_icmp6_error(pkt->data, pkt->len, pkt->if_idx, icmp6_type, icmp6_code,
+                     (const struct ether_addr *) rx_eth_header(pkt)->ether_shost);
+    drop_ip_packet(pkt, pkt->if_idx, reason);
+}
+
+// Look up the whole vector at once, as ip4-lookup does
+static void ip6_lookup_node(pkt_buf_t **pkts, int num_pkts) {
+    if (num_pkts <= 0) {
+        return;
+    }
+    struct in6_addr daddrs[GRAPH_VECTOR_SIZE];
+    const route6_entry_t *routes[GRAPH_VECTOR_SIZE];
+    if (num_pkts > GRAPH_VECTOR_SIZE) {
+        num_pkts = GRAPH_VECTOR_SIZE;
+    }
+    for (int i = 0; i < num_pkts; i++) {
+        daddrs[i] = ((struct ip6_hdr *) pkts[i]->data)->ip6_dst;
+    }
+    route6_lookup_burst(daddrs, num_pkts, routes);
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        if (routes[i] == NULL) {
+            fprintf(stderr, "No route to host %s. Sending ICMPv6 Destination Unreachable Message\n",
+                    ip62str(&daddrs[i]));
+            send_icmp6_error_and_drop(pkt, ICMP6_DST_UNREACH, ICMP6_DST_UNREACH_NOROUTE, DROP_NO_ROUTE);
+        } else if (((struct ip6_hdr *) pkt->data)->ip6_hlim <= 1) {
+            fprintf(stderr, "Zero hop limit. Sending ICMPv6 Time Exceeded Message\n");
+            send_icmp6_error_and_drop(pkt, ICMP6_TIME_EXCEEDED, ICMP6_TIME_EXCEED_TRANSIT, DROP_TTL_EXCEEDED);
+        } else {
+            ip6_meta(pkt)->route = routes[i];
+            graph_enqueue(NODE_IP6_REWRITE, pkt);
+        }
+    }
+}
+
+// Resolve next hop MAC address, decrement hop limit and push ethernet header. IPv6 header has no checksum.
+static void ip6_rewrite_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        const route6_entry_t *route = ip6_meta(pkt)->route;
+        struct ip6_hdr *ip6_hdr = (struct ip6_hdr *) pkt->data;
+        int if_next = route->if_idx;
+        const struct in6_addr *next_hop = &route->next_hop;
+        if (IN6_IS_ADDR_UNSPECIFIED(next_hop)) {
+            // Directly connected
+            next_hop = &ip6_hdr->ip6_dst;
+        }
+        struct ether_addr next_hop_mac;
+        if (if_is_tunnel(if_next)) {
+            next_hop_mac = tunnels[if_next].remote_mac;
+        } else if (nd_get_mac(next_hop, if_next, &next_hop_mac)) {
+            fprintf(stderr, "MAC not found for IPv6 %s\n", ip62str(next_hop));
+            drop_ip_packet(pkt, if_next, DROP_NO_NEIGHBOR);
+            continue;
+        }
+        ip6_hdr->ip6_hlim--;
+        ether_push_header(pkt, if_next, &next_hop_mac, ETHERTYPE_IPV6);
+        graph_enqueue(NODE_INTERFACE_OUTPUT, pkt);
+    }
+}
+
+static void interface_output_node(pkt_buf_t **pkts, int num_pkts) {
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        if (if_is_tunnel(pkt->tx_if_idx)) {
+            graph_enqueue(NODE_TUNNEL_ENCAP, pkt);
+            continue;
+        }
+        // Capture records the route of IPv4 packets, the metadata of IPv6 packets is laid out differently
+        const ip4_meta_t *meta = ip4_meta(pkt);
+        if (((struct ether_header *) pkt->data)->ether_type == htons(ETHERTYPE_IP) && meta->route != NULL) {
+            capture_set_route(meta->route->dst_ip, meta->route->mask, meta->next_hop, pkt->tx_if_idx);
+        }
+        send_packet(pkt->data, pkt->len, pkt->tx_if_idx);
+        pkt_free(pkt);
+    }
+}
+
+// Tunnels do not fragment: tell the source of the inner packet the MTU left for it. The error is routed like a
+// forwarded packet, as the received ethernet header was overwritten by the inner one.
+static void tunnel_too_big(pkt_buf_t *pkt, int if_idx, int mtu) {
+    fprintf(stderr, "Packet of %zu bytes too big for tunnel %s, MTU %d\n", pkt->len - sizeof(struct ether_header),
+            config->if_names[if_idx], mtu);
+    CAPTURE(CAPTURE_DROP, if_idx, NULL, pkt->data, pkt->len, DROP_TOO_BIG);
+    uint16_t ether_type = ((struct ether_header *) pkt->data)->ether_type;
+    pkt_pull(pkt, sizeof(struct ether_header));
+    if (ether_type == htons(ETHERTYPE_IP) && (((struct iphdr *) pkt->data)->frag_off & htons(IP_FLAG_DF)) &&
+        make_icmp_msg(pkt, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, mtu)) {
+        memset(ip4_meta(pkt), 0, sizeof(ip4_meta_t));
+        graph_enqueue(NODE_IP4_LOOKUP, pkt);
+    } else if (ether_type == htons(ETHERTYPE_IPV6) && make_icmp6_error(pkt, ICMP6_PACKET_TOO_BIG, 0, mtu)) {
+        graph_enqueue(NODE_IP6_LOOKUP, pkt);
+    } else {
+        pkt_free(pkt);
+    }
+}
+
+// Push outer headers from the tunnel template into the headroom and send over the underlay. The far end of each
+// tunnel is resolved once per vector.
+static void tunnel_encap_node(pkt_buf_t **pkts, int num_pkts) {
+    bool resolved[MAX_IF] = {false};
+    drop_reason_t reasons[MAX_IF];
+    int underlay_ifs[MAX_IF];
+    struct ether_addr underlay_macs[MAX_IF];
+    for (int i = 0; i < num_pkts; i++) {
+        pkt_buf_t *pkt = pkts[i];
+        int if_idx = pkt->tx_if_idx;
+        if (!resolved[if_idx]) {
+            reasons[if_idx] = resolve_underlay(&tunnels[if_idx], &underlay_ifs[if_idx], &underlay_macs[if_idx]);
+            resolved[if_idx] = true;
+        }
+        if (reasons[if_idx] != DROP_NONE) {
+            drop_ip_packet(pkt, if_idx, reasons[if_idx]);
+            continue;
+        }
+        int underlay_mtu = physical_mtu(underlay_ifs[if_idx]);
+        if (tunnel_encap_len(&tunnels[if_idx], pkt->len) > (size_t) underlay_mtu) {
+            int overhead = (int) tunnel_encap_len(&tunnels[if_idx], sizeof(struct ether_header));
+            tunnel_too_big(pkt, if_idx, underlay_mtu - overhead);
+            continue;
+        }
+        tunnel_encap(&tunnels[if_idx], pkt);
+        ether_push_header(pkt, underlay_ifs[if_idx], &underlay_macs[if_idx], ETHERTYPE_IP);
+        send_packet(pkt->data, pkt->len, pkt->tx_if_idx);
+        pkt_free(pkt);
+    }
+}
+
+static graph_node_t router_nodes[NUM_NODES] = {
+        [NODE_ETHER_INPUT] = {.name = "ether-input", .fn = ether_input_node, .trace_stage = TRACE_PARSE},
+        [NODE_ARP] = {.name = "arp", .fn = arp_node, .trace_stage = TRACE_CONTROL},
+        [NODE_IP6_INPUT] = {.name = "ip6-input", .fn = ip6_input_node, .trace_stage = TRACE_PARSE},
+        [NODE_IP6_LOCAL] = {.name = "ip6-local", .fn = ip6_local_node, .trace_stage = TRACE_CONTROL},
+        [NODE_IP4_INPUT] = {.name = "ip4-input", .fn = ip4_input_node, .trace_stage = TRACE_PARSE},
+        [NODE_IP4_LOCAL] = {.name = "ip4-local", .fn = ip4_local_node, .trace_stage = TRACE_CONTROL},
+        [NODE_TUNNEL_DECAP] = {.name = "tunnel-decap", .fn = tunnel_decap_node, .trace_stage = TRACE_PARSE},
+        [NODE_RIP] = {.name = "rip", .fn = rip_node, .trace_stage = TRACE_CONTROL},
+        [NODE_IP4_LOOKUP] = {.name = "ip4-lookup", .fn = ip4_lookup_node, .trace_stage = TRACE_LOOKUP},
+        [NODE_ICMP_ERROR] = {.name = "icmp-error", .fn = icmp_error_node, .trace_stage = TRACE_CONTROL},
+        [NODE_IP4_REWRITE] = {.name = "ip4-rewrite", .fn = ip4_rewrite_node, .trace_stage = TRACE_RESOLVE},
+        [NODE_IP6_LOOKUP] = {.name = "ip6-lookup", .fn = ip6_lookup_node, .trace_stage = TRACE_LOOKUP},
+        [NODE_IP6_REWRITE] = {.name = "ip6-rewrite", .fn = ip6_rewrite_node, .trace_stage = TRACE_RESOLVE},
+        [NODE_INTERFACE_OUTPUT] = {.name = "interface-output", .fn = interface_output_node, .trace_stage = TRACE_TX},
+        [NODE_TUNNEL_ENCAP] = {.name = "tunnel-encap", .fn = tunnel_encap_node, .trace_stage = TRACE_TX},
+};
+
 RC router_init() {
-    RC rc;
+    RC rc = graph_init(router_nodes, NUM_NODES);
+    if (rc) { return rc; }
+    rc = arena_init(&route_table.arena, (size_t) memory_config.route_table_size * sizeof(route_entry_t),
+                    memory_config.hugepages);
+    if (rc) { return rc; }
+    rc = fib_init(&route_table.fib, memory_config.fib_tbl8_groups, memory_config.hugepages);
+    if (rc) { return rc; }
+    route_table.entries = arena_alloc(&route_table.arena, 0);
+    rc = rib_init(&rib, memory_config.route_table_size, memory_config.hugepages);
+    if (rc) { return rc; }
+    route_ctl_table.max_entries = memory_config.route_table_size;
+    rc = ctl_register(&route_ctl_table);
+    if (rc) { return rc; }
+    rib_ctl_table.max_entries = memory_config.route_table_size * RIB_MAX_PATHS;
+    rc = ctl_register(&rib_ctl_table);
+    if (rc) { return rc; }
     // Insert interface IP into route table
-    for (int i = 0; i < NUM_IF; i++) {
-        insert_route(if_ips[i], if_masks[i], 0, i, 1);
+    for (int i = 0; i < config->num_if; i++) {
+        if (!if_active(i)) { continue; }
+        if (if_is_tunnel(i)) {
+            tunnel_setup(&tunnels[i], &config->if_tunnels[i], &config->if_macs[i]);
+        }
+        rc = add_connected_route(i);
+        if (rc) { return rc; }
     }
+    rc = insert_static_routes();
+    if (rc) { return rc; }
+    commit_routes();
     // Get RIP multicast address
     inet_aton(RIP_MULTICAST_IP_STR, (struct in_addr *) &RIP_MULTICAST_IP);
     rc = arp_get_mac(RIP_MULTICAST_IP, 0, &RIP_MULTICAST_MAC);
@@ -339,99 +987,142 @@ RC router_init() {
     return 0;
 }
 
+// ===== CONFIG RELOAD =====
+static bool if_changed(const config_t *old_config, int if_idx) {
+    const config_t *new_config = config;
+    return strcmp(old_config->if_names[if_idx], new_config->if_names[if_idx]) != 0 ||
+           old_config->if_ips[if_idx] != new_config->if_ips[if_idx] ||
+           old_config->if_masks[if_idx] != new_config->if_masks[if_idx] ||
+           memcmp(&old_config->if_macs[if_idx], &new_config->if_macs[if_idx], sizeof(struct ether_addr)) != 0 ||
+           !IN6_ARE_ADDR_EQUAL(&old_config->if_ip6s[if_idx], &new_config->if_ip6s[if_idx]) ||
+           old_config->if_prefix6_lens[if_idx] != new_config->if_prefix6_lens[if_idx] ||
+           memcmp(&old_config->if_tunnels[if_idx], &new_config->if_tunnels[if_idx], sizeof(tunnel_config_t)) != 0;
+}
+
+static inline bool is_new_if(const config_t *old_config, const config_t *new_config, int if_idx) {
+    return new_config->if_names[if_idx] != NULL && (if_idx >= old_config->num_if || old_config->if_names[if_idx] == NULL);
+}
+
+// A device needs a pcap handle if its slot was empty or held a tunnel, which has none
+static bool needs_open(const config_t *old_config, const config_t *new_config, int if_idx) {
+    return new_config->if_names[if_idx] != NULL && new_config->if_tunnels[if_idx].type == TUNNEL_NONE &&
+           (is_new_if(old_config, new_config, if_idx) || old_config->if_tunnels[if_idx].type != TUNNEL_NONE);
+}
+
+// Runs in reload thread before the new config is published: open new interfaces so that the swap itself is cheap
+static RC router_prepare_config(const config_t *old_config, const config_t *new_config) {
+    for (int i = 0; i < new_config->num_if; i++) {
+        if (needs_open(old_config, new_config, i) && physical_open(i, new_config->if_names[i])) {
+            // Roll back, the new config is dropped
+            while (--i >= 0) {
+                if (needs_open(old_config, new_config, i)) {
+                    physical_close(i);
+                }
+            }
+            return PHYSICAL_INIT_FAIL;
+        }
+    }
+    return 0;
+}
+
+// Runs in forwarding thread right after the swap: update state derived from config. Routes, ARP and neighbor
+// entries learned on unchanged interfaces are kept.
+static void router_reconfigure(const config_t *old_config) {
+    int num_if = old_config->num_if > config->num_if ? old_config->num_if : config->num_if;
+    for (int i = 0; i < num_if; i++) {
+        bool was_active = i < old_config->num_if && old_config->if_names[i] != NULL;
+        bool is_active = i < config->num_if && if_active(i);
+        if ((!was_active && !is_active) || (was_active && is_active && !if_changed(old_config, i))) {
+            continue;
+        }
+        if (was_active) {
+            printf("Interface %s is down\n", old_config->if_names[i]);
+            rib_del_via(&rib, i);
+            arp_if_down(i);
+            ip6_if_down(i);
+            memset(&tunnels[i], 0, sizeof(tunnel_t));
+            if (!is_active || if_is_tunnel(i)) {
+                physical_close(i);
+            }
+        }
+        // Opened by router_prepare_config
+        if (is_active && needs_open(old_config, config, i) && physical_attach(i)) {
+            fprintf(stderr, "Cannot receive from interface %s\n", config->if_names[i]);
+        }
+        if (is_active) {
+            if (if_is_tunnel(i)) {
+                tunnel_setup(&tunnels[i], &config->if_tunnels[i], &config->if_macs[i]);
+            }
+            printf("Interface %s is up: %s", config->if_names[i], ip2str(config->if_ips[i]));
+            printf(" %s\n", ip2str(config->if_masks[i]));
+            add_connected_route(i);
+            arp_if_up(i);
+            ip6_if_up(i);
+        }
+    }
+    // Static routes are few, replace them all. Unchanged ones keep their FIB entries, as their best path is the same.
+    rib_del_from(&rib, ROUTE_STATIC);
+    insert_static_routes();
+    ip6_del_routes_from(ROUTE_STATIC);
+    ip6_insert_static_routes();
+}
+
 _Noreturn void run_router() {
     uint64_t last_timer_fire = 0;
+    uint64_t last_dump = 0;
     while (1) {
+        // Pick up reloaded config between vectors, so that a packet never sees a half applied config
+        const config_t *old_config = config_swap();
+        if (old_config != NULL) {
+            router_reconfigure(old_config);
+        }
+        // Route changes of the last vector, e.g. RIP updates, reach the FIB together
+        commit_routes();
+        // Tables are queried between vectors as well, only the copy is taken here
+        ctl_serve();
+        capture_poll();
         // Timer
         uint64_t curr_time = get_clock_ms();
         if (curr_time - last_timer_fire >= RIP_UPDATE_TIME) {
             printf("Main timer fired, sending RIP response to all interfaces\n");
-            for (int i = 0; i < NUM_IF; i++) {
-                send_rip_response(i);
+            for (int i = 0; i < config->num_if; i++) {
+                if (if_active(i)) {
+                    send_rip_response(i);
+                }
             }
-            print_arp_table();
-            print_route_table();
+            physical_flush();
+            print_fib_stats(&route_table.fib);
+            print_tunnel_stats();
+            print_punt_stats();
+            print_graph_stats();
+            print_pool_stats();
+            print_trace_stats();
             last_timer_fire = curr_time;
         }
-        struct ether_addr src_mac, dst_mac;
-        int if_idx;
-        uint8_t ip_packet[BUFSIZ];
-        size_t ip_len = recv_ip_packet(1000, ip_packet, &if_idx, &src_mac, &dst_mac);
-        if (ip_len == 0) {
-            fprintf(stderr, "Recv packet time out for 1s\n");
-            continue;
+        // Full tables are large, they are dumped only if asked for, and otherwise queried with routerctl
+        if (control_config.dump_interval > 0 && curr_time - last_dump >= control_config.dump_interval * 1000ULL) {
+            print_arp_table();
+            print_route_table();
+            print_neighbor_table();
+            print_route6_table();
+            last_dump = curr_time;
         }
-        if (ip_len < sizeof(struct iphdr)) { continue; }
-        struct iphdr *ip_hdr = (struct iphdr *) ip_packet;
-        if (htons(ip_len) != ip_hdr->tot_len) { continue; }
-        size_t ip_hdr_len = ip_hdr->ihl * 4;
-        if (ip_len < ip_hdr_len) { continue; }
-        // validate checksum
-        uint16_t org_cksum = ip_hdr->check;
-        set_ip_checksum(ip_packet);
-        if (org_cksum != ip_hdr->check) {
-            fprintf(stderr, "Incorrect IP checksum, expected %04x, got %04x\n", ip_hdr->check, org_cksum);
+        pkt_buf_t *pkts[GRAPH_VECTOR_SIZE];
+        int num_pkts = recv_frames(1000, pkts, GRAPH_VECTOR_SIZE);
+        if (num_pkts == 0) {
+            if (!ctl_pending()) {
+                fprintf(stderr, "Recv packet time out for 1s\n");
+            }
             continue;
         }
-        // Check whether dst ip is mine
-        int dst_if;
-        for (dst_if = 0; dst_if < NUM_IF; dst_if++) {
-            if (if_ips[dst_if] == ip_hdr->daddr) {
-                break;
-            }
-        }
-        // Check destination IP
-        if (IN_MULTICAST(ntohl(ip_hdr->daddr))) {
-            if (ip_hdr->daddr == RIP_MULTICAST_IP) {
-                // Dst IP is RIP multicast address
-                if (ip_hdr->protocol == IPPROTO_UDP) {
-                    handle_udp_packet(ip_packet, ip_len, if_idx);
-                } else {
-                    fprintf(stderr, "Unsupported IP protocol %02x\n", ip_hdr->protocol);
-                }
-            }
-        } else if (dst_if < NUM_IF) {
-            // Dst IP is router's interface
-            if (ip_hdr->protocol == IPPROTO_UDP) {
-                handle_udp_packet(ip_packet, ip_len, if_idx);
-            } else if (ip_hdr->protocol == IPPROTO_ICMP) {
-                // Get ICMP echo (request)
-                uint8_t *icmp_packet = ip_packet + ip_hdr_len;
-                size_t icmp_len = ip_len - ip_hdr_len;
-                struct icmphdr *icmp_hdr = (struct icmphdr *) icmp_packet;
-                if (icmp_hdr->type == ICMP_ECHO) {
-                    printf("Sending ICMP reply to %s via %s\n", ip2str(ip_hdr->saddr), if_names[if_idx]);
-                    // Init ICMP packet
-                    icmp_hdr->type = ICMP_ECHOREPLY;
-                    set_icmp_checksum(icmp_packet, icmp_len);
-                    // Init IP packet
-                    SWAP(ip_hdr->saddr, ip_hdr->daddr);
-                    ip_hdr->ttl = IPDEFTTL;
-                    set_ip_checksum(ip_packet);
-                    send_ip_packet(ip_packet, ip_len, if_idx, &src_mac);
-                } else {
-                    fprintf(stderr, "Unsupported ICMP type %02x\n", icmp_hdr->type);
-                }
-            } else {
-                fprintf(stderr, "Unsupported IP protocol %02x\n", ip_hdr->protocol);
-            }
-        } else {
-            // Dst IP is not router's interface: query route table, find next hop, and forward
-            route_entry_t *route = get_route(ip_hdr->daddr);
-            if (route != NULL) {
-                // Found route to host, forward this packet
-                if (ip_hdr->ttl > 1) {
-                    ip_forward(ip_packet, ip_len, route);
-                } else {
-                    fprintf(stderr, "Zero TTL. Sending ICMP Time Exceeded Message\n");
-                    send_icmp_msg(ip_packet, ip_len, if_idx, ICMP_TIME_EXCEEDED, ICMP_EXC_TTL, &src_mac);
-                }
-            } else {
-                fprintf(stderr, "No route to host %s. Sending ICMP Destination Unreachable Message\n",
-                        ip2str(ip_hdr->daddr));
-                send_icmp_msg(ip_packet, ip_len, if_idx, ICMP_DEST_UNREACH, ICMP_NET_UNREACH, &src_mac);
-            }
+        // Sampling counts packets, a sampled vector is traced as its packets go through the nodes together
+        trace_begin(pkts[0]->rx_ns, num_pkts);
+        for (int i = 0; i < num_pkts; i++) {
+            graph_enqueue(NODE_ETHER_INPUT, pkts[i]);
         }
+        graph_dispatch();
+        // Frames sent by the vector leave in one batch
+        physical_flush();
     }
 }
 
@@ -444,12 +1135,24 @@ int main(int argc, char **argv) {
     char *config_path = argv[1];
     rc = config_init(config_path);
     if (rc) { return rc; }
+    rc = config_reload_init(config_path, router_prepare_config);
+    if (rc) { return rc; }
+    rc = pktpool_init(memory_config.packet_buffers, memory_config.hugepages);
+    if (rc) { return rc; }
+    rc = trace_init(trace_config.sample_rate);
+    if (rc) { return rc; }
     rc = physical_init();
     if (rc) { return rc; }
-    rc = ether_init();
+    rc = ether_init(tunnel_output);
     if (rc) { return rc; }
     rc = router_init();
     if (rc) { return rc; }
+    rc = ip6_init();
+    if (rc) { return rc; }
+    rc = capture_init();
+    if (rc) { return rc; }
+    rc = ctl_init("router", config_path);
+    if (rc) { return rc; }
     run_router();
     return 0;
 }
@@ -0,0 +1,79 @@
+#include "error.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Query tables of a running router or switch over its control socket. The remaining arguments form the request:
+//   <table> [lookup KEY] [match TEXT] [offset N] [limit N]
+
+#define REQUEST_SIZE 256
+
+static void usage() {
+    printf("Usage: ./routerctl --socket PATH [tables | <table> [options]]\n"
+           "Tables: route, rib, arp, neighbor, route6 (router), mac (switch)\n"
+           "Options:\n"
+           "  lookup KEY     Entry KEY resolves to: longest prefix match of an address for route and route6,\n"
+           "                 exact address for arp, neighbor and mac\n"
+           "  match TEXT     Only entries containing TEXT, e.g. an interface name\n"
+           "  offset N       Skip the first N entries\n"
+           "  limit N        Show at most N entries\n"
+           "The socket is /tmp/router-<config name>.sock or /tmp/switch-<config name>.sock by default.\n");
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_opts[] = {
+            {"socket", required_argument, NULL, 's'},
+            {NULL, 0,                     NULL, 0},
+    };
+    const char *socket_path = NULL;
+    int opt;
+    // Stop at the first request word, so that request options are not taken for ours
+    while ((opt = getopt_long(argc, argv, "+s:", long_opts, NULL)) != -1) {
+        if (opt == 's') {
+            socket_path = optarg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (socket_path == NULL) {
+        usage();
+        return 1;
+    }
+    char request[REQUEST_SIZE] = "";
+    size_t len = 0;
+    for (int i = optind; i < argc; i++) {
+        int n = snprintf(request + len, sizeof(request) - len, "%s%s", argv[i], i + 1 < argc ? " " : "\n");
+        if (n < 0 || (size_t) n >= sizeof(request) - len) {
+            fprintf(stderr, "Request too long\n");
+            return 1;
+        }
+        len += n;
+    }
+    if (len == 0) {
+        strcpy(request, "tables\n");
+        len = strlen(request);
+    }
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror(socket_path);
+        return 1;
+    }
+    if (write(fd, request, len) != (ssize_t) len) {
+        perror("write()");
+        return 1;
+    }
+    // Response ends when the server closes the connection
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, n, stdout);
+    }
+    close(fd);
+    return n < 0;
+}
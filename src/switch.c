@@ -1,109 +1,762 @@
 #include "physical_layer.h"
 #include "config.h"
+#include "checksum.h"
+#include "capture.h"
+#include "arena.h"
+#include "pktbuf.h"
+#include "ctl.h"
+#include <linux/ip.h>
+#include <linux/igmp.h>
+#include <netinet/ether.h>
 #include <string.h>
 
+// ===== PORT MASK =====
+typedef struct port_mask {
+    uint64_t bits[(MAX_IF + 63) / 64];
+} port_mask_t;
+
+static inline void port_mask_set(port_mask_t *mask, int if_idx) {
+    mask->bits[if_idx / 64] |= 1ULL << (if_idx % 64);
+}
+
+static inline void port_mask_clear(port_mask_t *mask, int if_idx) {
+    mask->bits[if_idx / 64] &= ~(1ULL << (if_idx % 64));
+}
+
+static inline bool port_mask_test(const port_mask_t *mask, int if_idx) {
+    return (mask->bits[if_idx / 64] >> (if_idx % 64)) & 1;
+}
+
+static inline port_mask_t port_mask_and(const port_mask_t *a, const port_mask_t *b) {
+    port_mask_t out;
+    for (int i = 0; i < (MAX_IF + 63) / 64; i++) {
+        out.bits[i] = a->bits[i] & b->bits[i];
+    }
+    return out;
+}
+
+static inline port_mask_t port_mask_or(const port_mask_t *a, const port_mask_t *b) {
+    port_mask_t out;
+    for (int i = 0; i < (MAX_IF + 63) / 64; i++) {
+        out.bits[i] = a->bits[i] | b->bits[i];
+    }
+    return out;
+}
+
+static inline bool port_mask_empty(const port_mask_t *mask) {
+    for (int i = 0; i < (MAX_IF + 63) / 64; i++) {
+        if (mask->bits[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Send packet to every port in mask. Cost is proportional to number of ports in mask.
+static void send_packet_mask(const uint8_t *packet, size_t len, const port_mask_t *mask) {
+    for (int i = 0; i < (MAX_IF + 63) / 64; i++) {
+        uint64_t bits = mask->bits[i];
+        while (bits) {
+            int if_idx = i * 64 + __builtin_ctzll(bits);
+            send_packet(packet, len, if_idx);
+            bits &= bits - 1;
+        }
+    }
+}
+
+// ===== STORM CONTROL =====
+// Token bucket per ingress port and class of flooded traffic, in thousandths of a packet so that low rates still
+// refill every millisecond. Frames are policed before MAC learning and fan-out, against the clock read once per frame.
+#define STORM_TOKEN_UNIT 1000
+#define STORM_QUIET_TIME 1000       // A storm ends after this long (ms) without suppressed frames
+
+typedef struct storm_port {
+    uint64_t tokens[NUM_STORM_CLASSES];
+    uint64_t last_refill[NUM_STORM_CLASSES];
+    uint64_t suppressed[NUM_STORM_CLASSES];
+    uint64_t storm_start;       // Start of current storm (ms), 0 if none
+    uint64_t last_suppressed;
+    uint64_t down_until;        // Shut down until (ms), UINT64_MAX until restart, 0 if up
+    uint64_t shutdown_drops;    // Frames received while shut down
+} storm_port_t;
+
+static storm_port_t storm_ports[MAX_IF];
+
+// Ports not shut down by storm control, only these send and receive
+static port_mask_t up_ports;
+
+static inline uint64_t storm_depth(int if_idx, storm_class_t cls) {
+    const storm_config_t *storm = &config->if_storms[if_idx];
+    uint64_t burst = storm->burst ? storm->burst : storm->rates[cls] / 10;
+    return (burst ? burst : 1) * STORM_TOKEN_UNIT;
+}
+
+static void storm_init(uint64_t now) {
+    for (int if_idx = 0; if_idx < config->num_if; if_idx++) {
+        port_mask_set(&up_ports, if_idx);
+        for (int cls = 0; cls < NUM_STORM_CLASSES; cls++) {
+            storm_ports[if_idx].tokens[cls] = storm_depth(if_idx, cls);
+            storm_ports[if_idx].last_refill[cls] = now;
+        }
+    }
+}
+
+static void storm_shutdown(int if_idx, uint64_t now) {
+    const storm_config_t *storm = &config->if_storms[if_idx];
+    storm_port_t *port = &storm_ports[if_idx];
+    port_mask_clear(&up_ports, if_idx);
+    port->down_until = storm->recovery ? now + (uint64_t) storm->recovery * 1000 : UINT64_MAX;
+    port->storm_start = 0;
+    if (storm->recovery) {
+        printf("Port %s shut down by storm control for %d s\n", config->if_names[if_idx], storm->recovery);
+    } else {
+        printf("Port %s shut down by storm control\n", config->if_names[if_idx]);
+    }
+}
+
+static void storm_recover(uint64_t now) {
+    for (int if_idx = 0; if_idx < config->num_if; if_idx++) {
+        storm_port_t *port = &storm_ports[if_idx];
+        if (port->down_until != 0 && port->down_until <= now) {
+            printf("Port %s recovered from storm control shutdown\n", config->if_names[if_idx]);
+            port->down_until = 0;
+            port_mask_set(&up_ports, if_idx);
+        }
+    }
+}
+
+// Take a token for a frame of class cls received on if_idx. Return false if the frame is to be suppressed.
+static inline bool storm_admit(int if_idx, storm_class_t cls, uint64_t now) {
+    uint32_t rate = config->if_storms[if_idx].rates[cls];
+    if (rate == 0) {
+        return true;
+    }
+    storm_port_t *port = &storm_ports[if_idx];
+    uint64_t elapsed = now - port->last_refill[cls];
+    if (elapsed > 0) {
+        uint64_t depth = storm_depth(if_idx, cls);
+        uint64_t tokens = port->tokens[cls] + elapsed * rate;
+        port->tokens[cls] = tokens > depth ? depth : tokens;
+        port->last_refill[cls] = now;
+    }
+    if (port->tokens[cls] >= STORM_TOKEN_UNIT) {
+        port->tokens[cls] -= STORM_TOKEN_UNIT;
+        return true;
+    }
+    port->suppressed[cls]++;
+    // Sustained storm: frames suppressed without a quiet second in between
+    if (port->storm_start == 0 || now - port->last_suppressed > STORM_QUIET_TIME) {
+        port->storm_start = now;
+    }
+    port->last_suppressed = now;
+    int shutdown_after = config->if_storms[if_idx].shutdown_after;
+    if (shutdown_after > 0 && now - port->storm_start >= (uint64_t) shutdown_after * 1000) {
+        storm_shutdown(if_idx, now);
+    }
+    return false;
+}
+
+void print_storm_stats() {
+    bool configured = false;
+    for (int if_idx = 0; if_idx < config->num_if; if_idx++) {
+        for (int cls = 0; cls < NUM_STORM_CLASSES; cls++) {
+            configured |= config->if_storms[if_idx].rates[cls] != 0;
+        }
+    }
+    if (!configured) {
+        return;
+    }
+    printf("=================== STORM CONTROL SUPPRESSED ===================\n");
+    char separator[] = "+-----------+------------+------------+------------+------------+";
+    printf("%s\n", separator);
+    printf("| %9s | %10s | %10s | %10s | %10s |\n", "IF", "BROADCAST", "MULTICAST", "UNKNOWN", "SHUTDOWN");
+    printf("%s\n", separator);
+    for (int if_idx = 0; if_idx < config->num_if; if_idx++) {
+        storm_port_t *port = &storm_ports[if_idx];
+        printf("| %9s | %10" PRIu64 " | %10" PRIu64 " | %10" PRIu64 " | %10" PRIu64 " |%s\n", config->if_names[if_idx],
+               port->suppressed[STORM_BROADCAST], port->suppressed[STORM_MULTICAST],
+               port->suppressed[STORM_UNKNOWN_UNICAST], port->shutdown_drops, port->down_until ? " down" : "");
+    }
+    printf("%s\n", separator);
+}
+
+// ===== VLAN =====
+typedef struct __attribute__((__packed__)) vlan_tag {
+    uint16_t tpid;
+    uint16_t tci;
+} vlan_tag_t;
+
+#define VLAN_VID_MASK 0x0fff
+
+_Static_assert(PKT_HEADROOM >= sizeof(vlan_tag_t), "no headroom to push VLAN tag");
+
+// Ports of each VLAN which send frames untagged / tagged, precomputed from port config
+static port_mask_t vlan_untagged_ports[VLAN_MAX];
+static port_mask_t vlan_tagged_ports[VLAN_MAX];
+
+static void vlan_init() {
+    for (int if_idx = 0; if_idx < config->num_if; if_idx++) {
+        if (config->if_vlan_modes[if_idx] == VLAN_MODE_ACCESS) {
+            port_mask_set(&vlan_untagged_ports[config->if_pvids[if_idx]], if_idx);
+            printf("Port %s: access VLAN %d\n", config->if_names[if_idx], config->if_pvids[if_idx]);
+            continue;
+        }
+        for (int vid = 1; vid < VLAN_MAX; vid++) {
+            if ((config->if_trunk_vlans[if_idx][vid / 64] >> (vid % 64)) & 1) {
+                port_mask_set(vid == config->if_pvids[if_idx] ? &vlan_untagged_ports[vid] : &vlan_tagged_ports[vid], if_idx);
+            }
+        }
+        printf("Port %s: trunk, native VLAN %d\n", config->if_names[if_idx], config->if_pvids[if_idx]);
+    }
+}
+
+static inline bool vlan_is_member(uint16_t vid, int if_idx) {
+    return port_mask_test(&vlan_untagged_ports[vid], if_idx) || port_mask_test(&vlan_tagged_ports[vid], if_idx);
+}
+
+// Pop 802.1Q tag in place: move MAC addresses forward over the tag. Return the new frame start.
+static inline uint8_t *vlan_pop(uint8_t *frame) {
+    memmove(frame + sizeof(vlan_tag_t), frame, 2 * sizeof(struct ether_addr));
+    return frame + sizeof(vlan_tag_t);
+}
+
+// Push 802.1Q tag in place: move MAC addresses backward into headroom. Return the new frame start.
+static inline uint8_t *vlan_push(uint8_t *frame, uint16_t tci) {
+    uint8_t *tagged = frame - sizeof(vlan_tag_t);
+    memmove(tagged, frame, 2 * sizeof(struct ether_addr));
+    vlan_tag_t *tag = (vlan_tag_t *) (tagged + 2 * sizeof(struct ether_addr));
+    tag->tpid = htons(ETHERTYPE_VLAN);
+    tag->tci = htons(tci);
+    return tagged;
+}
+
+// Send untagged frame to untagged member ports first, then tag it in place and send to tagged member ports
+static void vlan_send(uint8_t *frame, size_t len, uint16_t tci, const port_mask_t *ports) {
+    uint16_t vid = tci & VLAN_VID_MASK;
+    port_mask_t up = port_mask_and(ports, &up_ports);
+    port_mask_t untagged = port_mask_and(&up, &vlan_untagged_ports[vid]);
+    port_mask_t tagged = port_mask_and(&up, &vlan_tagged_ports[vid]);
+    send_packet_mask(frame, len, &untagged);
+    if (!port_mask_empty(&tagged)) {
+        send_packet_mask(vlan_push(frame, tci), len + sizeof(vlan_tag_t), &tagged);
+    }
+}
+
 // ===== MAC TABLE =====
 typedef struct mac_entry {
     struct ether_addr mac;
+    uint16_t vid;
     int if_idx;
 } mac_entry_t;
 
-#define MAC_TABLE_CAPACITY 1024
+// Sized from config at startup, allocated from its own arena
 struct {
-    mac_entry_t entries[MAC_TABLE_CAPACITY];
+    mac_entry_t *entries;
     int size;
+    int capacity;
+    int32_t *slots;     // Hash of (VLAN, MAC) to entry index, -1 if empty
+    uint32_t slot_mask;
+    arena_t arena;
 } mac_table;
 
-static mac_entry_t *get_mac_entry(const struct ether_addr *mac) {
-    for (int i = 0; i < mac_table.size; i++) {
-        mac_entry_t *entry = &mac_table.entries[i];
-        if (memcmp(&entry->mac, mac, sizeof(struct ether_addr)) == 0) {
-            return entry;
+static RC mac_table_init() {
+    mac_table.capacity = memory_config.mac_table_size;
+    // At least twice as many slots as entries, power of 2
+    uint32_t num_slots = 1;
+    while (num_slots < 2 * (uint32_t) mac_table.capacity) {
+        num_slots <<= 1;
+    }
+    mac_table.slot_mask = num_slots - 1;
+    RC rc = arena_init(&mac_table.arena, mac_table.capacity * sizeof(mac_entry_t) + num_slots * sizeof(int32_t) + 128,
+                       memory_config.hugepages);
+    if (rc) { return rc; }
+    mac_table.entries = arena_alloc(&mac_table.arena, mac_table.capacity * sizeof(mac_entry_t));
+    mac_table.slots = arena_alloc(&mac_table.arena, num_slots * sizeof(int32_t));
+    memset(mac_table.slots, -1, num_slots * sizeof(int32_t));
+    mac_table.size = 0;
+    return 0;
+}
+
+static inline uint32_t hash_mac(uint16_t vid, const struct ether_addr *mac) {
+    uint64_t key = vid;
+    memcpy((uint8_t *) &key + 2, mac, sizeof(struct ether_addr));
+    key *= 0x9e3779b97f4a7c15ULL;
+    return (uint32_t) (key >> 40);
+}
+
+static int32_t *find_mac_slot(uint16_t vid, const struct ether_addr *mac) {
+    uint32_t pos = hash_mac(vid, mac) & mac_table.slot_mask;
+    while (mac_table.slots[pos] >= 0) {
+        mac_entry_t *entry = &mac_table.entries[mac_table.slots[pos]];
+        if (entry->vid == vid && memcmp(&entry->mac, mac, sizeof(struct ether_addr)) == 0) {
+            break;
         }
+        pos = (pos + 1) & mac_table.slot_mask;
     }
-    return NULL;
+    return &mac_table.slots[pos];
 }
 
-static RC insert_mac_entry(const struct ether_addr *mac, int if_idx) {
-    mac_entry_t *entry = get_mac_entry(mac);
-    if (entry) {
+static mac_entry_t *get_mac_entry(uint16_t vid, const struct ether_addr *mac) {
+    int32_t *slot = find_mac_slot(vid, mac);
+    return *slot >= 0 ? &mac_table.entries[*slot] : NULL;
+}
+
+static RC insert_mac_entry(uint16_t vid, const struct ether_addr *mac, int if_idx) {
+    int32_t *slot = find_mac_slot(vid, mac);
+    if (*slot >= 0) {
         // Update existing mac entry
-        entry->if_idx = if_idx;
+        mac_table.entries[*slot].if_idx = if_idx;
     } else {
         // Insert a new mac entry
-        if (mac_table.size >= MAC_TABLE_CAPACITY) {
+        if (mac_table.size >= mac_table.capacity) {
             return OVERFLOW_ERROR;
         }
-        fprintf(stderr, "Learned mac of %s is %s\n", if_names[if_idx], mac2str((uint8_t *) mac));
-        entry = &mac_table.entries[mac_table.size];
+        fprintf(stderr, "Learned mac of %s in VLAN %d is %s\n", config->if_names[if_idx], vid, mac2str((uint8_t *) mac));
+        *slot = mac_table.size;
+        mac_entry_t *entry = &mac_table.entries[mac_table.size];
         mac_table.size++;
         memcpy(&entry->mac, mac, sizeof(struct ether_addr));
+        entry->vid = vid;
         entry->if_idx = if_idx;
     }
     return 0;
 }
 
 void print_mac_table() {
-    printf("=========== MAC TABLE ===========\n");
-    char separator[] = "+-------------------+-----------+";
+    printf("=============== MAC TABLE ===============\n");
+    char separator[] = "+------+-------------------+-----------+";
     printf("%s\n", separator);
-    printf("| %17s | %9s |\n", "MAC", "IF");
+    printf("| %4s | %17s | %9s |\n", "VLAN", "MAC", "IF");
     printf("%s\n", separator);
     for (int i = 0; i < mac_table.size; i++) {
         mac_entry_t *entry = &mac_table.entries[i];
-        printf("| %17s | %9s |\n", mac2str((uint8_t *) &entry->mac), if_names[entry->if_idx]);
+        printf("| %4d | %17s | %9s |\n", entry->vid, mac2str((uint8_t *) &entry->mac), config->if_names[entry->if_idx]);
     }
     printf("%s\n", separator);
 }
 
-void broadcast_packet(uint8_t *packet, size_t len, int if_idx) {
-    for (int i = 0; i < NUM_IF; i++) {
-        if (i != if_idx) {
-            send_packet(packet, len, i);
+static int mac_snapshot(void *buf, int offset, int max, int *total) {
+    return ctl_copy_range(buf, mac_table.entries, mac_table.size, sizeof(mac_entry_t), offset, max, total);
+}
+
+static void mac_format(const ctl_snapshot_t *snap, const void *entry, char *line, size_t size) {
+    const mac_entry_t *mac = entry;
+    snprintf(line, size, "%4d %-17s %s", mac->vid, mac2str((uint8_t *) &mac->mac), snap->if_names[mac->if_idx]);
+}
+
+// First entry of a MAC address in any VLAN
+static int mac_lookup(const char *key, void *buf) {
+    struct ether_addr addr;
+    if (ether_aton_r(key, &addr) == NULL) {
+        return CTL_LOOKUP_INVALID;
+    }
+    for (int i = 0; i < mac_table.size; i++) {
+        if (memcmp(&mac_table.entries[i].mac, &addr, sizeof(struct ether_addr)) == 0) {
+            memcpy(buf, &mac_table.entries[i], sizeof(mac_entry_t));
+            return 0;
         }
     }
+    return CTL_LOOKUP_NONE;
+}
+
+static ctl_table_t mac_ctl_table = {
+        .name = "mac",
+        .header = "VLAN MAC               IF",
+        .entry_size = sizeof(mac_entry_t),
+        .snapshot = mac_snapshot,
+        .format = mac_format,
+        .lookup = mac_lookup,
+};
+
+// Flood frame to all other member ports of its VLAN
+void flood_packet(uint8_t *frame, size_t len, uint16_t tci, int if_idx) {
+    uint16_t vid = tci & VLAN_VID_MASK;
+    port_mask_t ports = port_mask_or(&vlan_untagged_ports[vid], &vlan_tagged_ports[vid]);
+    port_mask_clear(&ports, if_idx);
+    vlan_send(frame, len, tci, &ports);
+}
+
+// ===== IGMP SNOOPING =====
+// Group membership is learned from IGMP reports / leaves, router ports from IGMP queries and PIM hellos.
+// Multicast data is only sent to member ports and router ports of its VLAN (RFC 4541).
+typedef struct mcast_entry {
+    in_addr_t group;
+    uint16_t vid;
+    port_mask_t members;
+    uint64_t expires[MAX_IF];   // Membership expire time of each member port
+} mcast_entry_t;
+
+#define MCAST_TABLE_CAPACITY 1024
+#define MCAST_TABLE_SLOTS (2 * MCAST_TABLE_CAPACITY)    // must be power of 2
+
+#define IGMP_MEMBERSHIP_TIMEOUT 260000      // Group membership interval (ms), RFC 3376 8.4
+#define IGMP_ROUTER_TIMEOUT 255000          // Other querier present interval (ms), RFC 3376 8.5
+#define IGMP_LEAVE_TIMEOUT 2000             // Last member query time (ms), RFC 3376 8.8
+#define IGMP_EXPIRE_INTERVAL 1000
+
+static struct {
+    mcast_entry_t entries[MCAST_TABLE_CAPACITY];
+    int size;
+    int16_t slots[MCAST_TABLE_SLOTS];       // Hash of (VLAN, group) to entry index, -1 if empty
+} mcast_table;
+
+// Multicast router ports of each VLAN, each expiring on its own
+static port_mask_t mrouter_ports[VLAN_MAX];
+static uint64_t mrouter_expires[VLAN_MAX][MAX_IF];
+
+static void mcast_table_init() {
+    memset(mcast_table.slots, -1, sizeof(mcast_table.slots));
+    mcast_table.size = 0;
+}
+
+static inline uint32_t mcast_slot_home(uint16_t vid, in_addr_t group) {
+    uint64_t key = ((uint64_t) vid << 32 | group) * 0x9e3779b97f4a7c15ULL;
+    return (uint32_t) (key >> 40) & (MCAST_TABLE_SLOTS - 1);
+}
+
+static int16_t *find_mcast_slot(uint16_t vid, in_addr_t group) {
+    uint32_t pos = mcast_slot_home(vid, group);
+    while (mcast_table.slots[pos] >= 0) {
+        mcast_entry_t *entry = &mcast_table.entries[mcast_table.slots[pos]];
+        if (entry->vid == vid && entry->group == group) {
+            break;
+        }
+        pos = (pos + 1) & (MCAST_TABLE_SLOTS - 1);
+    }
+    return &mcast_table.slots[pos];
+}
+
+static mcast_entry_t *get_mcast_entry(uint16_t vid, in_addr_t group) {
+    int16_t *slot = find_mcast_slot(vid, group);
+    return *slot >= 0 ? &mcast_table.entries[*slot] : NULL;
+}
+
+static void igmp_join(uint16_t vid, in_addr_t group, int if_idx, uint64_t now) {
+    if (!IN_MULTICAST(ntohl(group))) {
+        return;
+    }
+    int16_t *slot = find_mcast_slot(vid, group);
+    if (*slot < 0) {
+        if (mcast_table.size >= MCAST_TABLE_CAPACITY) {
+            fprintf(stderr, "Multicast table overflow\n");
+            return;
+        }
+        *slot = (int16_t) mcast_table.size;
+        mcast_entry_t *entry = &mcast_table.entries[mcast_table.size++];
+        memset(entry, 0, sizeof(mcast_entry_t));
+        entry->group = group;
+        entry->vid = vid;
+    }
+    mcast_entry_t *entry = &mcast_table.entries[*slot];
+    if (!port_mask_test(&entry->members, if_idx)) {
+        printf("Port %s joined group %s in VLAN %d\n", config->if_names[if_idx], ip2str(group), vid);
+        port_mask_set(&entry->members, if_idx);
+    }
+    entry->expires[if_idx] = now + IGMP_MEMBERSHIP_TIMEOUT;
+}
+
+static void igmp_leave(uint16_t vid, in_addr_t group, int if_idx, uint64_t now) {
+    mcast_entry_t *entry = get_mcast_entry(vid, group);
+    if (entry && port_mask_test(&entry->members, if_idx) && entry->expires[if_idx] > now + IGMP_LEAVE_TIMEOUT) {
+        // Keep forwarding until the querier had a chance to ask for remaining members of this port
+        entry->expires[if_idx] = now + IGMP_LEAVE_TIMEOUT;
+    }
+}
+
+// Free entry of a group without members: backward shift delete its slot, then move the last entry into its place
+static void mcast_del_entry(int idx) {
+    mcast_entry_t *entry = &mcast_table.entries[idx];
+    uint32_t hole = (uint32_t) (find_mcast_slot(entry->vid, entry->group) - mcast_table.slots);
+    for (uint32_t next = (hole + 1) & (MCAST_TABLE_SLOTS - 1); mcast_table.slots[next] >= 0;
+         next = (next + 1) & (MCAST_TABLE_SLOTS - 1)) {
+        const mcast_entry_t *moved = &mcast_table.entries[mcast_table.slots[next]];
+        uint32_t home = mcast_slot_home(moved->vid, moved->group);
+        if (((next - home) & (MCAST_TABLE_SLOTS - 1)) >= ((next - hole) & (MCAST_TABLE_SLOTS - 1))) {
+            mcast_table.slots[hole] = mcast_table.slots[next];
+            hole = next;
+        }
+    }
+    mcast_table.slots[hole] = -1;
+    int last = --mcast_table.size;
+    if (idx != last) {
+        mcast_entry_t *moved = &mcast_table.entries[last];
+        *find_mcast_slot(moved->vid, moved->group) = (int16_t) idx;
+        *entry = *moved;
+    }
+}
+
+static void igmp_expire(uint64_t now) {
+    for (int i = 0; i < mcast_table.size;) {
+        mcast_entry_t *entry = &mcast_table.entries[i];
+        for (int if_idx = 0; if_idx < config->num_if; if_idx++) {
+            if (port_mask_test(&entry->members, if_idx) && entry->expires[if_idx] <= now) {
+                printf("Port %s left group %s in VLAN %d\n", config->if_names[if_idx], ip2str(entry->group), entry->vid);
+                port_mask_clear(&entry->members, if_idx);
+            }
+        }
+        if (port_mask_empty(&entry->members)) {
+            // The last entry is moved into i, which is checked next
+            mcast_del_entry(i);
+        } else {
+            i++;
+        }
+    }
+    for (int vid = 1; vid < VLAN_MAX; vid++) {
+        if (port_mask_empty(&mrouter_ports[vid])) {
+            continue;
+        }
+        for (int if_idx = 0; if_idx < config->num_if; if_idx++) {
+            if (port_mask_test(&mrouter_ports[vid], if_idx) && mrouter_expires[vid][if_idx] <= now) {
+                printf("Multicast router port %s timed out in VLAN %d\n", config->if_names[if_idx], vid);
+                port_mask_clear(&mrouter_ports[vid], if_idx);
+            }
+        }
+    }
+}
+
+static void mrouter_detected(uint16_t vid, int if_idx, uint64_t now) {
+    if (!port_mask_test(&mrouter_ports[vid], if_idx)) {
+        printf("Detected multicast router port %s in VLAN %d\n", config->if_names[if_idx], vid);
+        port_mask_set(&mrouter_ports[vid], if_idx);
+    }
+    mrouter_expires[vid][if_idx] = now + IGMP_ROUTER_TIMEOUT;
+}
+
+// Learn from an IGMP message and return the ports it should be forwarded to
+static port_mask_t igmp_snoop(const uint8_t *igmp_packet, size_t igmp_len, uint16_t vid, int if_idx, uint64_t now) {
+    port_mask_t ports = mrouter_ports[vid];
+    if (igmp_len < sizeof(struct igmphdr) || get_cksum16(igmp_packet, igmp_len) != 0) {
+        fprintf(stderr, "Broken IGMP packet\n");
+        return (port_mask_t) {0};
+    }
+    const struct igmphdr *igmp_hdr = (const struct igmphdr *) igmp_packet;
+    switch (igmp_hdr->type) {
+        case IGMP_HOST_MEMBERSHIP_QUERY:
+            // Queries go to every port so that hosts can answer
+            mrouter_detected(vid, if_idx, now);
+            ports = port_mask_or(&vlan_untagged_ports[vid], &vlan_tagged_ports[vid]);
+            break;
+        case IGMP_HOST_MEMBERSHIP_REPORT:
+        case IGMPV2_HOST_MEMBERSHIP_REPORT:
+            igmp_join(vid, igmp_hdr->group, if_idx, now);
+            break;
+        case IGMP_HOST_LEAVE_MESSAGE:
+            igmp_leave(vid, igmp_hdr->group, if_idx, now);
+            break;
+        case IGMPV3_HOST_MEMBERSHIP_REPORT: {
+            const struct igmpv3_report *report = (const struct igmpv3_report *) igmp_packet;
+            size_t offset = sizeof(struct igmpv3_report);
+            for (int i = 0; i < ntohs(report->ngrec); i++) {
+                if (offset + sizeof(struct igmpv3_grec) > igmp_len) {
+                    break;
+                }
+                const struct igmpv3_grec *grec = (const struct igmpv3_grec *) (igmp_packet + offset);
+                int num_src = ntohs(grec->grec_nsrcs);
+                // Source lists are not tracked: any EXCLUDE or non-empty INCLUDE state means the port wants the group
+                if (grec->grec_type == IGMPV3_MODE_IS_EXCLUDE || grec->grec_type == IGMPV3_CHANGE_TO_EXCLUDE ||
+                    ((grec->grec_type == IGMPV3_MODE_IS_INCLUDE || grec->grec_type == IGMPV3_CHANGE_TO_INCLUDE ||
+                      grec->grec_type == IGMPV3_ALLOW_NEW_SOURCES) && num_src > 0)) {
+                    igmp_join(vid, grec->grec_mca, if_idx, now);
+                } else if ((grec->grec_type == IGMPV3_CHANGE_TO_INCLUDE || grec->grec_type == IGMPV3_MODE_IS_INCLUDE) &&
+                           num_src == 0) {
+                    igmp_leave(vid, grec->grec_mca, if_idx, now);
+                }
+                offset += sizeof(struct igmpv3_grec) + num_src * sizeof(in_addr_t) + grec->grec_auxwords * 4;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    port_mask_clear(&ports, if_idx);
+    return ports;
+}
+
+// Forward a frame with multicast dest mac address
+static void forward_multicast(uint8_t *frame, size_t len, uint16_t tci, int if_idx, uint64_t now) {
+    uint16_t vid = tci & VLAN_VID_MASK;
+    struct ether_header *eth_hdr = (struct ether_header *) frame;
+    struct iphdr *ip_hdr = (struct iphdr *) (eth_hdr + 1);
+    if (eth_hdr->ether_type != htons(ETHERTYPE_IP) || len < sizeof(struct ether_header) + sizeof(struct iphdr) ||
+        len < sizeof(struct ether_header) + ip_hdr->ihl * 4 || !IN_MULTICAST(ntohl(ip_hdr->daddr))) {
+        // Not IPv4 multicast, nothing to snoop
+        flood_packet(frame, len, tci, if_idx);
+        return;
+    }
+    size_t ip_hdr_len = ip_hdr->ihl * 4;
+    port_mask_t ports;
+    if (ip_hdr->protocol == IPPROTO_IGMP) {
+        size_t ip_len = ntohs(ip_hdr->tot_len);
+        if (ip_len < ip_hdr_len || ip_len > len - sizeof(struct ether_header)) {
+            return;
+        }
+        ports = igmp_snoop((uint8_t *) ip_hdr + ip_hdr_len, ip_len - ip_hdr_len, vid, if_idx, now);
+    } else if ((ntohl(ip_hdr->daddr) & 0xffffff00) == INADDR_UNSPEC_GROUP) {
+        // Link-local groups 224.0.0.0/24 (e.g. RIP, OSPF, PIM) are always flooded
+        if (ip_hdr->protocol == IPPROTO_PIM) {
+            mrouter_detected(vid, if_idx, now);
+        }
+        flood_packet(frame, len, tci, if_idx);
+        return;
+    } else {
+        mcast_entry_t *entry = get_mcast_entry(vid, ip_hdr->daddr);
+        if (entry == NULL && port_mask_empty(&mrouter_ports[vid])) {
+            // Unregistered group without any querier in this VLAN: snooping cannot be trusted, flood
+            flood_packet(frame, len, tci, if_idx);
+            return;
+        }
+        ports = mrouter_ports[vid];
+        if (entry) {
+            ports = port_mask_or(&ports, &entry->members);
+        }
+        port_mask_clear(&ports, if_idx);
+    }
+    vlan_send(frame, len, tci, &ports);
+}
+
+void print_mcast_table() {
+    printf("============= MULTICAST TABLE =============\n");
+    char separator[] = "+------+-----------------+-----------+";
+    printf("%s\n", separator);
+    printf("| %4s | %15s | %9s |\n", "VLAN", "GROUP", "IF");
+    printf("%s\n", separator);
+    for (int i = 0; i < mcast_table.size; i++) {
+        mcast_entry_t *entry = &mcast_table.entries[i];
+        for (int if_idx = 0; if_idx < config->num_if; if_idx++) {
+            if (port_mask_test(&entry->members, if_idx)) {
+                printf("| %4d | %15s | %9s |\n", entry->vid, ip2str(entry->group), config->if_names[if_idx]);
+            }
+        }
+    }
+    for (int vid = 1; vid < VLAN_MAX; vid++) {
+        for (int if_idx = 0; if_idx < config->num_if; if_idx++) {
+            if (port_mask_test(&mrouter_ports[vid], if_idx)) {
+                printf("| %4d | %15s | %9s |\n", vid, "router", config->if_names[if_idx]);
+            }
+        }
+    }
+    printf("%s\n", separator);
+}
+
+static inline bool is_multicast_mac(const uint8_t *mac) {
+    return mac[0] & 0x01;
 }
 
 static const struct ether_addr BROADCAST_MAC = {"\xff\xff\xff\xff\xff\xff"};
 
-_Noreturn void run_switch() {
+// Every frame is done with by the end of an iteration, so one buffer is reused
+_Noreturn void run_switch(pkt_buf_t *pkt) {
     int print_interval = 5000;
     uint64_t last_time_fire = 0;
+    uint64_t last_dump = 0;
+    uint64_t last_expire = 0;
+    // Clock is read once per frame, timers and storm control use this value
+    uint64_t curr_time = get_clock_ms();
+    storm_init(curr_time);
     while (1) {
-        uint64_t curr_time = get_clock_ms();
+        // Tables are queried between frames, only the copy is taken here
+        ctl_serve();
+        capture_poll();
         if (curr_time - last_time_fire >= print_interval) {
-            print_mac_table();
+            print_storm_stats();
             last_time_fire = curr_time;
         }
+        // Full tables are dumped only if asked for, and otherwise queried with routerctl
+        if (control_config.dump_interval > 0 && curr_time - last_dump >= control_config.dump_interval * 1000ULL) {
+            print_mac_table();
+            print_mcast_table();
+            last_dump = curr_time;
+        }
+        if (curr_time - last_expire >= IGMP_EXPIRE_INTERVAL) {
+            igmp_expire(curr_time);
+            storm_recover(curr_time);
+            last_expire = curr_time;
+        }
         int if_idx;
-        uint8_t packet[BUFSIZ];
-        size_t len = recv_packet(1000, packet, &if_idx);
+        // Packet buffer headroom leaves room to push a VLAN tag in place
+        uint8_t *packet = pkt_reset(pkt);
+        size_t len = recv_packet(1000, packet, &if_idx, NULL);
+        curr_time = get_clock_ms();
         if (len == 0) {
-            fprintf(stderr, "Recv packet time out for 1s\n");
+            if (!ctl_pending()) {
+                fprintf(stderr, "Recv packet time out for 1s\n");
+            }
+            continue;
+        }
+        if (!port_mask_test(&up_ports, if_idx)) {
+            storm_ports[if_idx].shutdown_drops++;
+            CAPTURE(CAPTURE_DROP, if_idx, NULL, packet, len, DROP_STORM);
             continue;
         }
         if (len < sizeof(struct ether_header)) {
             fprintf(stderr, "Broken ethernet packet\n");
+            CAPTURE(CAPTURE_DROP, if_idx, NULL, packet, len, DROP_INVALID);
+            continue;
         }
         struct ether_header *eth_hdr = (struct ether_header *) packet;
-        // Learn source mac address
-        insert_mac_entry((struct ether_addr *) eth_hdr->ether_shost, if_idx);
-        // Check dest mac address
+        // Classify ingress VLAN, internally frames are untagged
+        uint16_t tci;
+        if (eth_hdr->ether_type == htons(ETHERTYPE_VLAN)) {
+            if (len < sizeof(struct ether_header) + sizeof(vlan_tag_t)) {
+                fprintf(stderr, "Broken VLAN packet\n");
+                CAPTURE(CAPTURE_DROP, if_idx, NULL, packet, len, DROP_INVALID);
+                continue;
+            }
+            tci = ntohs(((vlan_tag_t *) (packet + 2 * sizeof(struct ether_addr)))->tci);
+            if ((tci & VLAN_VID_MASK) == 0) {
+                // Priority tagged frame belongs to native VLAN
+                tci |= config->if_pvids[if_idx];
+            }
+            packet = vlan_pop(packet);
+            len -= sizeof(vlan_tag_t);
+            eth_hdr = (struct ether_header *) packet;
+        } else {
+            tci = config->if_pvids[if_idx];
+        }
+        uint16_t vid = tci & VLAN_VID_MASK;
+        if (vid == 0 || !vlan_is_member(vid, if_idx)) {
+            // Untagged frame on trunk without native VLAN, or VLAN not allowed on this port
+            CAPTURE(CAPTURE_DROP, if_idx, NULL, packet, len, DROP_VLAN_FILTER);
+            continue;
+        }
+        // Classify dest mac address, frames that would be flooded are policed before any further work
+        mac_entry_t *mac_entry = NULL;
+        storm_class_t storm_class;
         if (memcmp(eth_hdr->ether_dhost, &BROADCAST_MAC, sizeof(struct ether_addr)) == 0) {
-            // Dest mac is broadcast address
-            broadcast_packet(packet, len, if_idx);
+            storm_class = STORM_BROADCAST;
+        } else if (is_multicast_mac(eth_hdr->ether_dhost)) {
+            storm_class = STORM_MULTICAST;
         } else {
-            // Find next interface by dest mac
-            mac_entry_t *mac_entry = get_mac_entry((struct ether_addr *) eth_hdr->ether_dhost);
-            if (mac_entry) {
-                // Dst mac found: forward this packet to dst interface
-                send_packet(packet, len, mac_entry->if_idx);
-            } else {
-                // Dst mac not found: broadcast
-                fprintf(stderr, "Dest MAC addr %s not found, broadcasting\n", mac2str(eth_hdr->ether_dhost));
-                broadcast_packet(packet, len, if_idx);
+            mac_entry = get_mac_entry(vid, (struct ether_addr *) eth_hdr->ether_dhost);
+            storm_class = mac_entry ? NUM_STORM_CLASSES : STORM_UNKNOWN_UNICAST;
+        }
+        if (storm_class != NUM_STORM_CLASSES && !storm_admit(if_idx, storm_class, curr_time)) {
+            CAPTURE(CAPTURE_DROP, if_idx, NULL, packet, len, DROP_STORM);
+            continue;
+        }
+        // Learn source mac address
+        insert_mac_entry(vid, (struct ether_addr *) eth_hdr->ether_shost, if_idx);
+        if (storm_class == STORM_BROADCAST) {
+            // Dest mac is broadcast address
+            flood_packet(packet, len, tci, if_idx);
+        } else if (storm_class == STORM_MULTICAST) {
+            // Dest mac is multicast address
+            forward_multicast(packet, len, tci, if_idx, curr_time);
+        } else if (mac_entry) {
+            // Dst mac found: forward this packet to dst interface
+            if (mac_entry->if_idx != if_idx) {
+                port_mask_t dst_port = {0};
+                port_mask_set(&dst_port, mac_entry->if_idx);
+                vlan_send(packet, len, tci, &dst_port);
             }
+        } else {
+            // Dst mac not found: flood within VLAN
+            fprintf(stderr, "Dest MAC addr %s not found in VLAN %d, flooding\n",
+                    mac2str(eth_hdr->ether_dhost), vid);
+            flood_packet(packet, len, tci, if_idx);
         }
+        // Copies of the frame leave together, the io_uring backend would otherwise hold them until the next receive
+        physical_flush();
     }
 }
 
@@ -116,8 +769,26 @@ int main(int argc, char **argv) {
     char *config_path = argv[1];
     rc = config_init(config_path);
     if (rc) { return rc; }
+    rc = pktpool_init(memory_config.packet_buffers, memory_config.hugepages);
+    if (rc) { return rc; }
     rc = physical_init();
     if (rc) { return rc; }
-    run_switch();
+    rc = capture_init();
+    if (rc) { return rc; }
+    rc = mac_table_init();
+    if (rc) { return rc; }
+    mac_ctl_table.max_entries = mac_table.capacity;
+    rc = ctl_register(&mac_ctl_table);
+    if (rc) { return rc; }
+    mcast_table_init();
+    vlan_init();
+    rc = ctl_init("switch", config_path);
+    if (rc) { return rc; }
+    pkt_buf_t *pkt = pkt_alloc();
+    if (pkt == NULL) {
+        fprintf(stderr, "Cannot allocate packet buffer\n");
+        return OVERFLOW_ERROR;
+    }
+    run_switch(pkt);
     return 0;
 }
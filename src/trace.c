@@ -0,0 +1,94 @@
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+
+const char *trace_stage_names[NUM_TRACE_STAGES] = {"rx", "parse", "lookup", "resolve", "tx", "control", "total"};
+
+bool trace_active;
+
+static struct {
+    int sample_rate;
+    int countdown;          // Packets until the next sample
+    int vec_size;           // Packets in the sampled vector
+    double ns_per_tick;
+    uint64_t rx_ns;         // Kernel to start of processing of current packet
+    uint64_t begin;         // Ticks at start of processing
+    uint64_t last;          // Ticks at last stamp
+    uint64_t stage_ticks[NUM_TRACE_STAGES];     // Ticks charged to each stage so far
+    uint32_t stages_seen;   // Bit set of stages stamped so far
+    hist_t hists[NUM_TRACE_STAGES];
+} trace;
+
+static inline uint64_t ticks_to_ns(uint64_t ticks) {
+    return (uint64_t) (ticks * trace.ns_per_tick);
+}
+
+RC trace_init(int sample_rate) {
+    trace.sample_rate = trace.countdown = sample_rate;
+    for (int i = 0; i < NUM_TRACE_STAGES; i++) {
+        hist_reset(&trace.hists[i]);
+    }
+    if (sample_rate <= 0) {
+        return 0;
+    }
+#ifdef HAS_TSC
+    // Calibrate TSC against the monotonic clock, assumes an invariant TSC
+    uint64_t start_ns = clock_ns(CLOCK_MONOTONIC), start_ticks = read_ticks();
+    struct timespec wait = {0, 20000000};
+    nanosleep(&wait, NULL);
+    uint64_t end_ns = clock_ns(CLOCK_MONOTONIC), end_ticks = read_ticks();
+    trace.ns_per_tick = (double) (end_ns - start_ns) / (double) (end_ticks - start_ticks);
+#else
+    trace.ns_per_tick = 1;
+#endif
+    printf("Tracing one of every %d packets, per packet stage cost, %.3f GHz tick\n", sample_rate, 1 / trace.ns_per_tick);
+    return 0;
+}
+
+void trace_begin(uint64_t rx_ns, int num_pkts) {
+    trace_active = false;
+    if (trace.sample_rate <= 0 || num_pkts <= 0 || (trace.countdown -= num_pkts) > 0) {
+        return;
+    }
+    // A vector holds at most one sample, keep the phase for the next one
+    trace.countdown = trace.sample_rate + trace.countdown % trace.sample_rate;
+    trace.vec_size = num_pkts;
+    trace_active = true;
+    trace.begin = trace.last = read_ticks();
+    memset(trace.stage_ticks, 0, sizeof(trace.stage_ticks));
+    trace.stages_seen = 0;
+    uint64_t now_ns = clock_ns(CLOCK_REALTIME);
+    trace.rx_ns = rx_ns && now_ns > rx_ns ? now_ns - rx_ns : 0;
+    if (rx_ns) {
+        hist_record(&trace.hists[TRACE_RX], trace.rx_ns);
+    }
+}
+
+void trace_stamp(trace_stage_t stage) {
+    // A stage may be stamped several times, e.g. by several graph nodes, it is recorded once at the end
+    uint64_t now = read_ticks();
+    trace.stage_ticks[stage] += now - trace.last;
+    trace.stages_seen |= 1u << stage;
+    trace.last = now;
+}
+
+void trace_end() {
+    for (int stage = 0; stage < NUM_TRACE_STAGES; stage++) {
+        if (trace.stages_seen & (1u << stage)) {
+            hist_record(&trace.hists[stage], ticks_to_ns(trace.stage_ticks[stage]) / (uint64_t) trace.vec_size);
+        }
+    }
+    hist_record(&trace.hists[TRACE_TOTAL], trace.rx_ns + ticks_to_ns(trace.last - trace.begin));
+    trace_active = false;
+}
+
+void trace_snapshot(hist_t hists[NUM_TRACE_STAGES]) {
+    memcpy(hists, trace.hists, sizeof(trace.hists));
+}
+
+void print_trace_stats() {
+    if (trace.sample_rate <= 0) {
+        return;
+    }
+    print_hist_table("LATENCY TRACE", trace_stage_names, trace.hists, NUM_TRACE_STAGES);
+}
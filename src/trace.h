@@ -0,0 +1,76 @@
+#pragma once
+
+#include "error.h"
+#include "histogram.h"
+#include <inttypes.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_TSC 1
+#endif
+
+// ===== LATENCY TRACE =====
+// Sampled packets are timed at stage boundaries with the TSC, each stage feeds its own histogram:
+//   rx: kernel receive timestamp to start of processing (pcap buffering and receive queues)
+//   parse: header validation, lookup: route lookup, resolve: next hop MAC lookup, tx: transmit
+//   control: packets to the router (ARP, NDP, ICMP echo, RIP) and ICMP errors, kept out of the forwarding stages
+//   total: kernel receive timestamp to end of processing
+// Packets are processed in vectors, a stage records the vector's time divided by its size, i.e. per packet cost.
+// Total is the sampled packet's latency, the whole vector is sent before any of it is done.
+typedef enum {
+    TRACE_RX = 0,
+    TRACE_PARSE,
+    TRACE_LOOKUP,
+    TRACE_RESOLVE,
+    TRACE_TX,
+    TRACE_CONTROL,
+    TRACE_TOTAL,
+    NUM_TRACE_STAGES,
+} trace_stage_t;
+
+extern const char *trace_stage_names[NUM_TRACE_STAGES];
+
+// Whether the packet being processed is sampled, checked on every stamp
+extern bool trace_active;
+
+// Trace one of every sample_rate packets, 0 to disable
+RC trace_init(int sample_rate);
+
+static inline uint64_t clock_ns(clockid_t clock) {
+    struct timespec tp;
+    clock_gettime(clock, &tp);
+    return (uint64_t) tp.tv_sec * 1000000000 + (uint64_t) tp.tv_nsec;
+}
+
+// CPU ticks, nanoseconds where there is no TSC
+static inline uint64_t read_ticks() {
+#ifdef HAS_TSC
+    return __rdtsc();
+#else
+    return clock_ns(CLOCK_MONOTONIC);
+#endif
+}
+
+// Start processing a vector of num_pkts packets, the first received by the kernel at rx_ns (CLOCK_REALTIME),
+// 0 if unknown
+void trace_begin(uint64_t rx_ns, int num_pkts);
+
+// Charge time since the previous stamp to stage
+void trace_stamp(trace_stage_t stage);
+
+// Packet is processed, record stage and total latency
+void trace_end();
+
+#define TRACE_STAMP(stage) do { \
+    if (__builtin_expect(trace_active, 0)) { trace_stamp(stage); } \
+} while (0)
+
+#define TRACE_END() do { \
+    if (__builtin_expect(trace_active, 0)) { trace_end(); } \
+} while (0)
+
+// Copy of stage histograms, for dumping outside the forwarding loop
+void trace_snapshot(hist_t hists[NUM_TRACE_STAGES]);
+
+void print_trace_stats();
@@ -0,0 +1,148 @@
+#include "tunnel.h"
+#include "checksum.h"
+#include <string.h>
+
+#define TUNNEL_TTL 64
+#define VXLAN_SRC_PORT_MIN 49152    // Dynamic port range the flow hash is folded into
+
+void tunnel_setup(tunnel_t *tunnel, const tunnel_config_t *cfg, const struct ether_addr *mac) {
+    memset(tunnel, 0, sizeof(tunnel_t));
+    tunnel->type = cfg->type;
+    tunnel->local = cfg->local;
+    tunnel->remote = cfg->remote;
+    tunnel->vni = cfg->type == TUNNEL_VXLAN ? cfg->vni : 0;
+    tunnel->mac = *mac;
+    tunnel->remote_mac = cfg->remote_mac;
+    static const struct ether_addr zero_mac;
+    tunnel->learn_remote_mac = memcmp(&cfg->remote_mac, &zero_mac, sizeof(struct ether_addr)) == 0;
+    if (tunnel->learn_remote_mac) {
+        // Until a frame is received from the far end
+        memset(&tunnel->remote_mac, 0xff, sizeof(struct ether_addr));
+    }
+    struct iphdr *ip_hdr = (struct iphdr *) tunnel->hdr;
+    *ip_hdr = (struct iphdr) {
+            .version = 4,
+            .ihl = sizeof(struct iphdr) / 4,
+            .frag_off = htons(IP_FLAG_DF),   // Never fragmented, so the ID may stay zero (RFC 6864)
+            .ttl = TUNNEL_TTL,
+            .protocol = tunnel->type == TUNNEL_VXLAN ? IPPROTO_UDP : GRE_PROTO,
+            .saddr = tunnel->local,
+            .daddr = tunnel->remote,
+    };
+    if (tunnel->type == TUNNEL_VXLAN) {
+        struct udphdr *udp_hdr = (struct udphdr *) (ip_hdr + 1);
+        // UDP checksum zero is allowed over IPv4 (RFC 7348 5)
+        udp_hdr->dest = htons(VXLAN_PORT);
+        vxlan_hdr_t *vxlan_hdr = (vxlan_hdr_t *) (udp_hdr + 1);
+        vxlan_hdr->flags = VXLAN_FLAG_VNI;
+        vxlan_hdr->vni = htonl(tunnel->vni << 8);
+    }
+    tunnel->hdr_check = get_cksum16(tunnel->hdr, sizeof(struct iphdr));
+}
+
+// Source port carries a hash of the inner flow, so that the underlay spreads flows over its paths (RFC 7348 5)
+static inline uint16_t vxlan_src_port(const uint8_t *frame, size_t len) {
+    const struct ether_header *eth_hdr = (const struct ether_header *) frame;
+    uint32_t a, b;
+    if (eth_hdr->ether_type == htons(ETHERTYPE_IP) && len >= sizeof(struct ether_header) + sizeof(struct iphdr)) {
+        const struct iphdr *ip_hdr = (const struct iphdr *) (eth_hdr + 1);
+        a = ip_hdr->saddr;
+        b = ip_hdr->daddr;
+    } else {
+        memcpy(&a, eth_hdr->ether_dhost + 2, sizeof(a));
+        memcpy(&b, eth_hdr->ether_shost + 2, sizeof(b));
+    }
+    uint32_t hash = (a ^ b) * 0x9e3779b1u;
+    return htons(VXLAN_SRC_PORT_MIN | (hash >> 18));
+}
+
+void tunnel_encap(tunnel_t *tunnel, pkt_buf_t *pkt) {
+    struct iphdr *ip_hdr;
+    // Template copies are of constant size, so that they compile to a few moves instead of a memcpy call
+    if (tunnel->type == TUNNEL_VXLAN) {
+        uint16_t src_port = vxlan_src_port(pkt->data, pkt->len);
+        ip_hdr = (struct iphdr *) pkt_push(pkt, VXLAN_ENCAP_LEN);
+        memcpy(ip_hdr, tunnel->hdr, VXLAN_ENCAP_LEN);
+        struct udphdr *udp_hdr = (struct udphdr *) (ip_hdr + 1);
+        udp_hdr->source = src_port;
+        udp_hdr->len = htons(pkt->len - sizeof(struct iphdr));
+    } else {
+        uint16_t protocol = ((struct ether_header *) pkt->data)->ether_type;
+        pkt_pull(pkt, sizeof(struct ether_header));
+        ip_hdr = (struct iphdr *) pkt_push(pkt, GRE_ENCAP_LEN);
+        memcpy(ip_hdr, tunnel->hdr, GRE_ENCAP_LEN);
+        ((gre_hdr_t *) (ip_hdr + 1))->protocol = protocol;
+    }
+    ip_hdr->tot_len = htons(pkt->len);
+    ip_hdr->check = cksum_update16(tunnel->hdr_check, 0, ip_hdr->tot_len);
+    tunnel->encap_packets++;
+}
+
+static inline tunnel_t *find_tunnel(tunnel_t *tunnels, int num_tunnels, tunnel_type_t type, const struct iphdr *ip_hdr,
+                                    uint32_t vni) {
+    for (int i = 0; i < num_tunnels; i++) {
+        tunnel_t *tunnel = &tunnels[i];
+        if (tunnel->type == type && tunnel->remote == ip_hdr->saddr && tunnel->local == ip_hdr->daddr &&
+            tunnel->vni == vni) {
+            return tunnel;
+        }
+    }
+    return NULL;
+}
+
+int tunnel_decap(tunnel_t *tunnels, int num_tunnels, pkt_buf_t *pkt) {
+    const struct iphdr *ip_hdr = (const struct iphdr *) pkt->data;
+    size_t ip_hdr_len = ip_hdr->ihl * 4;
+    tunnel_t *tunnel;
+    if (ip_hdr->protocol == IPPROTO_UDP) {
+        const struct udphdr *udp_hdr = (const struct udphdr *) (pkt->data + ip_hdr_len);
+        const vxlan_hdr_t *vxlan_hdr = (const vxlan_hdr_t *) (udp_hdr + 1);
+        size_t hdr_len = ip_hdr_len + sizeof(struct udphdr) + sizeof(vxlan_hdr_t);
+        if (pkt->len < hdr_len + sizeof(struct ether_header) || udp_hdr->dest != htons(VXLAN_PORT) ||
+            !(vxlan_hdr->flags & VXLAN_FLAG_VNI)) {
+            return -1;
+        }
+        tunnel = find_tunnel(tunnels, num_tunnels, TUNNEL_VXLAN, ip_hdr, ntohl(vxlan_hdr->vni) >> 8);
+        if (tunnel == NULL) {
+            return -1;
+        }
+        const struct ether_header *eth_hdr = (const struct ether_header *) (pkt->data + hdr_len);
+        // Inner frames to other hosts on the overlay are not forwarded, broadcast is a multicast address too
+        if (!(eth_hdr->ether_dhost[0] & 0x01) &&
+            memcmp(eth_hdr->ether_dhost, &tunnel->mac, sizeof(struct ether_addr)) != 0) {
+            return -1;
+        }
+        pkt_pull(pkt, hdr_len);
+        if (tunnel->learn_remote_mac) {
+            memcpy(&tunnel->remote_mac, eth_hdr->ether_shost, sizeof(struct ether_addr));
+        }
+    } else if (ip_hdr->protocol == GRE_PROTO) {
+        const gre_hdr_t *gre_hdr = (const gre_hdr_t *) (pkt->data + ip_hdr_len);
+        if (pkt->len < ip_hdr_len + sizeof(gre_hdr_t)) {
+            return -1;
+        }
+        uint16_t flags = ntohs(gre_hdr->flags);
+        // Optional fields are 4 bytes each, checksum and sequence number are not checked. Tunnels have no key, so a
+        // keyed packet belongs to a tunnel of another router (RFC 2890 2.1).
+        size_t hdr_len = ip_hdr_len + sizeof(gre_hdr_t) + (flags & GRE_FLAG_CSUM ? 4 : 0) +
+                         (flags & GRE_FLAG_SEQ ? 4 : 0);
+        if (pkt->len < hdr_len || (flags & GRE_VERSION_MASK) != 0 || (flags & GRE_FLAG_KEY)) {
+            return -1;
+        }
+        tunnel = find_tunnel(tunnels, num_tunnels, TUNNEL_GRE, ip_hdr, 0);
+        if (tunnel == NULL) {
+            return -1;
+        }
+        uint16_t protocol = gre_hdr->protocol;
+        // Inner packet gets an ethernet header in place of the outer headers, as if received on the tunnel device
+        pkt_pull(pkt, hdr_len);
+        struct ether_header *eth_hdr = (struct ether_header *) pkt_push(pkt, sizeof(struct ether_header));
+        memcpy(eth_hdr->ether_dhost, &tunnel->mac, sizeof(struct ether_addr));
+        memcpy(eth_hdr->ether_shost, &tunnel->remote_mac, sizeof(struct ether_addr));
+        eth_hdr->ether_type = protocol;
+    } else {
+        return -1;
+    }
+    tunnel->decap_packets++;
+    return (int) (tunnel - tunnels);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "error.h"
+#include "config.h"
+#include "pktbuf.h"
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+// ===== TUNNEL =====
+// VXLAN (RFC 7348) and GRE (RFC 2784) encapsulation over IPv4. The outer headers of a tunnel are built once into a
+// template with zero lengths. Encapsulation copies the template into the headroom in front of the packet, patches the
+// lengths and updates the template's IP checksum incrementally, the payload is never copied or summed.
+#define VXLAN_PORT 4789
+#define VXLAN_FLAG_VNI 0x08
+#define GRE_PROTO 47
+#define IP_FLAG_DF 0x4000
+
+typedef struct __attribute__((__packed__)) vxlan_hdr {
+    uint8_t flags;
+    uint8_t reserved[3];
+    uint32_t vni;           // VNI in the upper 24 bits, network byte order
+} vxlan_hdr_t;
+
+typedef struct __attribute__((__packed__)) gre_hdr {
+    uint16_t flags;         // Checksum, key and sequence present bits, and version
+    uint16_t protocol;      // Ether type of payload
+} gre_hdr_t;
+
+#define GRE_FLAG_CSUM 0x8000
+#define GRE_FLAG_KEY 0x2000
+#define GRE_FLAG_SEQ 0x1000
+#define GRE_VERSION_MASK 0x0007
+
+#define VXLAN_ENCAP_LEN (sizeof(struct iphdr) + sizeof(struct udphdr) + sizeof(vxlan_hdr_t))
+#define GRE_ENCAP_LEN (sizeof(struct iphdr) + sizeof(gre_hdr_t))
+#define TUNNEL_MAX_HDR_LEN VXLAN_ENCAP_LEN
+
+typedef struct tunnel {
+    tunnel_type_t type;
+    in_addr_t local;
+    in_addr_t remote;
+    uint32_t vni;
+    struct ether_addr mac;          // MAC address of the tunnel interface, source of inner frames
+    struct ether_addr remote_mac;   // Destination of inner VXLAN frames
+    bool learn_remote_mac;          // Take remote_mac from received frames
+    uint8_t hdr[TUNNEL_MAX_HDR_LEN];    // Outer IP and UDP + VXLAN / GRE headers, lengths zero
+    uint16_t hdr_check;             // Outer IP checksum of the template
+    uint64_t encap_packets;
+    uint64_t decap_packets;
+} tunnel_t;
+
+// Length of the outer IP packet an ethernet frame of frame_len bytes is encapsulated into
+static inline size_t tunnel_encap_len(const tunnel_t *tunnel, size_t frame_len) {
+    return tunnel->type == TUNNEL_VXLAN ? frame_len + VXLAN_ENCAP_LEN
+                                        : frame_len - sizeof(struct ether_header) + GRE_ENCAP_LEN;
+}
+
+// Build tunnel from config, mac is the address of the tunnel interface
+void tunnel_setup(tunnel_t *tunnel, const tunnel_config_t *cfg, const struct ether_addr *mac);
+
+// Encapsulate the ethernet frame at pkt->data: VXLAN carries the whole frame, GRE the packet it contains. Data then
+// starts at the outer IP header, ready for the underlay ethernet header. Headroom must hold TUNNEL_MAX_HDR_LEN more
+// bytes, which it always does after the received ethernet header was pulled.
+void tunnel_encap(tunnel_t *tunnel, pkt_buf_t *pkt);
+
+// Find the tunnel of the IP packet at pkt->data, which is addressed to the router, among tunnels indexed by interface.
+// Strip its outer headers and return the tunnel interface, data then starts at an inner ethernet header. Return -1
+// and leave the packet untouched if it is not tunneled, its inner frame is not addressed to the tunnel interface, or
+// it is GRE with a key, as no tunnel is configured with one.
+int tunnel_decap(tunnel_t *tunnels, int num_tunnels, pkt_buf_t *pkt);
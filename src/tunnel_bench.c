@@ -0,0 +1,193 @@
+#include "tunnel.h"
+#include "checksum.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Microbenchmark of tunnel encapsulation and decapsulation as done by the router's tunnel-encap and tunnel-decap
+// nodes: outer headers are pushed from the template into the headroom of a batch of buffers, then stripped again.
+// Payloads are never touched, so the cost per packet should not depend on the frame size.
+
+static const int frame_sizes[] = {64, 512, 1500};
+static const char *type_names[] = {"none", "vxlan", "gre"};
+
+static struct {
+    int packets;
+    int rounds;
+} opts = {
+        .packets = 256,
+        .rounds = 2000,
+};
+
+static inline uint64_t get_ns() {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (uint64_t) tp.tv_sec * 1000000000 + (uint64_t) tp.tv_nsec;
+}
+
+static void usage() {
+    printf("Usage: ./tunnel_bench [options]\n"
+           "Options:\n"
+           "  --packets N    Packets per batch (default 256)\n"
+           "  --rounds N     Batches per measurement (default 2000)\n");
+}
+
+static RC parse_opts(int argc, char **argv) {
+    static const struct option long_opts[] = {
+            {"packets", required_argument, NULL, 'p'},
+            {"rounds",  required_argument, NULL, 'r'},
+            {NULL, 0,                      NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                opts.packets = atoi(optarg);
+                break;
+            case 'r':
+                opts.rounds = atoi(optarg);
+                break;
+            default:
+                return CONFIG_PARSE_FAIL;
+        }
+    }
+    if (opts.packets <= 0 || opts.rounds <= 0) {
+        fprintf(stderr, "Options must be positive\n");
+        return CONFIG_PARSE_FAIL;
+    }
+    return 0;
+}
+
+// Ethernet frame of an IPv4 UDP packet to dst_mac, as received by the router with the ethernet header still in front
+static void make_frame(pkt_buf_t *pkt, int size, uint32_t flow, const struct ether_addr *dst_mac) {
+    uint8_t *frame = pkt_reset(pkt);
+    memset(frame, 0, size);
+    struct ether_header *eth_hdr = (struct ether_header *) frame;
+    memcpy(eth_hdr->ether_dhost, dst_mac, sizeof(struct ether_addr));
+    memset(eth_hdr->ether_shost, 0x04, sizeof(struct ether_addr));
+    eth_hdr->ether_type = htons(ETHERTYPE_IP);
+    struct iphdr *ip_hdr = (struct iphdr *) (eth_hdr + 1);
+    ip_hdr->version = 4;
+    ip_hdr->ihl = sizeof(struct iphdr) / 4;
+    ip_hdr->tot_len = htons(size - sizeof(struct ether_header));
+    ip_hdr->ttl = 64;
+    ip_hdr->protocol = IPPROTO_UDP;
+    ip_hdr->saddr = htonl(0x0a010000 | (flow & 0xffff));
+    ip_hdr->daddr = htonl(0x0a020001);
+    ip_hdr->check = get_cksum16((uint8_t *) ip_hdr, sizeof(struct iphdr));
+    pkt->len = size;
+}
+
+static const struct ether_addr underlay_mac = {{0x02, 0x00, 0x00, 0x00, 0x00, 0x09}};
+
+// Encapsulate and push the underlay ethernet header, as tunnel-encap does before sending
+static inline void encap(tunnel_t *tunnel, pkt_buf_t *pkt) {
+    tunnel_encap(tunnel, pkt);
+    struct ether_header *eth_hdr = (struct ether_header *) pkt_push(pkt, sizeof(struct ether_header));
+    memcpy(eth_hdr->ether_dhost, &underlay_mac, sizeof(struct ether_addr));
+    memcpy(eth_hdr->ether_shost, &tunnel->mac, sizeof(struct ether_addr));
+    eth_hdr->ether_type = htons(ETHERTYPE_IP);
+}
+
+// Pull the underlay ethernet header as ether-input does, then decapsulate
+static inline int decap(tunnel_t *tunnel, pkt_buf_t *pkt) {
+    pkt_pull(pkt, sizeof(struct ether_header));
+    return tunnel_decap(tunnel, 1, pkt);
+}
+
+// One round trip must give back the inner packet, with a valid outer checksum on the way
+static RC verify(tunnel_t *tunnel, tunnel_t *far_end, pkt_buf_t *pkt, int size) {
+    uint8_t inner[2048];
+    memcpy(inner, pkt->data, size);
+    encap(tunnel, pkt);
+    const uint8_t *outer_ip = pkt->data + sizeof(struct ether_header);
+    if (get_cksum16(outer_ip, sizeof(struct iphdr)) != 0 ||
+        ntohs(((const struct iphdr *) outer_ip)->tot_len) != pkt->len - sizeof(struct ether_header)) {
+        fprintf(stderr, "Bad outer IP header of %s\n", type_names[tunnel->type]);
+        return OUT_OF_RANGE_ERROR;
+    }
+    // GRE does not carry the inner ethernet header
+    size_t skip = tunnel->type == TUNNEL_GRE ? sizeof(struct ether_header) : 0;
+    if (decap(far_end, pkt) != 0 || pkt->len != (uint32_t) size ||
+        memcmp(pkt->data + skip, inner + skip, size - skip) != 0) {
+        fprintf(stderr, "Decapsulated %s packet differs\n", type_names[tunnel->type]);
+        return OUT_OF_RANGE_ERROR;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (parse_opts(argc, argv)) {
+        usage();
+        return 1;
+    }
+    pkt_buf_t **pkts = malloc(opts.packets * sizeof(pkt_buf_t *));
+    if (pkts == NULL) {
+        fprintf(stderr, "Cannot allocate packet buffers\n");
+        return 1;
+    }
+    for (int i = 0; i < opts.packets; i++) {
+        pkts[i] = aligned_alloc(64, PKT_BUF_SIZE);
+        if (pkts[i] == NULL) {
+            fprintf(stderr, "Cannot allocate packet buffers\n");
+            return 1;
+        }
+    }
+    const struct ether_addr tunnel_mac = {{0x02, 0x00, 0x0a, 0x00, 0x05, 0x01}};
+    tunnel_config_t configs[] = {
+            {.type = TUNNEL_VXLAN, .vni = 100, .remote_mac = {{0x02, 0x00, 0x0a, 0x00, 0x05, 0x02}}},
+            {.type = TUNNEL_GRE},
+    };
+
+    printf("==================== TUNNEL ENCAP / DECAP ====================\n");
+    char separator[] = "+-------+------+-----------+-----------+----------+----------+";
+    printf("%s\n", separator);
+    printf("| %5s | %4s | %9s | %9s | %8s | %8s |\n", "TYPE", "SIZE", "ENCAP NS", "DECAP NS", "ENC MPPS", "DEC MPPS");
+    printf("%s\n", separator);
+    for (size_t t = 0; t < sizeof(configs) / sizeof(configs[0]); t++) {
+        inet_pton(AF_INET, "192.168.0.1", &configs[t].local);
+        inet_pton(AF_INET, "192.168.0.2", &configs[t].remote);
+        tunnel_t tunnel, far_end;
+        tunnel_setup(&tunnel, &configs[t], &tunnel_mac);
+        // Packets are decapsulated by the far end of the tunnel
+        tunnel_config_t far_config = configs[t];
+        far_config.local = configs[t].remote;
+        far_config.remote = configs[t].local;
+        tunnel_setup(&far_end, &far_config, &tunnel_mac);
+        for (size_t s = 0; s < sizeof(frame_sizes) / sizeof(frame_sizes[0]); s++) {
+            int size = frame_sizes[s];
+            for (int i = 0; i < opts.packets; i++) {
+                // The far end only decapsulates frames addressed to it
+                make_frame(pkts[i], size, i, &far_end.mac);
+            }
+            RC rc = verify(&tunnel, &far_end, pkts[0], size);
+            if (rc) { return rc; }
+            uint64_t encap_ns = 0, decap_ns = 0;
+            for (int round = 0; round < opts.rounds; round++) {
+                uint64_t start = get_ns();
+                for (int i = 0; i < opts.packets; i++) {
+                    encap(&tunnel, pkts[i]);
+                }
+                uint64_t mid = get_ns();
+                for (int i = 0; i < opts.packets; i++) {
+                    decap(&far_end, pkts[i]);
+                }
+                uint64_t end = get_ns();
+                encap_ns += mid - start;
+                decap_ns += end - mid;
+            }
+            double num = (double) opts.packets * opts.rounds;
+            double encap_per_pkt = encap_ns / num, decap_per_pkt = decap_ns / num;
+            printf("| %5s | %4d | %9.2f | %9.2f | %8.1f | %8.1f |\n", type_names[tunnel.type], size,
+                   encap_per_pkt, decap_per_pkt, 1000 / encap_per_pkt, 1000 / decap_per_pkt);
+        }
+    }
+    printf("%s\n", separator);
+    for (int i = 0; i < opts.packets; i++) {
+        free(pkts[i]);
+    }
+    free(pkts);
+    return 0;
+}